@@ -1,7 +1,21 @@
 #include "platform.h"
 #include "arbiter.h"
 
-PBArbiter* PBArbiterCreate(PBBody* b1, PBBody* b2) {
+static PBVec2 PBArbiterGetRelativePosition(PBArbiter* arbiter) {
+  PBMat22 Rot1T = PBMat22Transpose(PBMat22MakeWithAngle(arbiter->body1->rotation));
+  return PBMat22MultVec(Rot1T, PBVec2Sub(arbiter->body2->position, arbiter->body1->position));
+}
+
+// Remember the relative pose the current manifold was built for.
+static void PBArbiterStoreManifoldPose(PBArbiter* arbiter) {
+  arbiter->manifoldRelativePosition = PBArbiterGetRelativePosition(arbiter);
+  arbiter->manifoldRelativeRotation = arbiter->body2->rotation - arbiter->body1->rotation;
+  arbiter->contactsRelativePosition = arbiter->manifoldRelativePosition;
+  arbiter->contactsPosition = arbiter->body1->position;
+  arbiter->contactsRotation = arbiter->body1->rotation;
+}
+
+static PBArbiter* PBArbiterAlloc(PBBody* b1, PBBody* b2) {
   PBArbiter* arbiter = pb_alloc(sizeof(PBArbiter));
   memset(arbiter, 0, sizeof(PBArbiter));
     
@@ -9,26 +23,35 @@ PBArbiter* PBArbiterCreate(PBBody* b1, PBBody* b2) {
         pb_log("playbox: PBArbiter: attempting to create arbiter with NULL body");
     }
   
-  if(b1 < b2) {
-    arbiter->body1 = b1;
-    arbiter->body2 = b2;
-  }
-  else {
-    arbiter->body1 = b2;
-    arbiter->body2 = b1;
-  }
-  
-  arbiter->numContacts = PBCollide(arbiter->contacts, arbiter->body1, arbiter->body2);
+  arbiter->body1 = b1;
+  arbiter->body2 = b2;
   arbiter->friction = sqrtf(arbiter->body1->friction * arbiter->body2->friction);
+  arbiter->index = -1;
   
   return arbiter;
 }
 
+PBArbiter* PBArbiterCreate(PBBody* b1, PBBody* b2) {
+  PBArbiter* arbiter = PBArbiterAlloc(b1, b2);
+  arbiter->numContacts = PBCollide(arbiter->contacts, arbiter->body1, arbiter->body2);
+  PBArbiterStoreManifoldPose(arbiter);
+  return arbiter;
+}
+
+// Contacts must have been generated for the bodies in the same order.
+PBArbiter* PBArbiterCreateWithContacts(PBBody* b1, PBBody* b2, PBContact* contacts, int numContacts) {
+  PBArbiter* arbiter = PBArbiterAlloc(b1, b2);
+  memcpy(arbiter->contacts, contacts, sizeof(PBContact) * numContacts);
+  arbiter->numContacts = numContacts;
+  PBArbiterStoreManifoldPose(arbiter);
+  return arbiter;
+}
+
 void PBArbiterFree(PBArbiter* arbiter) {
   pb_free(arbiter);
 }
 
-void PBArbiterUpdate(PBArbiter* arbiter, PBContact* newContacts, int numNewContacts) {
+void PBArbiterUpdate(PBArbiter* arbiter, PBContact* newContacts, int numNewContacts, int warmStarting) {
   PBContact mergedContacts[2];
   
   for(int i = 0; i < numNewContacts; i++) {
@@ -46,7 +69,7 @@ void PBArbiterUpdate(PBArbiter* arbiter, PBContact* newContacts, int numNewConta
       PBContact* cOld = arbiter->contacts + k;
       PBContact* c = mergedContacts + i;
       *c = *cNew;
-      if(PBWarmStarting) {
+      if(warmStarting) {
         c->Pn = cOld->Pn;
         c->Pt = cOld->Pt;
         c->Pnb = cOld->Pnb;
@@ -67,112 +90,143 @@ void PBArbiterUpdate(PBArbiter* arbiter, PBContact* newContacts, int numNewConta
   }
   
   arbiter->numContacts = numNewContacts;
+  PBArbiterStoreManifoldPose(arbiter);
+}
+
+int PBArbiterReuseManifold(PBArbiter* arbiter, float linearTolerance, float angularTolerance, int warmStarting) {
+  PBBody* b1 = arbiter->body1;
+  PBBody* b2 = arbiter->body2;
+  
+  // Compare the relative pose against the one the manifold was built for.
+  PBVec2 relativePosition = PBArbiterGetRelativePosition(arbiter);
+  PBVec2 drift = PBVec2Sub(relativePosition, arbiter->manifoldRelativePosition);
+  float rotationDrift = (b2->rotation - b1->rotation) - arbiter->manifoldRelativeRotation;
+  
+  if(PBVec2Dot(drift, drift) > linearTolerance * linearTolerance || PBAbs(rotationDrift) > angularTolerance) {
+    return 0;
+  }
+  
+  // Carry the contacts along with body1 and account for the small
+  // relative motion along each normal.
+  PBMat22 Rot1 = PBMat22MakeWithAngle(b1->rotation);
+  PBMat22 RotT = PBMat22Transpose(PBMat22MakeWithAngle(arbiter->contactsRotation));
+  PBVec2 step = PBVec2Sub(relativePosition, arbiter->contactsRelativePosition);
+  
+  for(int i = 0; i < arbiter->numContacts; i++) {
+    PBContact* c = arbiter->contacts + i;
+    PBVec2 localPosition = PBMat22MultVec(RotT, PBVec2Sub(c->position, arbiter->contactsPosition));
+    PBVec2 localNormal = PBMat22MultVec(RotT, c->normal);
+    
+    c->position = PBVec2Add(b1->position, PBMat22MultVec(Rot1, localPosition));
+    c->normal = PBMat22MultVec(Rot1, localNormal);
+    c->separation += PBVec2Dot(step, localNormal);
+    
+    // Match what PBArbiterUpdate does with a freshly built manifold.
+    if(!warmStarting) {
+      c->Pn = 0.0f;
+      c->Pt = 0.0f;
+      c->Pnb = 0.0f;
+    }
+  }
+  
+  arbiter->contactsRelativePosition = relativePosition;
+  arbiter->contactsPosition = b1->position;
+  arbiter->contactsRotation = b1->rotation;
+  
+  return 1;
 }
 
-void PBArbiterPreStep(PBArbiter* arbiter, float inv_dt) {
+// Builds the arbiter's contact constraint for this step and applies the
+// warm start impulses. With splitImpulse set, penetration is resolved by
+// PBContactConstraintApplyPositionImpulse through the bodies' bias velocities
+// instead of being mixed into the velocity solve.
+void PBArbiterPreStep(PBArbiter* arbiter, PBContactConstraint* constraint, PBSolverBody* bodies, float inv_dt, int splitImpulse, int flags) {
   const float k_allowedPenetration = 0.01f;
-  float k_biasFactor = PBPositionCorrection ? 0.2f : 0.0f;
+  float k_biasFactor = (flags & PBSolverPositionCorrection) ? 0.2f : 0.0f;
+
+  constraint->solverIndex1 = arbiter->body1->solverIndex;
+  constraint->solverIndex2 = arbiter->body2->solverIndex;
+  constraint->friction = arbiter->friction;
+  constraint->numPoints = arbiter->numContacts;
+  PBSolverBody* b1 = bodies + constraint->solverIndex1;
+  PBSolverBody* b2 = bodies + constraint->solverIndex2;
+
+  // Every contact in a manifold shares the normal.
+  constraint->normal = arbiter->contacts[0].normal;
+  constraint->tangent = PBVec2CrossF(constraint->normal, 1.0f);
+  PBVec2 normal = constraint->normal;
+  PBVec2 tangent = constraint->tangent;
 
   for(int i = 0; i < arbiter->numContacts; i++) {
     PBContact* c = arbiter->contacts + i;
+    PBContactConstraintPoint* cp = constraint->points + i;
 
     PBVec2 r1 = PBVec2Sub(c->position, arbiter->body1->position);
     PBVec2 r2 = PBVec2Sub(c->position, arbiter->body2->position);
+    cp->r1 = r1;
+    cp->r2 = r2;
 
     // Precompute normal mass, tangent mass, and bias.
-    float rn1 = PBVec2Dot(r1, c->normal);
-    float rn2 = PBVec2Dot(r2, c->normal);
-    float kNormal = arbiter->body1->invMass + arbiter->body2->invMass;
-    kNormal += arbiter->body1->invI * (PBVec2Dot(r1, r1) - rn1 * rn1) + arbiter->body2->invI * (PBVec2Dot(r2, r2) - rn2 * rn2);
-    c->massNormal = 1.0f / kNormal;
+    float rn1 = PBVec2Dot(r1, normal);
+    float rn2 = PBVec2Dot(r2, normal);
+    float kNormal = b1->invMass + b2->invMass;
+    kNormal += b1->invI * (PBVec2Dot(r1, r1) - rn1 * rn1) + b2->invI * (PBVec2Dot(r2, r2) - rn2 * rn2);
+    cp->massNormal = 1.0f / kNormal;
 
-    PBVec2 tangent = PBVec2CrossF(c->normal, 1.0f);
     float rt1 = PBVec2Dot(r1, tangent);
     float rt2 = PBVec2Dot(r2, tangent);
-    float kTangent = arbiter->body1->invMass + arbiter->body2->invMass;
-    kTangent += arbiter->body1->invI * (PBVec2Dot(r1, r1) - rt1 * rt1) + arbiter->body2->invI * (PBVec2Dot(r2, r2) - rt2 * rt2);
-    c->massTangent = 1.0f /  kTangent;
+    float kTangent = b1->invMass + b2->invMass;
+    kTangent += b1->invI * (PBVec2Dot(r1, r1) - rt1 * rt1) + b2->invI * (PBVec2Dot(r2, r2) - rt2 * rt2);
+    cp->massTangent = 1.0f /  kTangent;
 
-    c->bias = -k_biasFactor * inv_dt * PBMin(0.0f, c->separation + k_allowedPenetration);
+    float bias = -k_biasFactor * inv_dt * PBMin(0.0f, c->separation + k_allowedPenetration);
+    cp->bias = splitImpulse ? 0.0f : bias;
+    cp->positionBias = splitImpulse ? bias : 0.0f;
 
-    if(PBAccumulateImpulses) {
-      // Apply normal + friction impulse
-      PBVec2 P = PBVec2Add(PBVec2MultF(c->normal, c->Pn), PBVec2MultF(tangent, c->Pt));
+    cp->Pn = c->Pn;
+    cp->Pt = c->Pt;
+    cp->Pnb = 0.0f;
+  }
 
-      arbiter->body1->velocity = PBVec2Sub(arbiter->body1->velocity, PBVec2MultF(P, arbiter->body1->invMass));
-      arbiter->body1->angularVelocity -= arbiter->body1->invI * PBVec2Cross(r1, P);
+  if(flags & PBSolverAccumulateImpulses) {
+    PBContactConstraintWarmStart(constraint, bodies);
+  }
 
-      arbiter->body2->velocity = PBVec2Add(arbiter->body2->velocity, PBVec2MultF(P, arbiter->body2->invMass));
-      arbiter->body2->angularVelocity += arbiter->body2->invI * PBVec2Cross(r2, P);
+  // Prepare the 2x2 normal block. Nearly parallel rows make the block
+  // ill-conditioned, in which case PBContactConstraintApplyBlockImpulse
+  // falls back to solving the contacts one at a time.
+  constraint->blockSolve = 0;
+  if(constraint->numPoints == 2) {
+    const float k_maxConditionNumber = 1000.0f;
+
+    PBContactConstraintPoint* cp1 = constraint->points;
+    PBContactConstraintPoint* cp2 = constraint->points + 1;
+
+    float rn1A = PBVec2Cross(cp1->r1, normal);
+    float rn1B = PBVec2Cross(cp1->r2, normal);
+    float rn2A = PBVec2Cross(cp2->r1, normal);
+    float rn2B = PBVec2Cross(cp2->r2, normal);
+
+    float mass = b1->invMass + b2->invMass;
+    float k11 = mass + b1->invI * rn1A * rn1A + b2->invI * rn1B * rn1B;
+    float k22 = mass + b1->invI * rn2A * rn2A + b2->invI * rn2B * rn2B;
+    float k12 = mass + b1->invI * rn1A * rn2A + b2->invI * rn1B * rn2B;
+
+    if(k11 * k11 < k_maxConditionNumber * (k11 * k22 - k12 * k12)) {
+      constraint->K = PBMat22Make(PBVec2Make(k11, k12), PBVec2Make(k12, k22));
+      constraint->normalMass = PBMat22Invert(constraint->K);
+      constraint->blockSolve = 1;
     }
   }
 }
 
-void PBArbiterApplyImpulse(PBArbiter* arbiter) {
-  PBBody* b1 = arbiter->body1;
-  PBBody* b2 = arbiter->body2;
-
-  for(int i = 0; i < arbiter->numContacts; ++i) {
+// Copies the solved impulses back for warm starting the next step.
+void PBArbiterStoreImpulses(PBArbiter* arbiter, const PBContactConstraint* constraint) {
+  for(int i = 0; i < constraint->numPoints; i++) {
     PBContact* c = arbiter->contacts + i;
-    c->r1 = PBVec2Sub(c->position, b1->position);
-    c->r2 = PBVec2Sub(c->position, b2->position);
-
-    // Relative velocity at contact
-    PBVec2 dv = PBVec2Sub(PBVec2Sub(PBVec2Add(b2->velocity, PBVec2FCross(b2->angularVelocity, c->r2)), b1->velocity), PBVec2FCross(b1->angularVelocity, c->r1));
-
-    // Compute normal impulse
-    float vn = PBVec2Dot(dv, c->normal);
-
-    float dPn = c->massNormal * (-vn + c->bias);
-
-    if(PBAccumulateImpulses) {
-      // Clamp the accumulated impulse
-      float Pn0 = c->Pn;
-      c->Pn = PBMax(Pn0 + dPn, 0.0f);
-      dPn = c->Pn - Pn0;
-    }
-    else {
-      dPn = PBMax(dPn, 0.0f);
-    }
-
-    // Apply contact impulse
-    PBVec2 Pn = PBVec2MultF(c->normal, dPn);
-
-    b1->velocity = PBVec2Sub(b1->velocity, PBVec2MultF(Pn, b1->invMass));
-    b1->angularVelocity -= b1->invI * PBVec2Cross(c->r1, Pn);
-
-    b2->velocity = PBVec2Add(b2->velocity, PBVec2MultF(Pn, b2->invMass));
-    b2->angularVelocity += b2->invI * PBVec2Cross(c->r2, Pn);
-
-    // Relative velocity at contact
-    dv = PBVec2Sub(PBVec2Sub(PBVec2Add(b2->velocity, PBVec2FCross(b2->angularVelocity, c->r2)), b1->velocity), PBVec2FCross(b1->angularVelocity, c->r1));
-
-    PBVec2 tangent = PBVec2CrossF(c->normal, 1.0f);
-    float vt = PBVec2Dot(dv, tangent);
-    float dPt = c->massTangent * (-vt);
-
-    if(PBAccumulateImpulses) {
-      // Compute friction impulse
-      float maxPt = arbiter->friction * c->Pn;
-
-      // Clamp friction
-      float oldTangentImpulse = c->Pt;
-      c->Pt = PBClamp(oldTangentImpulse + dPt, -maxPt, maxPt);
-      dPt = c->Pt - oldTangentImpulse;
-    }
-    else
-    {
-      float maxPt = arbiter->friction * dPn;
-      dPt = PBClamp(dPt, -maxPt, maxPt);
-    }
-
-    // Apply contact impulse
-    PBVec2 Pt = PBVec2MultF(tangent, dPt);
-
-    b1->velocity = PBVec2Sub(b1->velocity, PBVec2MultF(Pt, b1->invMass));
-    b1->angularVelocity -= b1->invI * PBVec2Cross(c->r1, Pt);
-
-    b2->velocity = PBVec2Add(b2->velocity, PBVec2MultF(Pt, b2->invMass));
-    b2->angularVelocity += b2->invI * PBVec2Cross(c->r2, Pt);
+    const PBContactConstraintPoint* cp = constraint->points + i;
+    c->Pn = cp->Pn;
+    c->Pt = cp->Pt;
+    c->Pnb = cp->Pnb;
   }
 }
@@ -3,6 +3,7 @@
 
 #include "maths.h"
 #include "body.h"
+#include "solver.h"
 #include <stdint.h>
 
 typedef union {
@@ -15,27 +16,35 @@ typedef union {
   uint32_t value;
 } PBFeaturePair;
 
+// Narrowphase output, plus the last step's impulses for warm starting.
+// Per-step solver data lives in PBContactConstraint.
 typedef struct {
   PBVec2 position;
   PBVec2 normal;
-  PBVec2 r1, r2;
   float separation;
   float Pn;  // accumulated normal impulse
   float Pt;  // accumulated tangent impulse
   float Pnb;  // accumulated normal impulse for position bias
-  float massNormal, massTangent;
-  float bias;
   PBFeaturePair feature;
 } PBContact;
 
-#ifndef MAX_ARBITER_POINTS
-#define MAX_ARBITER_POINTS 2
-#endif
+struct PBArbiter;
 
-typedef struct {
+// Links an arbiter into the arbiter list of one of its bodies.
+typedef struct PBArbiterEdge {
+  PBBody* other;
+  struct PBArbiter* arbiter;
+  struct PBArbiterEdge* prev;
+  struct PBArbiterEdge* next;
+} PBArbiterEdge;
+
+typedef struct PBArbiter {
   // Connectivity
   PBBody* body1;
   PBBody* body2;
+  PBArbiterEdge edge1;
+  PBArbiterEdge edge2;
+  int index;  // position in the world's arbiter array
 
   // Combined friction
   float friction;
@@ -43,13 +52,22 @@ typedef struct {
   // Run-time data
   int numContacts;
   PBContact contacts[MAX_ARBITER_POINTS];
+  
+  // Manifold reuse
+  PBVec2 manifoldRelativePosition;  // body2 in body1's frame when the manifold was built
+  float manifoldRelativeRotation;
+  PBVec2 contactsRelativePosition;  // body2 in body1's frame when the contacts were last placed
+  PBVec2 contactsPosition;  // body1 pose when the contacts were last placed
+  float contactsRotation;
 } PBArbiter;
 
 extern PBArbiter* PBArbiterCreate(PBBody* body1, PBBody* body2);
+extern PBArbiter* PBArbiterCreateWithContacts(PBBody* body1, PBBody* body2, PBContact* contacts, int numContacts);
 extern void PBArbiterFree(PBArbiter* arbiter);
-extern void PBArbiterUpdate(PBArbiter* arbiter, PBContact* newContacts, int numNewContacts);
-extern void PBArbiterPreStep(PBArbiter* arbiter, float inv_dt);
-extern void PBArbiterApplyImpulse(PBArbiter* arbiter);
+extern void PBArbiterUpdate(PBArbiter* arbiter, PBContact* newContacts, int numNewContacts, int warmStarting);
+extern int PBArbiterReuseManifold(PBArbiter* arbiter, float linearTolerance, float angularTolerance, int warmStarting);
+extern void PBArbiterPreStep(PBArbiter* arbiter, PBContactConstraint* constraint, PBSolverBody* bodies, float inv_dt, int splitImpulse, int flags);
+extern void PBArbiterStoreImpulses(PBArbiter* arbiter, const PBContactConstraint* constraint);
 
 extern int PBCollide(PBContact* contacts, PBBody* body1, PBBody* body2);
 
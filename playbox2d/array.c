@@ -5,7 +5,7 @@ PBArray* PBArrayCreate(size_t item_size) {
   PBArray* array = (PBArray*)pb_alloc(sizeof(PBArray));
   memset(array, 0, sizeof(PBArray));
   array->item_size = item_size;
-  pb_log("PBArray: creating with item size %i", array->item_size);
+  pb_log("PBArray: creating with item size %i", (int)array->item_size);
   return array;
 }
   
@@ -27,12 +27,41 @@ void* PBArrayGetItem(PBArray* array, int i) {
 
 void PBArrayRemoveAllItems(PBArray* array) {
   array->count = 0;
+  array->capacity = 0;
   if(array->first != NULL) {
     pb_free(array->first);
     array->first = NULL;
   }
 }
 
+void PBArrayReserve(PBArray* array, int capacity) {
+  if(capacity <= array->capacity) {
+    return;
+  }
+  
+  if(array->first == NULL) {
+    array->first = pb_alloc(array->item_size * capacity);
+  }
+  else {
+    array->first = pb_realloc(array->first, array->item_size * capacity);
+  }
+  array->capacity = capacity;
+}
+
+// Grows or truncates the array in place. New items are zeroed.
+void PBArraySetCount(PBArray* array, int count) {
+  if(count < 0) {
+    pb_log("PBArray: attempt to set negative count");
+    return;
+  }
+  
+  PBArrayReserve(array, count);
+  if(count > array->count) {
+    memset(array->first + (array->item_size * array->count), 0, array->item_size * (count - array->count));
+  }
+  array->count = count;
+}
+
 void PBArrayRemoveItem(PBArray* array, void* item) {
   int i = PBArrayIndexOfItem(array, item);
   if(i != -1) {
@@ -49,17 +78,13 @@ void PBArrayAppendItem(PBArray* array, void* item) {
     return;
   }
   
-  array->count++;
-  
-  if(array->first == NULL) {
-    array->first = pb_alloc(array->item_size);
-    memset(array->first, 0, array->item_size);
-  }
-  else {
-    array->first = pb_realloc(array->first, array->item_size * array->count);
-    memset(array->first + (array->item_size * (array->count - 1)), 0, array->item_size);
+  // Grow geometrically so bursts of appends don't realloc every time.
+  if(array->count == array->capacity) {
+    PBArrayReserve(array, array->capacity > 0 ? array->capacity * 2 : 4);
   }
   
+  array->count++;
+  
   memcpy(array->first + (array->item_size * (array->count - 1)), item, array->item_size);
 }
   
@@ -88,10 +113,23 @@ void PBArrayRemoveItemAt(PBArray* array, int i) {
   if(array->count == 0) {
     pb_free(array->first);
     array->first = NULL;
+    array->capacity = 0;
   }
-  else {
-    array->first = pb_realloc(array->first, array->item_size * array->count);
+}
+  
+// Removes the item by moving the last item into its slot. Does not preserve order.
+void PBArraySwapRemoveItemAt(PBArray* array, int i) {
+  if(i < 0 || i >= array->count) {
+    pb_log("PBArray: attempt to swap-erase item outside of bounds");
+    return;
   }
+  
+  int last = array->count - 1;
+  if(i != last) {
+    memcpy(array->first + (array->item_size * i), array->first + (array->item_size * last), array->item_size);
+  }
+  
+  PBArrayRemoveItemAt(array, last);
 }
   
 void* PBArrayFindItem(PBArray* array, int (*find_function)(void* item, int i)) {
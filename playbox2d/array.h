@@ -5,6 +5,7 @@
 
 typedef struct {
   int count;
+  int capacity;
   size_t item_size;
   void* first;
 } PBArray;
@@ -12,9 +13,12 @@ typedef struct {
 extern PBArray* PBArrayCreate(size_t item_size);
 extern void PBArrayFree(PBArray* array);
 extern void PBArrayRemoveAllItems(PBArray* array);
+extern void PBArrayReserve(PBArray* array, int capacity);
+extern void PBArraySetCount(PBArray* array, int count);
 extern void* PBArrayGetItem(PBArray* array, int i);
 extern void PBArrayAppendItem(PBArray* array, void* item);
 extern void PBArrayRemoveItemAt(PBArray* array, int i);
+extern void PBArraySwapRemoveItemAt(PBArray* array, int i);
 extern void* PBArrayFindItem(PBArray* array, int (*find_function)(void* item, int i));
 extern int PBArrayIndexOfItem(PBArray* array, void* item);
 extern void PBArrayRemoveItem(PBArray* array, void* item);
@@ -0,0 +1,310 @@
+#include "async.h"
+
+#ifdef PB_THREADS
+
+#include <stdint.h>
+
+#include "platform.h"
+
+PBBody* PBWorldGetBody(PBWorld* world, int i);
+
+// FRAMES
+
+static void PBWorldFrameInit(PBWorldFrame* frame) {
+  frame->step = 0;
+  frame->transforms = PBArrayCreate(sizeof(PBBodyTransform));
+  frame->contactEvents = PBArrayCreate(sizeof(PBContactEvent));
+}
+
+static void PBWorldFrameFree(PBWorldFrame* frame) {
+  PBArrayFree(frame->transforms);
+  PBArrayFree(frame->contactEvents);
+}
+
+static void PBAsyncWorldWriteTransforms(PBAsyncWorld* async, PBWorldFrame* frame) {
+  PBWorld* world = async->world;
+  PBArraySetCount(frame->transforms, world->bodies->count);
+  PBBodyTransform* transforms = frame->transforms->first;
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBBody* body = PBWorldGetBody(world, i);
+    transforms[i].body = body;
+    transforms[i].position = body->position;
+    transforms[i].rotation = body->rotation;
+    transforms[i].velocity = body->velocity;
+    transforms[i].angularVelocity = body->angularVelocity;
+  }
+}
+
+// CONTACT EVENTS
+
+static int PBBodyPairCompare(const void* a, const void* b) {
+  const PBBodyPair* pa = a;
+  const PBBodyPair* pb = b;
+  uintptr_t a1 = (uintptr_t)pa->body1, b1 = (uintptr_t)pb->body1;
+  if(a1 != b1) {
+    return a1 < b1 ? -1 : 1;
+  }
+  uintptr_t a2 = (uintptr_t)pa->body2, b2 = (uintptr_t)pb->body2;
+  if(a2 != b2) {
+    return a2 < b2 ? -1 : 1;
+  }
+  return 0;
+}
+
+static void PBAsyncWorldAppendEvent(PBWorldFrame* frame, PBContactEventType type, const PBBodyPair* pair) {
+  PBContactEvent event = { .type = type, .body1 = pair->body1, .body2 = pair->body2 };
+  PBArrayAppendItem(frame->contactEvents, &event);
+}
+
+// Arbiters exist while bodies touch, so contact events are the difference
+// between this step's sorted arbiter pairs and the last step's.
+static void PBAsyncWorldWriteContactEvents(PBAsyncWorld* async, PBWorldFrame* frame) {
+  PBWorld* world = async->world;
+  
+  PBArray* swap = async->previousContacts;
+  async->previousContacts = async->contacts;
+  async->contacts = swap;
+  
+  PBArraySetCount(async->contacts, 0);
+  for(int i = 0; i < world->arbiters->count; i++) {
+    PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+    if(arbiter->numContacts == 0) {
+      continue;
+    }
+    PBBodyPair pair = { .body1 = arbiter->body1, .body2 = arbiter->body2 };
+    if((uintptr_t)pair.body2 < (uintptr_t)pair.body1) {
+      pair.body1 = arbiter->body2;
+      pair.body2 = arbiter->body1;
+    }
+    PBArrayAppendItem(async->contacts, &pair);
+  }
+  if(async->contacts->count > 1) {
+    qsort(async->contacts->first, async->contacts->count, sizeof(PBBodyPair), PBBodyPairCompare);
+  }
+  
+  PBArraySetCount(frame->contactEvents, 0);
+  const PBBodyPair* current = async->contacts->first;
+  const PBBodyPair* previous = async->previousContacts->first;
+  int i = 0, j = 0;
+  while(i < async->contacts->count || j < async->previousContacts->count) {
+    int order;
+    if(i == async->contacts->count) {
+      order = 1;
+    }
+    else if(j == async->previousContacts->count) {
+      order = -1;
+    }
+    else {
+      order = PBBodyPairCompare(&current[i], &previous[j]);
+    }
+    
+    if(order < 0) {
+      PBAsyncWorldAppendEvent(frame, PBContactEventBegin, &current[i++]);
+    }
+    else if(order > 0) {
+      PBAsyncWorldAppendEvent(frame, PBContactEventEnd, &previous[j++]);
+    }
+    else {
+      i++;
+      j++;
+    }
+  }
+}
+
+// WORKER
+
+static void* PBAsyncWorldThread(void* context) {
+  PBAsyncWorld* async = context;
+  
+  pthread_mutex_lock(&async->mutex);
+  for(;;) {
+    while(!async->quit && (!async->running || async->done)) {
+      pthread_cond_wait(&async->cond, &async->mutex);
+    }
+    if(async->quit) {
+      break;
+    }
+    float dt = async->dt;
+    pthread_mutex_unlock(&async->mutex);
+    
+    // The world and the back frame belong to this thread until the step is joined
+    PBWorldFrame* frame = &async->frames[1 - async->front];
+    PBWorldStep(async->world, dt);
+    frame->step = async->frames[async->front].step + 1;
+    PBAsyncWorldWriteTransforms(async, frame);
+    PBAsyncWorldWriteContactEvents(async, frame);
+    
+    pthread_mutex_lock(&async->mutex);
+    async->done = 1;
+    pthread_cond_broadcast(&async->cond);
+  }
+  pthread_mutex_unlock(&async->mutex);
+  
+  return NULL;
+}
+
+// ASYNC WORLD
+
+static void PBAsyncWorldFreeResources(PBAsyncWorld* async) {
+  pthread_mutex_destroy(&async->mutex);
+  pthread_cond_destroy(&async->cond);
+  PBWorldFrameFree(&async->frames[0]);
+  PBWorldFrameFree(&async->frames[1]);
+  PBArrayFree(async->commands);
+  PBArrayFree(async->contacts);
+  PBArrayFree(async->previousContacts);
+  pb_free(async);
+}
+
+// Returns NULL if the worker thread can't be started.
+PBAsyncWorld* PBAsyncWorldCreate(PBWorld* world) {
+  PBAsyncWorld* async = pb_alloc(sizeof(PBAsyncWorld));
+  memset(async, 0, sizeof(PBAsyncWorld));
+  
+  async->world = world;
+  PBWorldFrameInit(&async->frames[0]);
+  PBWorldFrameInit(&async->frames[1]);
+  async->commands = PBArrayCreate(sizeof(PBAsyncCommand));
+  async->contacts = PBArrayCreate(sizeof(PBBodyPair));
+  async->previousContacts = PBArrayCreate(sizeof(PBBodyPair));
+  
+  // Start with the world as it is, so the front frame is valid before the first join
+  PBAsyncWorldWriteTransforms(async, &async->frames[0]);
+  
+  pthread_mutex_init(&async->mutex, NULL);
+  pthread_cond_init(&async->cond, NULL);
+  if(pthread_create(&async->thread, NULL, PBAsyncWorldThread, async) != 0) {
+    pb_log("playbox: PBAsyncWorld: failed to start worker thread");
+    PBAsyncWorldFreeResources(async);
+    return NULL;
+  }
+  
+  return async;
+}
+
+void PBAsyncWorldFree(PBAsyncWorld* async) {
+  PBAsyncWorldJoin(async);
+  
+  pthread_mutex_lock(&async->mutex);
+  async->quit = 1;
+  pthread_cond_broadcast(&async->cond);
+  pthread_mutex_unlock(&async->mutex);
+  pthread_join(async->thread, NULL);
+  
+  PBAsyncWorldFreeResources(async);
+}
+
+static void PBAsyncWorldApplyCommand(PBAsyncWorld* async, const PBAsyncCommand* command) {
+  PBWorld* world = async->world;
+  PBBody* body = command->body;
+  
+  switch(command->type) {
+    case PBAsyncCommandSetPosition:
+      body->position = command->v;
+      if(body->world == world) {
+        PBWorldUpdateBody(world, body);
+      }
+      break;
+    case PBAsyncCommandSetRotation:
+      body->rotation = command->f;
+      if(body->world == world) {
+        PBWorldUpdateBody(world, body);
+      }
+      break;
+    case PBAsyncCommandSetVelocity:
+      body->velocity = command->v;
+      break;
+    case PBAsyncCommandSetAngularVelocity:
+      body->angularVelocity = command->f;
+      break;
+    case PBAsyncCommandAddForce:
+      PBBodyAddForce(body, command->v);
+      break;
+    case PBAsyncCommandAddBody:
+      PBWorldAddBody(world, body);
+      break;
+    case PBAsyncCommandRemoveBody:
+      PBWorldRemoveBody(world, body);
+      break;
+  }
+}
+
+// Applies a change now when the world is idle, or after the running step is joined.
+static void PBAsyncWorldSubmit(PBAsyncWorld* async, PBAsyncCommand command) {
+  if(async->running) {
+    PBArrayAppendItem(async->commands, &command);
+  }
+  else {
+    PBAsyncWorldApplyCommand(async, &command);
+  }
+}
+
+void PBAsyncWorldBeginStep(PBAsyncWorld* async, float dt) {
+  PBAsyncWorldJoin(async);
+  
+  pthread_mutex_lock(&async->mutex);
+  async->dt = dt;
+  async->done = 0;
+  async->running = 1;
+  pthread_cond_broadcast(&async->cond);
+  pthread_mutex_unlock(&async->mutex);
+}
+
+void PBAsyncWorldJoin(PBAsyncWorld* async) {
+  if(!async->running) {
+    return;
+  }
+  
+  pthread_mutex_lock(&async->mutex);
+  while(!async->done) {
+    pthread_cond_wait(&async->cond, &async->mutex);
+  }
+  async->running = 0;
+  pthread_mutex_unlock(&async->mutex);
+  
+  async->front = 1 - async->front;
+  
+  const PBAsyncCommand* commands = async->commands->first;
+  for(int i = 0; i < async->commands->count; i++) {
+    PBAsyncWorldApplyCommand(async, &commands[i]);
+  }
+  PBArraySetCount(async->commands, 0);
+}
+
+int PBAsyncWorldIsStepping(PBAsyncWorld* async) {
+  return async->running;
+}
+
+const PBWorldFrame* PBAsyncWorldGetFrame(PBAsyncWorld* async) {
+  return &async->frames[async->front];
+}
+
+void PBAsyncWorldSetPosition(PBAsyncWorld* async, PBBody* body, PBVec2 position) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandSetPosition, .body = body, .v = position });
+}
+
+void PBAsyncWorldSetRotation(PBAsyncWorld* async, PBBody* body, float rotation) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandSetRotation, .body = body, .f = rotation });
+}
+
+void PBAsyncWorldSetVelocity(PBAsyncWorld* async, PBBody* body, PBVec2 velocity) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandSetVelocity, .body = body, .v = velocity });
+}
+
+void PBAsyncWorldSetAngularVelocity(PBAsyncWorld* async, PBBody* body, float angularVelocity) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandSetAngularVelocity, .body = body, .f = angularVelocity });
+}
+
+void PBAsyncWorldAddForce(PBAsyncWorld* async, PBBody* body, PBVec2 force) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandAddForce, .body = body, .v = force });
+}
+
+void PBAsyncWorldAddBody(PBAsyncWorld* async, PBBody* body) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandAddBody, .body = body });
+}
+
+void PBAsyncWorldRemoveBody(PBAsyncWorld* async, PBBody* body) {
+  PBAsyncWorldSubmit(async, (PBAsyncCommand){ .type = PBAsyncCommandRemoveBody, .body = body });
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef PLAYBOX_ASYNC_H
+#define PLAYBOX_ASYNC_H
+
+// Background world stepping for threaded host builds. The Playdate has no
+// threads, so this is only compiled when PB_THREADS is defined.
+#ifdef PB_THREADS
+
+#include <pthread.h>
+
+#include "maths.h"
+#include "body.h"
+#include "array.h"
+#include "world.h"
+
+typedef struct {
+  PBBody* body;
+  PBVec2 position;
+  float rotation;
+  PBVec2 velocity;
+  float angularVelocity;
+} PBBodyTransform;
+
+typedef enum {
+  PBContactEventBegin = 0,
+  PBContactEventEnd
+} PBContactEventType;
+
+typedef struct {
+  PBContactEventType type;
+  PBBody* body1;
+  PBBody* body2;
+} PBContactEvent;
+
+// Results of one step. Frames are not modified while they are the front frame.
+typedef struct {
+  int step;
+  PBArray* transforms;  // PBBodyTransform per body, in world order
+  PBArray* contactEvents;  // PBContactEvent for pairs that started or stopped touching
+} PBWorldFrame;
+
+typedef enum {
+  PBAsyncCommandSetPosition,
+  PBAsyncCommandSetRotation,
+  PBAsyncCommandSetVelocity,
+  PBAsyncCommandSetAngularVelocity,
+  PBAsyncCommandAddForce,
+  PBAsyncCommandAddBody,
+  PBAsyncCommandRemoveBody
+} PBAsyncCommandType;
+
+typedef struct {
+  PBAsyncCommandType type;
+  PBBody* body;
+  PBVec2 v;
+  float f;
+} PBAsyncCommand;
+
+typedef struct {
+  PBWorld* world;
+  
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int running;  // a step has been started and not joined yet
+  int done;  // the worker finished the running step
+  int quit;
+  float dt;
+  
+  // The caller reads the front frame while the worker fills the back one
+  PBWorldFrame frames[2];
+  int front;
+  
+  // Changes made while a step is running, applied when it is joined
+  PBArray* commands;
+  
+  // Touching body pairs, sorted, for deriving contact events
+  PBArray* contacts;
+  PBArray* previousContacts;
+} PBAsyncWorld;
+
+extern PBAsyncWorld* PBAsyncWorldCreate(PBWorld* world);
+extern void PBAsyncWorldFree(PBAsyncWorld* async);
+extern void PBAsyncWorldBeginStep(PBAsyncWorld* async, float dt);
+extern void PBAsyncWorldJoin(PBAsyncWorld* async);
+extern int PBAsyncWorldIsStepping(PBAsyncWorld* async);
+extern const PBWorldFrame* PBAsyncWorldGetFrame(PBAsyncWorld* async);
+
+extern void PBAsyncWorldSetPosition(PBAsyncWorld* async, PBBody* body, PBVec2 position);
+extern void PBAsyncWorldSetRotation(PBAsyncWorld* async, PBBody* body, float rotation);
+extern void PBAsyncWorldSetVelocity(PBAsyncWorld* async, PBBody* body, PBVec2 velocity);
+extern void PBAsyncWorldSetAngularVelocity(PBAsyncWorld* async, PBBody* body, float angularVelocity);
+extern void PBAsyncWorldAddForce(PBAsyncWorld* async, PBBody* body, PBVec2 force);
+extern void PBAsyncWorldAddBody(PBAsyncWorld* async, PBBody* body);
+extern void PBAsyncWorldRemoveBody(PBAsyncWorld* async, PBBody* body);
+
+#endif
+
+#endif
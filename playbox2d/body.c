@@ -3,6 +3,13 @@
 
 PBBody* PBBodyCreate(void) {
   PBBody* body = pb_alloc(sizeof(PBBody));
+  PBBodyInit(body);
+  return body;
+}
+
+// Sets up a body in memory the caller owns, such as a scene's body block.
+void PBBodyInit(PBBody* body) {
+  memset(body, 0, sizeof(PBBody));
   
   body->position = PBVec2MakeEmpty();
   body->rotation = 0.0f;
@@ -10,22 +17,27 @@ PBBody* PBBodyCreate(void) {
   body->angularVelocity = 0.0f;
   body->force = PBVec2MakeEmpty();
   body->friction = 0.2f;
+  body->shape.type = PBShapeTypeBox;
   body->width = PBVec2Make(1.0f, 1.0f);
   body->AABBHalfSize = PBVec2GetLength(body->width) * 0.5f;
   body->mass = FLT_MAX;
   body->invMass = 0.0f;
   body->I = FLT_MAX;
   body->invI = 0.0f;
-  
-  return body;
+  body->proxyId = -1;
 }
 
 void PBBodyFree(PBBody* body) {
+  // Scene bodies are freed with their world.
+  if(body->scene != NULL) {
+    return;
+  }
+  
   pb_log("playbox: freeing body %p", body);
   pb_free(body);
 }
 
-void PBBodySet(PBBody* body, const PBVec2 w, float m) {
+static void PBBodyReset(PBBody* body) {
   body->position = PBVec2MakeEmpty();
   body->rotation = 0.0f;
   body->velocity = PBVec2MakeEmpty();
@@ -33,23 +45,225 @@ void PBBodySet(PBBody* body, const PBVec2 w, float m) {
   body->force = PBVec2MakeEmpty();
   body->torque = 0.0f;
   body->friction = 0.2f;
+}
+
+// Moment of inertia about the center of mass for a unit mass of the body's shape.
+static float PBBodyComputeUnitInertia(PBBody* body) {
+  PBShape* shape = &body->shape;
   
-  body->width = w;
-  body->AABBHalfSize = PBVec2GetLength(body->width) * 0.5f;
+  switch(shape->type) {
+    case PBShapeTypeCircle:
+      return 0.5f * shape->radius * shape->radius;
+      
+    case PBShapeTypePolygon: {
+      // Vertices are centered on the centroid, so sum the triangle fan around it.
+      float area = 0.0f;
+      float I = 0.0f;
+      for(int i = 0; i < shape->vertexCount; i++) {
+        PBVec2 e1 = shape->vertices[i];
+        PBVec2 e2 = shape->vertices[i + 1 < shape->vertexCount ? i + 1 : 0];
+        float D = PBVec2Cross(e1, e2);
+        area += 0.5f * D;
+        I += (0.25f / 3.0f) * D * (e1.x * e1.x + e2.x * e1.x + e2.x * e2.x + e1.y * e1.y + e2.y * e1.y + e2.y * e2.y);
+      }
+      return area > 0.0f ? I / area : 0.0f;
+    }
+      
+    case PBShapeTypeBox:
+    default:
+      return (body->width.x * body->width.x + body->width.y * body->width.y) / 12.0f;
+  }
+}
+
+static void PBBodySetMass(PBBody* body, float m) {
   body->mass = m;
   
   if(m < FLT_MAX) {
     body->invMass = 1.0f / m;
-    body->I = m * (w.x * w.x + w.y * w.y) / 12.0f;
-    body->invI = 1.0f / body->I;
   }
   else {
     body->invMass = 0.0f;
+  }
+  
+  if(m < FLT_MAX && !body->fixedRotation) {
+    body->I = m * PBBodyComputeUnitInertia(body);
+    body->invI = body->I > 0.0f ? 1.0f / body->I : 0.0f;
+  }
+  else {
     body->I = FLT_MAX;
     body->invI = 0.0f;
   }
 }
 
+void PBBodySet(PBBody* body, const PBVec2 w, float m) {
+  PBBodyReset(body);
+  
+  body->shape.type = PBShapeTypeBox;
+  body->width = w;
+  body->AABBHalfSize = PBVec2GetLength(body->width) * 0.5f;
+  PBBodySetMass(body, m);
+}
+
+void PBBodySetCircle(PBBody* body, float radius, float m) {
+  PBBodyReset(body);
+  
+  body->shape.type = PBShapeTypeCircle;
+  body->shape.radius = radius;
+  body->width = PBVec2Make(2.0f * radius, 2.0f * radius);
+  body->AABBHalfSize = radius;
+  PBBodySetMass(body, m);
+}
+
+int PBBodySetPolygon(PBBody* body, const PBVec2* vertices, int count, float m) {
+  if(count < 3 || count > PB_MAX_POLYGON_VERTICES) {
+    pb_log("playbox: PBBody: polygon must have between 3 and %i vertices", PB_MAX_POLYGON_VERTICES);
+    return 0;
+  }
+  
+  // Find the centroid and winding of the polygon.
+  float area = 0.0f;
+  PBVec2 centroid = PBVec2MakeEmpty();
+  for(int i = 0; i < count; i++) {
+    PBVec2 p1 = vertices[i];
+    PBVec2 p2 = vertices[i + 1 < count ? i + 1 : 0];
+    float D = PBVec2Cross(p1, p2);
+    area += 0.5f * D;
+    centroid = PBVec2Add(centroid, PBVec2MultF(PBVec2Add(p1, p2), D / 6.0f));
+  }
+  
+  if(PBAbs(area) <= FLT_EPSILON) {
+    pb_log("playbox: PBBody: polygon has no area");
+    return 0;
+  }
+  
+  // Edge normals need edges with length. Written as !(x > 0) here and below
+  // so NaN coordinates fail too.
+  for(int i = 0; i < count; i++) {
+    PBVec2 edge = PBVec2Sub(vertices[i + 1 < count ? i + 1 : 0], vertices[i]);
+    if(!(PBVec2GetLength(edge) > FLT_EPSILON)) {
+      pb_log("playbox: PBBody: polygon has a zero-length edge");
+      return 0;
+    }
+  }
+  
+  // Every other vertex must lie strictly inside each edge, which rejects
+  // collinear and reflex vertices and self-intersecting outlines.
+  float winding = area > 0.0f ? 1.0f : -1.0f;
+  for(int i = 0; i < count; i++) {
+    PBVec2 v = vertices[i];
+    PBVec2 edge = PBVec2Sub(vertices[i + 1 < count ? i + 1 : 0], v);
+    for(int j = 0; j < count; j++) {
+      if(j == i || j == (i + 1 < count ? i + 1 : 0)) {
+        continue;
+      }
+      if(!(winding * PBVec2Cross(edge, PBVec2Sub(vertices[j], v)) > 0.0f)) {
+        pb_log("playbox: PBBody: polygon must be convex");
+        return 0;
+      }
+    }
+  }
+  
+  centroid = PBVec2MultF(centroid, 1.0f / area);
+  
+  PBBodyReset(body);
+  
+  // Store counter-clockwise vertices relative to the centroid.
+  PBShape* shape = &body->shape;
+  shape->type = PBShapeTypePolygon;
+  shape->vertexCount = count;
+  for(int i = 0; i < count; i++) {
+    PBVec2 v = area > 0.0f ? vertices[i] : vertices[count - 1 - i];
+    shape->vertices[i] = PBVec2Sub(v, centroid);
+  }
+  
+  PBVec2 lower = shape->vertices[0];
+  PBVec2 upper = shape->vertices[0];
+  body->AABBHalfSize = 0.0f;
+  for(int i = 0; i < count; i++) {
+    PBVec2 v = shape->vertices[i];
+    PBVec2 edge = PBVec2Sub(shape->vertices[i + 1 < count ? i + 1 : 0], v);
+    PBVec2 normal = PBVec2CrossF(edge, 1.0f);
+    shape->normals[i] = PBVec2MultF(normal, 1.0f / PBVec2GetLength(normal));
+    
+    lower = PBVec2Make(PBMin(lower.x, v.x), PBMin(lower.y, v.y));
+    upper = PBVec2Make(PBMax(upper.x, v.x), PBMax(upper.y, v.y));
+    body->AABBHalfSize = PBMax(body->AABBHalfSize, PBVec2GetLength(v));
+  }
+  
+  body->width = PBVec2Sub(upper, lower);
+  PBBodySetMass(body, m);
+  
+  return 1;
+}
+
+void PBBodySetFixedRotation(PBBody* body, int fixedRotation) {
+  body->fixedRotation = fixedRotation ? 1 : 0;
+  
+  if(body->fixedRotation) {
+    body->rotation = 0.0f;
+    body->angularVelocity = 0.0f;
+    body->torque = 0.0f;
+  }
+  
+  PBBodySetMass(body, body->mass);
+}
+
+PBAABB PBBodyGetAABB(PBBody* body) {
+  if(body->shape.type == PBShapeTypeCircle) {
+    PBVec2 r = PBVec2Make(body->shape.radius, body->shape.radius);
+    return PBAABBMake(PBVec2Sub(body->position, r), PBVec2Add(body->position, r));
+  }
+  
+  if(body->shape.type == PBShapeTypeBox) {
+    PBMat22 absRot = PBMat22Abs(PBMat22MakeWithAngle(body->rotation));
+    PBVec2 h = PBMat22MultVec(absRot, PBVec2MultF(body->width, 0.5f));
+    return PBAABBMake(PBVec2Sub(body->position, h), PBVec2Add(body->position, h));
+  }
+  
+  PBMat22 Rot = PBMat22MakeWithAngle(body->rotation);
+  PBVec2 v = PBMat22MultVec(Rot, body->shape.vertices[0]);
+  PBAABB aabb = PBAABBMake(v, v);
+  for(int i = 1; i < body->shape.vertexCount; i++) {
+    v = PBMat22MultVec(Rot, body->shape.vertices[i]);
+    aabb = PBAABBCombine(aabb, PBAABBMake(v, v));
+  }
+  aabb.lower = PBVec2Add(aabb.lower, body->position);
+  aabb.upper = PBVec2Add(aabb.upper, body->position);
+  return aabb;
+}
+
+// Boxes become four vertex polygons. Circles have no polygon.
+void PBBodyGetWorldPolygon(PBBody* body, PBPolygon* polygon) {
+  PBMat22 Rot = PBMat22MakeWithAngle(body->rotation);
+  
+  if(body->shape.type == PBShapeTypeBox) {
+    PBVec2 h = PBVec2MultF(body->width, 0.5f);
+    polygon->count = 4;
+    polygon->vertices[0] = PBVec2Make(-h.x, -h.y);
+    polygon->vertices[1] = PBVec2Make( h.x, -h.y);
+    polygon->vertices[2] = PBVec2Make( h.x,  h.y);
+    polygon->vertices[3] = PBVec2Make(-h.x,  h.y);
+    polygon->normals[0] = PBVec2Make( 0.0f, -1.0f);
+    polygon->normals[1] = PBVec2Make( 1.0f,  0.0f);
+    polygon->normals[2] = PBVec2Make( 0.0f,  1.0f);
+    polygon->normals[3] = PBVec2Make(-1.0f,  0.0f);
+  }
+  else if(body->shape.type == PBShapeTypePolygon) {
+    polygon->count = body->shape.vertexCount;
+    memcpy(polygon->vertices, body->shape.vertices, sizeof(PBVec2) * polygon->count);
+    memcpy(polygon->normals, body->shape.normals, sizeof(PBVec2) * polygon->count);
+  }
+  else {
+    polygon->count = 0;
+    return;
+  }
+  
+  for(int i = 0; i < polygon->count; i++) {
+    polygon->vertices[i] = PBVec2Add(body->position, PBMat22MultVec(Rot, polygon->vertices[i]));
+    polygon->normals[i] = PBMat22MultVec(Rot, polygon->normals[i]);
+  }
+}
+
 void PBBodyAddForce(PBBody* body, const PBVec2 f) {
   body->force = PBVec2Add(body->force, f);
 }
@@ -3,7 +3,49 @@
 
 #include "maths.h"
 
+#ifndef PB_MAX_POLYGON_VERTICES
+#define PB_MAX_POLYGON_VERTICES 8
+#endif
+
+typedef enum {
+  PBShapeTypeBox = 0,
+  PBShapeTypeCircle,
+  PBShapeTypePolygon,
+  PBShapeTypeCount
+} PBShapeType;
+
 typedef struct {
+  PBShapeType type;
+  
+  // Circle
+  float radius;
+  
+  // Convex polygon in body space, counter-clockwise, centered on the centroid.
+  int vertexCount;
+  PBVec2 vertices[PB_MAX_POLYGON_VERTICES];
+  PBVec2 normals[PB_MAX_POLYGON_VERTICES];
+} PBShape;
+
+// A box or convex polygon shape transformed into world space.
+typedef struct {
+  int count;
+  PBVec2 vertices[PB_MAX_POLYGON_VERTICES];
+  PBVec2 normals[PB_MAX_POLYGON_VERTICES];
+} PBPolygon;
+
+typedef enum {
+  PBBodyLODAuto = 0,  // from the distance to the world's LOD focus
+  PBBodyLODFull,
+  PBBodyLODReduced,
+  PBBodyLODFrozen
+} PBBodyLOD;
+
+struct PBArbiterEdge;
+struct PBJointEdge;
+struct PBScene;
+struct PBStream;
+
+typedef struct PBBody {
   // State
   PBVec2 position;
   float rotation;
@@ -11,23 +53,55 @@ typedef struct {
   float angularVelocity;
   
   // Properties
+  PBShape shape;
   PBVec2 width;
   float AABBHalfSize;
   float friction;
   float mass, invMass;
   float I, invI;
+  int fixedRotation;
+  int bullet;  // swept against other bodies each step to prevent tunneling
   
   // Applied forces
   PBVec2 force;
   float torque;
 
+  // Application defined identifier, reported by world queries
+  int tag;
+  
+  // Simulation level of detail. Bodies touching each other share the most
+  // detailed level of any of them.
+  PBBodyLOD lod;
+  int lodSkipped;  // not simulated this step
+  float lodTime;  // time skipped at the reduced rate, made up in the next simulated step
+
   // Reference to world
   void* world;
+  int proxyId;  // broadphase tree proxy, -1 when not in a world
+  int index;  // position in the world's body array
+  int pending;  // queued deferred world change: 1 add, -1 remove
+  int solverIndex;  // index in the world's body array, set when stepping
+  
+  // Arbiters and joints touching this body, maintained by the world
+  struct PBArbiterEdge* arbiterList;
+  struct PBJointEdge* jointList;
+  
+  // Scene the body was loaded from, whose memory it lives in
+  struct PBScene* scene;
+  
+  // Stream that creates and frees the body as its region loads and unloads
+  struct PBStream* stream;
 } PBBody;
 
 extern PBBody* PBBodyCreate(void);
+extern void PBBodyInit(PBBody* body);
 extern void PBBodyFree(PBBody* body);
 extern void PBBodySet(PBBody* body, const PBVec2 w, float m);
+extern void PBBodySetCircle(PBBody* body, float radius, float m);
+extern int PBBodySetPolygon(PBBody* body, const PBVec2* vertices, int count, float m);
+extern void PBBodySetFixedRotation(PBBody* body, int fixedRotation);
+extern PBAABB PBBodyGetAABB(PBBody* body);
+extern void PBBodyGetWorldPolygon(PBBody* body, PBPolygon* polygon);
 extern void PBBodyAddForce(PBBody* body, const PBVec2 f);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,418 @@
+#include "platform.h"
+#include "broadphase.h"
+
+// Traversal stack depth. The tree is kept balanced, so this covers far
+// more proxies than fit in memory.
+#define PB_TREE_STACK_SIZE 256
+
+PBDynamicTree* PBDynamicTreeCreate(void) {
+  PBDynamicTree* tree = pb_alloc(sizeof(PBDynamicTree));
+  memset(tree, 0, sizeof(PBDynamicTree));
+  tree->root = PB_NULL_NODE;
+  tree->freeList = PB_NULL_NODE;
+  return tree;
+}
+
+void PBDynamicTreeFree(PBDynamicTree* tree) {
+  if(tree->nodes != NULL) {
+    pb_free(tree->nodes);
+  }
+  pb_free(tree);
+}
+
+static int PBDynamicTreeAllocateNode(PBDynamicTree* tree) {
+  if(tree->freeList == PB_NULL_NODE) {
+    int capacity = tree->nodeCapacity > 0 ? tree->nodeCapacity * 2 : 16;
+    if(tree->nodes == NULL) {
+      tree->nodes = pb_alloc(sizeof(PBTreeNode) * capacity);
+    }
+    else {
+      tree->nodes = pb_realloc(tree->nodes, sizeof(PBTreeNode) * capacity);
+    }
+
+    // Chain the new nodes into the free list.
+    for(int i = tree->nodeCapacity; i < capacity; i++) {
+      tree->nodes[i].parent = i + 1 < capacity ? i + 1 : PB_NULL_NODE;
+      tree->nodes[i].height = -1;
+    }
+    tree->freeList = tree->nodeCapacity;
+    tree->nodeCapacity = capacity;
+  }
+
+  int nodeId = tree->freeList;
+  PBTreeNode* node = tree->nodes + nodeId;
+  tree->freeList = node->parent;
+  node->parent = PB_NULL_NODE;
+  node->child1 = PB_NULL_NODE;
+  node->child2 = PB_NULL_NODE;
+  node->height = 0;
+  node->userData = NULL;
+  tree->nodeCount++;
+  return nodeId;
+}
+
+static void PBDynamicTreeFreeNode(PBDynamicTree* tree, int nodeId) {
+  tree->nodes[nodeId].parent = tree->freeList;
+  tree->nodes[nodeId].height = -1;
+  tree->freeList = nodeId;
+  tree->nodeCount--;
+}
+
+static int PBDynamicTreeIsLeaf(const PBTreeNode* node) {
+  return node->child1 == PB_NULL_NODE;
+}
+
+// Perform a left or right rotation if node A is imbalanced. Returns the new subtree root.
+static int PBDynamicTreeBalance(PBDynamicTree* tree, int iA) {
+  PBTreeNode* A = tree->nodes + iA;
+  if(PBDynamicTreeIsLeaf(A) || A->height < 2) {
+    return iA;
+  }
+
+  int iB = A->child1;
+  int iC = A->child2;
+  PBTreeNode* B = tree->nodes + iB;
+  PBTreeNode* C = tree->nodes + iC;
+
+  int balance = C->height - B->height;
+
+  // Rotate C up
+  if(balance > 1) {
+    int iF = C->child1;
+    int iG = C->child2;
+    PBTreeNode* F = tree->nodes + iF;
+    PBTreeNode* G = tree->nodes + iG;
+
+    C->child1 = iA;
+    C->parent = A->parent;
+    A->parent = iC;
+
+    if(C->parent != PB_NULL_NODE) {
+      if(tree->nodes[C->parent].child1 == iA) {
+        tree->nodes[C->parent].child1 = iC;
+      }
+      else {
+        tree->nodes[C->parent].child2 = iC;
+      }
+    }
+    else {
+      tree->root = iC;
+    }
+
+    if(F->height > G->height) {
+      C->child2 = iF;
+      A->child2 = iG;
+      G->parent = iA;
+      A->aabb = PBAABBCombine(B->aabb, G->aabb);
+      C->aabb = PBAABBCombine(A->aabb, F->aabb);
+      A->height = 1 + (B->height > G->height ? B->height : G->height);
+      C->height = 1 + (A->height > F->height ? A->height : F->height);
+    }
+    else {
+      C->child2 = iG;
+      A->child2 = iF;
+      F->parent = iA;
+      A->aabb = PBAABBCombine(B->aabb, F->aabb);
+      C->aabb = PBAABBCombine(A->aabb, G->aabb);
+      A->height = 1 + (B->height > F->height ? B->height : F->height);
+      C->height = 1 + (A->height > G->height ? A->height : G->height);
+    }
+
+    return iC;
+  }
+
+  // Rotate B up
+  if(balance < -1) {
+    int iD = B->child1;
+    int iE = B->child2;
+    PBTreeNode* D = tree->nodes + iD;
+    PBTreeNode* E = tree->nodes + iE;
+
+    B->child1 = iA;
+    B->parent = A->parent;
+    A->parent = iB;
+
+    if(B->parent != PB_NULL_NODE) {
+      if(tree->nodes[B->parent].child1 == iA) {
+        tree->nodes[B->parent].child1 = iB;
+      }
+      else {
+        tree->nodes[B->parent].child2 = iB;
+      }
+    }
+    else {
+      tree->root = iB;
+    }
+
+    if(D->height > E->height) {
+      B->child2 = iD;
+      A->child1 = iE;
+      E->parent = iA;
+      A->aabb = PBAABBCombine(C->aabb, E->aabb);
+      B->aabb = PBAABBCombine(A->aabb, D->aabb);
+      A->height = 1 + (C->height > E->height ? C->height : E->height);
+      B->height = 1 + (A->height > D->height ? A->height : D->height);
+    }
+    else {
+      B->child2 = iE;
+      A->child1 = iD;
+      D->parent = iA;
+      A->aabb = PBAABBCombine(C->aabb, D->aabb);
+      B->aabb = PBAABBCombine(A->aabb, E->aabb);
+      A->height = 1 + (C->height > D->height ? C->height : D->height);
+      B->height = 1 + (A->height > E->height ? A->height : E->height);
+    }
+
+    return iB;
+  }
+
+  return iA;
+}
+
+// Walk back up the tree from a node, refitting and rebalancing ancestors.
+static void PBDynamicTreeRefit(PBDynamicTree* tree, int index) {
+  while(index != PB_NULL_NODE) {
+    index = PBDynamicTreeBalance(tree, index);
+
+    PBTreeNode* node = tree->nodes + index;
+    PBTreeNode* child1 = tree->nodes + node->child1;
+    PBTreeNode* child2 = tree->nodes + node->child2;
+
+    node->height = 1 + (child1->height > child2->height ? child1->height : child2->height);
+    node->aabb = PBAABBCombine(child1->aabb, child2->aabb);
+
+    index = node->parent;
+  }
+}
+
+static void PBDynamicTreeInsertLeaf(PBDynamicTree* tree, int leaf) {
+  if(tree->root == PB_NULL_NODE) {
+    tree->root = leaf;
+    tree->nodes[leaf].parent = PB_NULL_NODE;
+    return;
+  }
+
+  // Find the best sibling using the surface area heuristic.
+  PBAABB leafAABB = tree->nodes[leaf].aabb;
+  int index = tree->root;
+  while(!PBDynamicTreeIsLeaf(tree->nodes + index)) {
+    PBTreeNode* node = tree->nodes + index;
+    int child1 = node->child1;
+    int child2 = node->child2;
+
+    float area = PBAABBGetPerimeter(node->aabb);
+    float combinedArea = PBAABBGetPerimeter(PBAABBCombine(node->aabb, leafAABB));
+
+    // Cost of creating a new parent for this node and the new leaf
+    float cost = 2.0f * combinedArea;
+
+    // Minimum cost of pushing the leaf further down the tree
+    float inheritanceCost = 2.0f * (combinedArea - area);
+
+    float cost1 = PBAABBGetPerimeter(PBAABBCombine(leafAABB, tree->nodes[child1].aabb)) + inheritanceCost;
+    if(!PBDynamicTreeIsLeaf(tree->nodes + child1)) {
+      cost1 -= PBAABBGetPerimeter(tree->nodes[child1].aabb);
+    }
+
+    float cost2 = PBAABBGetPerimeter(PBAABBCombine(leafAABB, tree->nodes[child2].aabb)) + inheritanceCost;
+    if(!PBDynamicTreeIsLeaf(tree->nodes + child2)) {
+      cost2 -= PBAABBGetPerimeter(tree->nodes[child2].aabb);
+    }
+
+    if(cost < cost1 && cost < cost2) {
+      break;
+    }
+
+    index = cost1 < cost2 ? child1 : child2;
+  }
+
+  int sibling = index;
+
+  // Create a new parent. Allocation may move the node array.
+  int oldParent = tree->nodes[sibling].parent;
+  int newParent = PBDynamicTreeAllocateNode(tree);
+  tree->nodes[newParent].parent = oldParent;
+  tree->nodes[newParent].aabb = PBAABBCombine(leafAABB, tree->nodes[sibling].aabb);
+  tree->nodes[newParent].height = tree->nodes[sibling].height + 1;
+  tree->nodes[newParent].child1 = sibling;
+  tree->nodes[newParent].child2 = leaf;
+  tree->nodes[sibling].parent = newParent;
+  tree->nodes[leaf].parent = newParent;
+
+  if(oldParent != PB_NULL_NODE) {
+    if(tree->nodes[oldParent].child1 == sibling) {
+      tree->nodes[oldParent].child1 = newParent;
+    }
+    else {
+      tree->nodes[oldParent].child2 = newParent;
+    }
+  }
+  else {
+    tree->root = newParent;
+  }
+
+  PBDynamicTreeRefit(tree, tree->nodes[leaf].parent);
+}
+
+static void PBDynamicTreeRemoveLeaf(PBDynamicTree* tree, int leaf) {
+  if(leaf == tree->root) {
+    tree->root = PB_NULL_NODE;
+    return;
+  }
+
+  int parent = tree->nodes[leaf].parent;
+  int grandParent = tree->nodes[parent].parent;
+  int sibling = tree->nodes[parent].child1 == leaf ? tree->nodes[parent].child2 : tree->nodes[parent].child1;
+
+  if(grandParent != PB_NULL_NODE) {
+    // Connect the sibling to the grandparent and drop the parent.
+    if(tree->nodes[grandParent].child1 == parent) {
+      tree->nodes[grandParent].child1 = sibling;
+    }
+    else {
+      tree->nodes[grandParent].child2 = sibling;
+    }
+    tree->nodes[sibling].parent = grandParent;
+    PBDynamicTreeFreeNode(tree, parent);
+
+    PBDynamicTreeRefit(tree, grandParent);
+  }
+  else {
+    tree->root = sibling;
+    tree->nodes[sibling].parent = PB_NULL_NODE;
+    PBDynamicTreeFreeNode(tree, parent);
+  }
+}
+
+int PBDynamicTreeCreateProxy(PBDynamicTree* tree, PBAABB aabb, void* userData) {
+  int proxyId = PBDynamicTreeAllocateNode(tree);
+  tree->nodes[proxyId].aabb = PBAABBExtend(aabb, PB_AABB_MARGIN);
+  tree->nodes[proxyId].userData = userData;
+  tree->nodes[proxyId].height = 0;
+  PBDynamicTreeInsertLeaf(tree, proxyId);
+  return proxyId;
+}
+
+void PBDynamicTreeDestroyProxy(PBDynamicTree* tree, int proxyId) {
+  PBDynamicTreeRemoveLeaf(tree, proxyId);
+  PBDynamicTreeFreeNode(tree, proxyId);
+}
+
+// Returns 1 if the proxy had to be reinserted.
+int PBDynamicTreeMoveProxy(PBDynamicTree* tree, int proxyId, PBAABB aabb) {
+  if(PBAABBContains(tree->nodes[proxyId].aabb, aabb)) {
+    return 0;
+  }
+
+  PBDynamicTreeRemoveLeaf(tree, proxyId);
+  tree->nodes[proxyId].aabb = PBAABBExtend(aabb, PB_AABB_MARGIN);
+  PBDynamicTreeInsertLeaf(tree, proxyId);
+  return 1;
+}
+
+void* PBDynamicTreeGetUserData(PBDynamicTree* tree, int proxyId) {
+  return tree->nodes[proxyId].userData;
+}
+
+PBAABB PBDynamicTreeGetFatAABB(PBDynamicTree* tree, int proxyId) {
+  return tree->nodes[proxyId].aabb;
+}
+
+void PBDynamicTreeQuery(PBDynamicTree* tree, PBAABB aabb, PBTreeQueryCallback callback, void* context) {
+  if(tree->root == PB_NULL_NODE) {
+    return;
+  }
+
+  int stack[PB_TREE_STACK_SIZE];
+  int count = 0;
+  stack[count++] = tree->root;
+
+  while(count > 0) {
+    int nodeId = stack[--count];
+    PBTreeNode* node = tree->nodes + nodeId;
+
+    if(!PBAABBOverlaps(node->aabb, aabb)) {
+      continue;
+    }
+
+    if(PBDynamicTreeIsLeaf(node)) {
+      if(!callback(nodeId, context)) {
+        return;
+      }
+    }
+    else if(count + 2 <= PB_TREE_STACK_SIZE) {
+      stack[count++] = node->child1;
+      stack[count++] = node->child2;
+    }
+    else {
+      pb_log("playbox: PBDynamicTree: query stack overflow");
+    }
+  }
+}
+
+void PBDynamicTreeRayCast(PBDynamicTree* tree, const PBRayCastInput* input, PBTreeRayCastCallback callback, void* context) {
+  if(tree->root == PB_NULL_NODE) {
+    return;
+  }
+
+  PBVec2 p1 = input->p1;
+  PBVec2 p2 = input->p2;
+  PBVec2 d = PBVec2Sub(p2, p1);
+  float length = PBVec2GetLength(d);
+  if(length <= 0.0f) {
+    return;
+  }
+  d = PBVec2MultF(d, 1.0f / length);
+
+  // Separating axis for the segment
+  PBVec2 v = PBVec2FCross(1.0f, d);
+  PBVec2 absV = PBVec2Abs(v);
+
+  float maxFraction = input->maxFraction;
+
+  PBVec2 t = PBVec2Add(p1, PBVec2MultF(PBVec2Sub(p2, p1), maxFraction));
+  PBAABB segmentAABB = PBAABBMake(PBVec2Make(PBMin(p1.x, t.x), PBMin(p1.y, t.y)), PBVec2Make(PBMax(p1.x, t.x), PBMax(p1.y, t.y)));
+
+  int stack[PB_TREE_STACK_SIZE];
+  int count = 0;
+  stack[count++] = tree->root;
+
+  while(count > 0) {
+    int nodeId = stack[--count];
+    PBTreeNode* node = tree->nodes + nodeId;
+
+    if(!PBAABBOverlaps(node->aabb, segmentAABB)) {
+      continue;
+    }
+
+    // |dot(v, p1 - c)| > dot(|v|, h)
+    PBVec2 c = PBVec2MultF(PBVec2Add(node->aabb.lower, node->aabb.upper), 0.5f);
+    PBVec2 h = PBVec2MultF(PBVec2Sub(node->aabb.upper, node->aabb.lower), 0.5f);
+    if(PBAbs(PBVec2Dot(v, PBVec2Sub(p1, c))) - PBVec2Dot(absV, h) > 0.0f) {
+      continue;
+    }
+
+    if(PBDynamicTreeIsLeaf(node)) {
+      PBRayCastInput subInput = { .p1 = p1, .p2 = p2, .maxFraction = maxFraction };
+      float value = callback(&subInput, nodeId, context);
+
+      if(value == 0.0f) {
+        return;
+      }
+
+      if(value > 0.0f && value < maxFraction) {
+        // Shrink the segment bounds to the new max fraction.
+        maxFraction = value;
+        t = PBVec2Add(p1, PBVec2MultF(PBVec2Sub(p2, p1), maxFraction));
+        segmentAABB = PBAABBMake(PBVec2Make(PBMin(p1.x, t.x), PBMin(p1.y, t.y)), PBVec2Make(PBMax(p1.x, t.x), PBMax(p1.y, t.y)));
+      }
+    }
+    else if(count + 2 <= PB_TREE_STACK_SIZE) {
+      stack[count++] = node->child1;
+      stack[count++] = node->child2;
+    }
+    else {
+      pb_log("playbox: PBDynamicTree: ray cast stack overflow");
+    }
+  }
+}
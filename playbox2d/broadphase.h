@@ -0,0 +1,52 @@
+#ifndef PLAYBOX_BROADPHASE_H
+#define PLAYBOX_BROADPHASE_H
+
+#include "maths.h"
+
+#define PB_NULL_NODE (-1)
+
+#ifndef PB_AABB_MARGIN
+#define PB_AABB_MARGIN 0.1f
+#endif
+
+typedef struct {
+  PBAABB aabb;
+  void* userData;
+  int parent;  // next free node when on the free list
+  int child1;
+  int child2;
+  int height;  // 0 for leaves, -1 when free
+} PBTreeNode;
+
+// Dynamic AABB tree. Leaves hold fattened body AABBs so small movements
+// don't require the tree to be updated.
+typedef struct {
+  int root;
+  PBTreeNode* nodes;
+  int nodeCount;
+  int nodeCapacity;
+  int freeList;
+} PBDynamicTree;
+
+typedef struct {
+  PBVec2 p1, p2;
+  float maxFraction;
+} PBRayCastInput;
+
+// Return 0 to stop the query.
+typedef int (*PBTreeQueryCallback)(int proxyId, void* context);
+
+// Return the new max fraction of the ray: 0 stops, input->maxFraction continues unclipped.
+typedef float (*PBTreeRayCastCallback)(const PBRayCastInput* input, int proxyId, void* context);
+
+extern PBDynamicTree* PBDynamicTreeCreate(void);
+extern void PBDynamicTreeFree(PBDynamicTree* tree);
+extern int PBDynamicTreeCreateProxy(PBDynamicTree* tree, PBAABB aabb, void* userData);
+extern void PBDynamicTreeDestroyProxy(PBDynamicTree* tree, int proxyId);
+extern int PBDynamicTreeMoveProxy(PBDynamicTree* tree, int proxyId, PBAABB aabb);
+extern void* PBDynamicTreeGetUserData(PBDynamicTree* tree, int proxyId);
+extern PBAABB PBDynamicTreeGetFatAABB(PBDynamicTree* tree, int proxyId);
+extern void PBDynamicTreeQuery(PBDynamicTree* tree, PBAABB aabb, PBTreeQueryCallback callback, void* context);
+extern void PBDynamicTreeRayCast(PBDynamicTree* tree, const PBRayCastInput* input, PBTreeRayCastCallback callback, void* context);
+
+#endif
@@ -120,12 +120,76 @@ static void ComputeIncidentEdge(PBClipVertex c[2], const PBVec2 h, const PBVec2
   c[1].v = PBVec2Add(pos, PBMat22MultVec(Rot, c[1].v));
 }
 
-int PBCollide(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
-  // Early discard with a simple AABB
-  float AABBSum = bodyA->AABBHalfSize + bodyB->AABBHalfSize;
-  if ( PBAbs(bodyA->position.x-bodyB->position.x)>AABBSum || PBAbs(bodyA->position.y-bodyB->position.y)>AABBSum )
+// Both boxes are axis-aligned, so the overlap axis and the two contact
+// points fall straight out of the box extents.
+static int PBCollideAABBs(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  PBVec2 hA = PBVec2MultF(bodyA->width, 0.5f);
+  PBVec2 hB = PBVec2MultF(bodyB->width, 0.5f);
+  
+  PBVec2 posA = bodyA->position;
+  PBVec2 posB = bodyB->position;
+  PBVec2 dp = PBVec2Sub(posB, posA);
+  
+  float separationX = PBAbs(dp.x) - hA.x - hB.x;
+  float separationY = PBAbs(dp.y) - hA.y - hB.y;
+  if(separationX > 0.0f || separationY > 0.0f) {
     return 0;
+  }
+  
+  // Same axis preference as the general box test.
+  const float relativeTol = 0.95f;
+  const float absoluteTol = 0.01f;
+  
+  PBVec2 normal;
+  PBVec2 lower, upper;
+  float separation;
+  char refEdge, incEdge, lowerEdge, upperEdge;
+  
+  if(separationY > relativeTol * separationX + absoluteTol * hA.y) {
+    float sign = PBSign(dp.y);
+    normal = PBVec2Make(0.0f, sign);
+    separation = separationY;
     
+    float front = posA.y + sign * hA.y;
+    lower = PBVec2Make(PBMax(posA.x - hA.x, posB.x - hB.x), front);
+    upper = PBVec2Make(PBMin(posA.x + hA.x, posB.x + hB.x), front);
+    refEdge = sign > 0.0f ? EDGE1 : EDGE3;
+    incEdge = sign > 0.0f ? EDGE3 : EDGE1;
+    lowerEdge = EDGE2;
+    upperEdge = EDGE4;
+  }
+  else {
+    float sign = PBSign(dp.x);
+    normal = PBVec2Make(sign, 0.0f);
+    separation = separationX;
+    
+    float front = posA.x + sign * hA.x;
+    lower = PBVec2Make(front, PBMax(posA.y - hA.y, posB.y - hB.y));
+    upper = PBVec2Make(front, PBMin(posA.y + hA.y, posB.y + hB.y));
+    refEdge = sign > 0.0f ? EDGE4 : EDGE2;
+    incEdge = sign > 0.0f ? EDGE2 : EDGE4;
+    lowerEdge = EDGE3;
+    upperEdge = EDGE1;
+  }
+  
+  for(int i = 0; i < 2; i++) {
+    contacts[i].separation = separation;
+    contacts[i].normal = normal;
+    contacts[i].position = i == 0 ? lower : upper;
+    contacts[i].feature.e.inEdge1 = refEdge;
+    contacts[i].feature.e.inEdge2 = incEdge;
+    contacts[i].feature.e.outEdge1 = i == 0 ? lowerEdge : upperEdge;
+    contacts[i].feature.e.outEdge2 = NO_EDGE;
+  }
+  
+  return 2;
+}
+
+static int PBCollideBoxes(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  if(bodyA->rotation == 0.0f && bodyB->rotation == 0.0f) {
+    return PBCollideAABBs(contacts, bodyA, bodyB);
+  }
+  
   // Setup
   PBVec2 hA = PBVec2MultF(bodyA->width, 0.5f);
   PBVec2 hB = PBVec2MultF(bodyB->width, 0.5f);
@@ -303,3 +367,350 @@ int PBCollide(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
 
   return numContacts;
 }
+
+// Circle collision routines produce a single contact, so they skip the
+// separating axis search and clipping used for boxes. The contact sits
+// halfway between the two surface points.
+
+static PBVec2 PBContactMidpoint(PBVec2 pointA, PBVec2 pointB) {
+  return PBVec2MultF(PBVec2Add(pointA, pointB), 0.5f);
+}
+
+static int PBCollideCircles(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  float rA = bodyA->shape.radius;
+  float rB = bodyB->shape.radius;
+  
+  PBVec2 d = PBVec2Sub(bodyB->position, bodyA->position);
+  float distSqr = PBVec2Dot(d, d);
+  float radius = rA + rB;
+  if(distSqr > radius * radius) {
+    return 0;
+  }
+  
+  float dist = sqrtf(distSqr);
+  PBVec2 normal = dist > FLT_EPSILON ? PBVec2MultF(d, 1.0f / dist) : PBVec2Make(0.0f, 1.0f);
+  
+  PBVec2 pointA = PBVec2Add(bodyA->position, PBVec2MultF(normal, rA));
+  PBVec2 pointB = PBVec2Sub(bodyB->position, PBVec2MultF(normal, rB));
+  
+  contacts[0].separation = dist - radius;
+  contacts[0].normal = normal;
+  contacts[0].position = PBContactMidpoint(pointA, pointB);
+  contacts[0].feature.value = 0;
+  
+  return 1;
+}
+
+static int PBCollideCircleAndBox(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  float radius = bodyA->shape.radius;
+  PBVec2 h = PBVec2MultF(bodyB->width, 0.5f);
+  
+  // Work in the box's frame.
+  PBMat22 RotB = PBMat22MakeWithAngle(bodyB->rotation);
+  PBVec2 center = PBMat22MultVec(PBMat22Transpose(RotB), PBVec2Sub(bodyA->position, bodyB->position));
+  
+  PBVec2 closest = PBVec2Make(PBClamp(center.x, -h.x, h.x), PBClamp(center.y, -h.y, h.y));
+  PBVec2 normal; // from box towards circle, box frame
+  float separation;
+  char edge;
+  
+  if(closest.x == center.x && closest.y == center.y) {
+    // Center is inside the box, push out through the nearest face.
+    float dx = h.x - PBAbs(center.x);
+    float dy = h.y - PBAbs(center.y);
+    if(dx < dy) {
+      normal = PBVec2Make(PBSign(center.x), 0.0f);
+      closest.x = normal.x * h.x;
+      separation = -dx - radius;
+      edge = normal.x > 0.0f ? EDGE4 : EDGE2;
+    }
+    else {
+      normal = PBVec2Make(0.0f, PBSign(center.y));
+      closest.y = normal.y * h.y;
+      separation = -dy - radius;
+      edge = normal.y > 0.0f ? EDGE1 : EDGE3;
+    }
+  }
+  else {
+    PBVec2 d = PBVec2Sub(center, closest);
+    float dist = PBVec2GetLength(d);
+    if(dist > radius) {
+      return 0;
+    }
+    normal = PBVec2MultF(d, 1.0f / dist);
+    separation = dist - radius;
+    edge = NO_EDGE;
+  }
+  
+  // Normal points from A (circle) to B (box).
+  PBVec2 worldNormal = PBVec2Invert(PBMat22MultVec(RotB, normal));
+  PBVec2 pointA = PBVec2Add(bodyA->position, PBVec2MultF(worldNormal, radius));
+  PBVec2 pointB = PBVec2Add(bodyB->position, PBMat22MultVec(RotB, closest));
+  
+  contacts[0].separation = separation;
+  contacts[0].normal = worldNormal;
+  contacts[0].position = PBContactMidpoint(pointA, pointB);
+  contacts[0].feature.value = 0;
+  contacts[0].feature.e.inEdge2 = edge;
+  
+  return 1;
+}
+
+// Convex polygons are collided in world space. Boxes are converted to
+// polygons when paired with a polygon.
+
+// Find the edge of poly1 with the largest separation from poly2.
+static float PBPolygonFindMaxSeparation(int* edgeIndex, const PBPolygon* poly1, const PBPolygon* poly2) {
+  int bestIndex = 0;
+  float maxSeparation = -FLT_MAX;
+  
+  for(int i = 0; i < poly1->count; i++) {
+    PBVec2 n = poly1->normals[i];
+    PBVec2 v1 = poly1->vertices[i];
+    
+    float si = FLT_MAX;
+    for(int j = 0; j < poly2->count; j++) {
+      si = PBMin(si, PBVec2Dot(n, PBVec2Sub(poly2->vertices[j], v1)));
+    }
+    
+    if(si > maxSeparation) {
+      maxSeparation = si;
+      bestIndex = i;
+    }
+  }
+  
+  *edgeIndex = bestIndex;
+  return maxSeparation;
+}
+
+static int PBCollidePolygons(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  PBPolygon polyA, polyB;
+  PBBodyGetWorldPolygon(bodyA, &polyA);
+  PBBodyGetWorldPolygon(bodyB, &polyB);
+  
+  int edgeA = 0;
+  float separationA = PBPolygonFindMaxSeparation(&edgeA, &polyA, &polyB);
+  if(separationA > 0.0f) {
+    return 0;
+  }
+  
+  int edgeB = 0;
+  float separationB = PBPolygonFindMaxSeparation(&edgeB, &polyB, &polyA);
+  if(separationB > 0.0f) {
+    return 0;
+  }
+  
+  // Prefer faces of A, same as the box-box test.
+  const float relativeTol = 0.95f;
+  const float absoluteTol = 0.005f;
+  
+  const PBPolygon* poly1;
+  const PBPolygon* poly2;
+  int edge1;
+  int flip;
+  
+  if(separationB > relativeTol * separationA + absoluteTol) {
+    poly1 = &polyB;
+    poly2 = &polyA;
+    edge1 = edgeB;
+    flip = 1;
+  }
+  else {
+    poly1 = &polyA;
+    poly2 = &polyB;
+    edge1 = edgeA;
+    flip = 0;
+  }
+  
+  PBVec2 frontNormal = poly1->normals[edge1];
+  
+  // Find the incident edge on poly2, the one most anti-parallel to the reference face.
+  int incident = 0;
+  float minDot = FLT_MAX;
+  for(int i = 0; i < poly2->count; i++) {
+    float dot = PBVec2Dot(frontNormal, poly2->normals[i]);
+    if(dot < minDot) {
+      minDot = dot;
+      incident = i;
+    }
+  }
+  
+  int incident2 = incident + 1 < poly2->count ? incident + 1 : 0;
+  
+  PBClipVertex incidentEdge[2];
+  memset(incidentEdge, 0, sizeof(incidentEdge));
+  incidentEdge[0].v = poly2->vertices[incident];
+  incidentEdge[0].fp.e.inEdge2 = (char)(incident + 1);
+  incidentEdge[1].v = poly2->vertices[incident2];
+  incidentEdge[1].fp.e.outEdge2 = (char)(incident2 + 1);
+  
+  int edge2 = edge1 + 1 < poly1->count ? edge1 + 1 : 0;
+  PBVec2 v11 = poly1->vertices[edge1];
+  PBVec2 v12 = poly1->vertices[edge2];
+  
+  PBVec2 tangent = PBVec2Sub(v12, v11);
+  tangent = PBVec2MultF(tangent, 1.0f / PBVec2GetLength(tangent));
+  
+  float front = PBVec2Dot(frontNormal, v11);
+  float negSide = -PBVec2Dot(tangent, v11);
+  float posSide = PBVec2Dot(tangent, v12);
+  
+  PBClipVertex clipPoints1[2];
+  PBClipVertex clipPoints2[2];
+  memset(clipPoints1, 0, sizeof(clipPoints1));
+  memset(clipPoints2, 0, sizeof(clipPoints2));
+  
+  if(PBClipSegmentToLine(clipPoints1, incidentEdge, PBVec2Invert(tangent), negSide, (char)(edge1 + 1)) < 2) {
+    return 0;
+  }
+  
+  if(PBClipSegmentToLine(clipPoints2, clipPoints1, tangent, posSide, (char)(edge2 + 1)) < 2) {
+    return 0;
+  }
+  
+  PBVec2 normal = flip ? PBVec2Invert(frontNormal) : frontNormal;
+  
+  int numContacts = 0;
+  for(int i = 0; i < 2; ++i) {
+    float separation = PBVec2Dot(frontNormal, clipPoints2[i].v) - front;
+    
+    if(separation <= 0) {
+      contacts[numContacts].separation = separation;
+      contacts[numContacts].normal = normal;
+      // slide contact point onto reference face (easy to cull)
+      contacts[numContacts].position = PBVec2Sub(clipPoints2[i].v, PBVec2MultF(frontNormal, separation));
+      contacts[numContacts].feature = clipPoints2[i].fp;
+      numContacts++;
+    }
+  }
+  
+  return numContacts;
+}
+
+static int PBCollideCircleAndPolygon(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  float radius = bodyA->shape.radius;
+  const PBShape* polygon = &bodyB->shape;
+  
+  // Work in the polygon's frame.
+  PBMat22 RotB = PBMat22MakeWithAngle(bodyB->rotation);
+  PBVec2 center = PBMat22MultVec(PBMat22Transpose(RotB), PBVec2Sub(bodyA->position, bodyB->position));
+  
+  // Find the face of minimum penetration.
+  int normalIndex = 0;
+  float separation = -FLT_MAX;
+  for(int i = 0; i < polygon->vertexCount; i++) {
+    float s = PBVec2Dot(polygon->normals[i], PBVec2Sub(center, polygon->vertices[i]));
+    if(s > radius) {
+      return 0;
+    }
+    if(s > separation) {
+      separation = s;
+      normalIndex = i;
+    }
+  }
+  
+  int vertIndex1 = normalIndex;
+  int vertIndex2 = vertIndex1 + 1 < polygon->vertexCount ? vertIndex1 + 1 : 0;
+  PBVec2 v1 = polygon->vertices[vertIndex1];
+  PBVec2 v2 = polygon->vertices[vertIndex2];
+  
+  PBVec2 normal; // from polygon towards circle, polygon frame
+  PBVec2 closest;
+  char feature;
+  
+  if(separation < FLT_EPSILON) {
+    // Center is inside the polygon.
+    normal = polygon->normals[normalIndex];
+    closest = PBVec2Sub(center, PBVec2MultF(normal, separation));
+    feature = (char)(normalIndex + 1);
+  }
+  else {
+    float u1 = PBVec2Dot(PBVec2Sub(center, v1), PBVec2Sub(v2, v1));
+    float u2 = PBVec2Dot(PBVec2Sub(center, v2), PBVec2Sub(v1, v2));
+    
+    if(u1 <= 0.0f || u2 <= 0.0f) {
+      // Vertex region
+      closest = u1 <= 0.0f ? v1 : v2;
+      PBVec2 d = PBVec2Sub(center, closest);
+      float dist = PBVec2GetLength(d);
+      if(dist > radius) {
+        return 0;
+      }
+      normal = PBVec2MultF(d, 1.0f / dist);
+      separation = dist;
+      feature = NO_EDGE;
+    }
+    else {
+      // Face region
+      normal = polygon->normals[normalIndex];
+      closest = PBVec2Sub(center, PBVec2MultF(normal, separation));
+      feature = (char)(normalIndex + 1);
+    }
+  }
+  
+  // Normal points from A (circle) to B (polygon).
+  PBVec2 worldNormal = PBVec2Invert(PBMat22MultVec(RotB, normal));
+  PBVec2 pointA = PBVec2Add(bodyA->position, PBVec2MultF(worldNormal, radius));
+  PBVec2 pointB = PBVec2Add(bodyB->position, PBMat22MultVec(RotB, closest));
+  
+  contacts[0].separation = separation - radius;
+  contacts[0].normal = worldNormal;
+  contacts[0].position = PBContactMidpoint(pointA, pointB);
+  contacts[0].feature.value = 0;
+  contacts[0].feature.e.inEdge2 = feature;
+  
+  return 1;
+}
+
+// Reversed pairs reuse the routines above and flip the result so the
+// normal still points from A to B.
+
+static int PBFlipContacts(PBContact* contacts, int numContacts) {
+  for(int i = 0; i < numContacts; i++) {
+    PBFeaturePair fp = contacts[i].feature;
+    contacts[i].normal = PBVec2Invert(contacts[i].normal);
+    contacts[i].feature.e.inEdge1 = fp.e.inEdge2;
+    contacts[i].feature.e.inEdge2 = fp.e.inEdge1;
+    contacts[i].feature.e.outEdge1 = fp.e.outEdge2;
+    contacts[i].feature.e.outEdge2 = fp.e.outEdge1;
+  }
+  return numContacts;
+}
+
+static int PBCollideBoxAndCircle(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  return PBFlipContacts(contacts, PBCollideCircleAndBox(contacts, bodyB, bodyA));
+}
+
+static int PBCollidePolygonAndCircle(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  return PBFlipContacts(contacts, PBCollideCircleAndPolygon(contacts, bodyB, bodyA));
+}
+
+typedef int (*PBCollideFunction)(PBContact* contacts, PBBody* bodyA, PBBody* bodyB);
+
+// Indexed by [bodyA->shape.type][bodyB->shape.type].
+static const PBCollideFunction PBCollideFunctions[PBShapeTypeCount][PBShapeTypeCount] = {
+  [PBShapeTypeBox] = {
+    [PBShapeTypeBox] = PBCollideBoxes,
+    [PBShapeTypeCircle] = PBCollideBoxAndCircle,
+    [PBShapeTypePolygon] = PBCollidePolygons
+  },
+  [PBShapeTypeCircle] = {
+    [PBShapeTypeBox] = PBCollideCircleAndBox,
+    [PBShapeTypeCircle] = PBCollideCircles,
+    [PBShapeTypePolygon] = PBCollideCircleAndPolygon
+  },
+  [PBShapeTypePolygon] = {
+    [PBShapeTypeBox] = PBCollidePolygons,
+    [PBShapeTypeCircle] = PBCollidePolygonAndCircle,
+    [PBShapeTypePolygon] = PBCollidePolygons
+  }
+};
+
+int PBCollide(PBContact* contacts, PBBody* bodyA, PBBody* bodyB) {
+  // Early discard with a simple AABB
+  float AABBSum = bodyA->AABBHalfSize + bodyB->AABBHalfSize;
+  if ( PBAbs(bodyA->position.x-bodyB->position.x)>AABBSum || PBAbs(bodyA->position.y-bodyB->position.y)>AABBSum )
+    return 0;
+  
+  return PBCollideFunctions[bodyA->shape.type][bodyB->shape.type](contacts, bodyA, bodyB);
+}
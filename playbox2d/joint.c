@@ -5,6 +5,12 @@
 
 PBJoint* PBJointCreate(PBBody* b1, PBBody* b2, const PBVec2 anchor) {
   PBJoint* joint = pb_alloc(sizeof(PBJoint));
+  PBJointInit(joint, b1, b2, anchor);
+  return joint;
+}
+
+// Sets up a joint in memory the caller owns, such as a scene's joint block.
+void PBJointInit(PBJoint* joint, PBBody* b1, PBBody* b2, const PBVec2 anchor) {
   memset(joint, 0, sizeof(PBJoint));
   
   joint->body1 = b1;
@@ -21,8 +27,6 @@ PBJoint* PBJointCreate(PBBody* b1, PBBody* b2, const PBVec2 anchor) {
   
   joint->softness = 0.0f;
   joint->biasFactor = 0.2f;
-  
-  return joint;
 }
 
 PBJoint* PBJointCreateEmpty(void) {
@@ -33,15 +37,22 @@ PBJoint* PBJointCreateEmpty(void) {
 }
 
 void PBJointFree(PBJoint* joint) {
+  // Scene joints are freed with their world.
+  if(joint->scene != NULL) {
+    return;
+  }
   pb_free(joint);
 }
 
-void PBJointPreStep(PBJoint* joint, float inv_dt) {
-  PBBody* body1 = joint->body1;
-  PBBody* body2 = joint->body2;
+void PBJointPreStep(PBJoint* joint, PBSolverBody* bodies, float inv_dt, int flags) {
+  PBBody* b1 = joint->body1;
+  PBBody* b2 = joint->body2;
 
-  PBMat22 Rot1 = PBMat22MakeWithAngle(body1->rotation);
-  PBMat22 Rot2 = PBMat22MakeWithAngle(body2->rotation);
+  PBSolverBody* body1 = bodies + joint->solverIndex1;
+  PBSolverBody* body2 = bodies + joint->solverIndex2;
+
+  PBMat22 Rot1 = PBMat22MakeWithAngle(b1->rotation);
+  PBMat22 Rot2 = PBMat22MakeWithAngle(b2->rotation);
   
   joint->r1 = PBMat22MultVec(Rot1, joint->localAnchor1);
   joint->r2 = PBMat22MultVec(Rot2, joint->localAnchor2);
@@ -64,11 +75,11 @@ void PBJointPreStep(PBJoint* joint, float inv_dt) {
   
   joint->M = PBMat22Invert(K);
   
-  PBVec2 p1 = PBVec2Add(body1->position, joint->r1);
-  PBVec2 p2 = PBVec2Add(body2->position, joint->r2);
+  PBVec2 p1 = PBVec2Add(b1->position, joint->r1);
+  PBVec2 p2 = PBVec2Add(b2->position, joint->r2);
   PBVec2 dp = PBVec2Sub(p2, p1);
 
-  if(PBPositionCorrection) {
+  if(flags & PBSolverPositionCorrection) {
     joint->bias = PBVec2MultF(dp, -joint->biasFactor * inv_dt);
   }
   else {
@@ -76,7 +87,7 @@ void PBJointPreStep(PBJoint* joint, float inv_dt) {
     joint->bias.y = 0.0f;
   }
   
-  if(PBWarmStarting) {
+  if(flags & PBSolverWarmStarting) {
     // Apply accumulated impulse.
     body1->velocity = PBVec2Sub(body1->velocity, PBVec2MultF(joint->P, body1->invMass));
     body1->angularVelocity -= body1->invI * PBVec2Cross(joint->r1, joint->P);
@@ -90,9 +101,10 @@ void PBJointPreStep(PBJoint* joint, float inv_dt) {
   }
 }
 
-void PBJointApplyImpulse(PBJoint* joint) {
-  PBBody* body1 = joint->body1;
-  PBBody* body2 = joint->body2;
+// Returns the size of the applied impulse, for convergence checks.
+float PBJointApplyImpulse(PBJoint* joint, PBSolverBody* bodies) {
+  PBSolverBody* body1 = bodies + joint->solverIndex1;
+  PBSolverBody* body2 = bodies + joint->solverIndex2;
   
   PBVec2 dv = PBVec2Sub(PBVec2Sub(PBVec2Add(body2->velocity, PBVec2FCross(body2->angularVelocity, joint->r2)), body1->velocity), PBVec2FCross(body1->angularVelocity, joint->r1));
 
@@ -105,4 +117,6 @@ void PBJointApplyImpulse(PBJoint* joint) {
   body2->angularVelocity += body2->invI * PBVec2Cross(joint->r2, impulse);
 
   joint->P = PBVec2Add(joint->P, impulse);
+
+  return PBMax(PBAbs(impulse.x), PBAbs(impulse.y));
 }
\ No newline at end of file
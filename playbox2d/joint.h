@@ -3,8 +3,20 @@
 
 #include "maths.h"
 #include "body.h"
+#include "solver.h"
 
-typedef struct {
+struct PBJoint;
+struct PBScene;
+
+// Links a joint into the joint list of one of its bodies.
+typedef struct PBJointEdge {
+  PBBody* other;
+  struct PBJoint* joint;
+  struct PBJointEdge* prev;
+  struct PBJointEdge* next;
+} PBJointEdge;
+
+typedef struct PBJoint {
   PBMat22 M;
   PBVec2 localAnchor1, localAnchor2;
   PBVec2 r1, r2;
@@ -17,12 +29,21 @@ typedef struct {
   
   // Reference to world
   void* world;
+  int pending;  // queued deferred world change: 1 add, -1 remove
+  PBJointEdge edge1;
+  PBJointEdge edge2;
+  int index;  // position in the world's joint array
+  int solverIndex1, solverIndex2;  // solver bodies for the current step
+  
+  // Scene the joint was loaded from, whose memory it lives in
+  struct PBScene* scene;
 } PBJoint;
 
 extern PBJoint* PBJointCreate(PBBody* b1, PBBody* b2, const PBVec2 anchor);
+extern void PBJointInit(PBJoint* joint, PBBody* b1, PBBody* b2, const PBVec2 anchor);
 extern PBJoint* PBJointCreateEmpty(void);
 extern void PBJointFree(PBJoint* body);
-extern void PBJointPreStep(PBJoint* joint, float inv_dt);
-extern void PBJointApplyImpulse(PBJoint* joint);
+extern void PBJointPreStep(PBJoint* joint, PBSolverBody* bodies, float inv_dt, int flags);
+extern float PBJointApplyImpulse(PBJoint* joint, PBSolverBody* bodies);
 
 #endif
\ No newline at end of file
@@ -4,6 +4,46 @@
 #include <math.h>
 #include <float.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Everything here is static inline so the vector math in the collision and
+// solver code compiles down to plain float instructions without relying on
+// link-time optimization.
+//
+// PB_SIMD (GCC and Clang host builds) backs the element-wise PBVec2 and
+// PBMat22 operations with compiler vector extensions. The device's FPU has
+// no float SIMD, so leave it off there. Results are the same either way, but
+// code that mixes lanes can get slower, so check tools/microbench first.
+//
+// PB_FAST_TRIG replaces sinf and cosf in PBMat22MakeWithAngle and PBSinCos
+// with a polynomial accurate to about 1e-6, which is much cheaper than the
+// C library on the device.
+//
+// PB_DETERMINISTIC makes the core give bit-identical results on the device,
+// the simulator and x86-64 hosts, for lockstep games and replays. It needs
+// the core files compiled with -ffp-contract=off and without -ffast-math,
+// as the Makefiles do with DETERMINISTIC=1: a fused multiply-add rounds once
+// where a separate multiply and add round twice. It also turns on
+// PB_FAST_TRIG, because every C library rounds sinf and cosf differently.
+
+#if defined(PB_SIMD) && !defined(__GNUC__)
+#undef PB_SIMD
+#endif
+
+#ifdef PB_DETERMINISTIC
+#ifdef __FAST_MATH__
+#error "PB_DETERMINISTIC doesn't work with -ffast-math"
+#endif
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0
+#error "PB_DETERMINISTIC needs float math done in float precision, not x87"
+#endif
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+#ifndef PB_FAST_TRIG
+#define PB_FAST_TRIG
+#endif
+#endif
 
 extern const float pb_pi;
 
@@ -11,44 +51,249 @@ typedef struct {
   float x, y;
 } PBVec2;
 
-extern PBVec2 PBVec2Make(float x, float y);
-extern PBVec2 PBVec2MakeEmpty(void);
-extern void PBVec2Set(PBVec2* v, float x, float y);
-extern PBVec2 PBVec2Invert(const PBVec2 v);
-extern PBVec2 PBVec2Add(const PBVec2 v1, const PBVec2 v2);
-extern float PBVec2AddF(const PBVec2 v1, float a);
-extern PBVec2 PBVec2Sub(const PBVec2 v1, const PBVec2 v2);
-extern PBVec2 PBVec2Mult(const PBVec2 v1, const PBVec2 v2);
-extern PBVec2 PBVec2MultF(const PBVec2 v1, float a);
-extern float PBVec2GetLength(const PBVec2 v1);
-extern float PBVec2Dot(PBVec2 v1, PBVec2 v2);
-extern float PBVec2Cross(PBVec2 v1, PBVec2 v2);
-extern PBVec2 PBVec2CrossF(PBVec2 v1, float s);
-extern PBVec2 PBVec2FCross(float s, PBVec2 v1);
-
 typedef struct {
   PBVec2 col1;
   PBVec2 col2;
 } PBMat22;
 
-extern PBMat22 PBMat22Make(PBVec2 v1, PBVec2 v2);
-extern PBMat22 PBMat22MakeWithAngle(float angle);
-extern PBMat22 PBMat22MakeEmpty(void);
-extern PBMat22 PBMat22Transpose(PBMat22 m);
-extern PBMat22 PBMat22Invert(PBMat22 m);
-extern PBMat22 PBMat22Mult(PBMat22 m1, PBMat22 m2);
-extern PBVec2 PBMat22MultVec(PBMat22 m1, PBVec2 v1);
-extern PBMat22 PBMat22Add(PBMat22 m1, PBMat22 m2);
+typedef struct {
+  PBVec2 lower;
+  PBVec2 upper;
+} PBAABB;
+
+#ifdef PB_SIMD
+typedef float PBFloat2 __attribute__((vector_size(8)));
+
+static inline PBFloat2 PBFloat2Load(PBVec2 v) {
+  PBFloat2 r;
+  memcpy(&r, &v, sizeof(r));
+  return r;
+}
+
+static inline PBVec2 PBFloat2Store(PBFloat2 r) {
+  PBVec2 v;
+  memcpy(&v, &r, sizeof(v));
+  return v;
+}
+#endif
+
+// SCALARS
+
+static inline float PBAbs(float a) {
+  return a > 0.0f ? a : -a;
+}
+
+static inline float PBSign(float a) {
+  return a < 0.0f ? -1.0f : 1.0f;
+}
+
+static inline float PBMin(float a, float b) {
+  return a < b ? a : b;
+}
+
+static inline float PBMax(float a, float b) {
+  return a > b ? a : b;
+}
+
+static inline float PBClamp(float a, float low, float high) {
+  return PBMax(low, PBMin(a, high));
+}
+
+static inline void PBSwap(void** a, void** b) {
+  void* tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+static inline void PBSinCos(float angle, float* s, float* c) {
+#ifdef PB_FAST_TRIG
+  // Reduce to r in [-pi/4, pi/4] and quadrant q, then evaluate the Taylor
+  // series of both, which are within float precision on that range.
+  float t = angle * 0.636619772f;
+  int q = (int)(t + (t < 0.0f ? -0.5f : 0.5f));
+  float r = (angle - q * 1.5703125f) - q * 4.83826794e-4f;
+  float r2 = r * r;
+  float sr = r + r * r2 * (-1.66666667e-1f + r2 * (8.33333333e-3f + r2 * -1.98412698e-4f));
+  float cr = 1.0f + r2 * (-0.5f + r2 * (4.16666667e-2f + r2 * (-1.38888889e-3f + r2 * 2.48015873e-5f)));
+  switch(q & 3) {
+    case 0: *s = sr; *c = cr; break;
+    case 1: *s = cr; *c = -sr; break;
+    case 2: *s = -sr; *c = -cr; break;
+    default: *s = -cr; *c = sr; break;
+  }
+#else
+  *s = sinf(angle);
+  *c = cosf(angle);
+#endif
+}
+
+// VECTORS
+
+static inline PBVec2 PBVec2Make(float x, float y) {
+  return (PBVec2){.x = x, .y = y};
+}
+
+static inline PBVec2 PBVec2MakeEmpty(void) {
+  return (PBVec2){.x = 0.0f, .y = 0.0f};
+}
+
+static inline void PBVec2Set(PBVec2* v, float x, float y) {
+  v->x = x;
+  v->y = y;
+}
+
+static inline PBVec2 PBVec2Invert(const PBVec2 v) {
+#ifdef PB_SIMD
+  return PBFloat2Store(-PBFloat2Load(v));
+#else
+  return (PBVec2){.x = -(v.x), .y = -(v.y)};
+#endif
+}
+
+static inline PBVec2 PBVec2Add(const PBVec2 v1, const PBVec2 v2) {
+#ifdef PB_SIMD
+  return PBFloat2Store(PBFloat2Load(v1) + PBFloat2Load(v2));
+#else
+  return (PBVec2){.x = (v1.x + v2.x), .y = (v1.y + v2.y)};
+#endif
+}
+
+static inline PBVec2 PBVec2Sub(const PBVec2 v1, const PBVec2 v2) {
+#ifdef PB_SIMD
+  return PBFloat2Store(PBFloat2Load(v1) - PBFloat2Load(v2));
+#else
+  return (PBVec2){.x = (v1.x - v2.x), .y = (v1.y - v2.y)};
+#endif
+}
+
+static inline PBVec2 PBVec2Mult(const PBVec2 v1, const PBVec2 v2) {
+#ifdef PB_SIMD
+  return PBFloat2Store(PBFloat2Load(v1) * PBFloat2Load(v2));
+#else
+  return (PBVec2){.x = (v1.x * v2.x), .y = (v1.y * v2.y)};
+#endif
+}
+
+static inline PBVec2 PBVec2MultF(const PBVec2 v1, float a) {
+#ifdef PB_SIMD
+  return PBFloat2Store(PBFloat2Load(v1) * a);
+#else
+  return (PBVec2){.x = (v1.x * a), .y = (v1.y * a)};
+#endif
+}
+
+static inline float PBVec2GetLength(const PBVec2 v) {
+  return sqrtf(v.x * v.x + v.y * v.y);
+}
+
+static inline float PBVec2Dot(PBVec2 a, PBVec2 b) {
+  return a.x * b.x + a.y * b.y;
+}
+
+static inline float PBVec2Cross(PBVec2 a, PBVec2 b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+static inline PBVec2 PBVec2CrossF(PBVec2 v, float s) {
+  return (PBVec2){.x = s * v.y, .y = -s * v.x};
+}
+
+static inline PBVec2 PBVec2FCross(float s, PBVec2 v) {
+  return (PBVec2){.x = -s * v.y, .y = s * v.x};
+}
+
+static inline PBVec2 PBVec2Abs(PBVec2 v1) {
+  return PBVec2Make(fabsf(v1.x), fabsf(v1.y));
+}
+
+// MATRICES
+
+static inline PBMat22 PBMat22Make(PBVec2 v1, PBVec2 v2) {
+  return (PBMat22){ .col1 = v1, .col2 = v2 };
+}
+
+static inline PBMat22 PBMat22MakeWithAngle(float angle) {
+  float c, s;
+  PBSinCos(angle, &s, &c);
+  return (PBMat22){ .col1.x = c, .col1.y = s, .col2.x = -s, .col2.y = c };
+}
+
+static inline PBMat22 PBMat22MakeEmpty(void) {
+  return (PBMat22){ .col1 = PBVec2MakeEmpty(), .col2 = PBVec2MakeEmpty() };
+}
+
+static inline PBMat22 PBMat22Transpose(PBMat22 m1) {
+  return PBMat22Make(
+    PBVec2Make(m1.col1.x, m1.col2.x),
+    PBVec2Make(m1.col1.y, m1.col2.y)
+  );
+}
+
+static inline PBMat22 PBMat22Invert(PBMat22 m1) {
+  float a = m1.col1.x, b = m1.col2.x, c = m1.col1.y, d = m1.col2.y;
+  float det = a * d - b * c;
+  det = 1.0f / det;
+
+  return PBMat22Make(
+    PBVec2Make(det * d, -det * c),
+    PBVec2Make(-det * b, det * a)
+  );
+}
+
+static inline PBVec2 PBMat22MultVec(PBMat22 m, PBVec2 v) {
+#ifdef PB_SIMD
+  return PBFloat2Store(PBFloat2Load(m.col1) * v.x + PBFloat2Load(m.col2) * v.y);
+#else
+  return PBVec2Make(m.col1.x * v.x + m.col2.x * v.y, m.col1.y * v.x + m.col2.y * v.y);
+#endif
+}
+
+static inline PBMat22 PBMat22Mult(PBMat22 m1, PBMat22 m2) {
+  return PBMat22Make(PBMat22MultVec(m1, m2.col1), PBMat22MultVec(m1, m2.col2));
+}
+
+static inline PBMat22 PBMat22Add(PBMat22 m1, PBMat22 m2) {
+  return PBMat22Make(PBVec2Add(m1.col1, m2.col1), PBVec2Add(m1.col2, m2.col2));
+}
+
+static inline PBMat22 PBMat22Abs(PBMat22 m1) {
+  return PBMat22Make(PBVec2Abs(m1.col1), PBVec2Abs(m1.col2));
+}
+
+// BOUNDING BOXES
+
+static inline PBAABB PBAABBMake(PBVec2 lower, PBVec2 upper) {
+  return (PBAABB){ .lower = lower, .upper = upper };
+}
+
+static inline PBAABB PBAABBCombine(PBAABB a, PBAABB b) {
+  return PBAABBMake(
+    PBVec2Make(PBMin(a.lower.x, b.lower.x), PBMin(a.lower.y, b.lower.y)),
+    PBVec2Make(PBMax(a.upper.x, b.upper.x), PBMax(a.upper.y, b.upper.y))
+  );
+}
+
+static inline PBAABB PBAABBExtend(PBAABB a, float margin) {
+  return PBAABBMake(
+    PBVec2Make(a.lower.x - margin, a.lower.y - margin),
+    PBVec2Make(a.upper.x + margin, a.upper.y + margin)
+  );
+}
+
+static inline int PBAABBOverlaps(PBAABB a, PBAABB b) {
+  return !(b.lower.x > a.upper.x || b.lower.y > a.upper.y || a.lower.x > b.upper.x || a.lower.y > b.upper.y);
+}
 
-extern float PBAbs(float a);
-extern PBVec2 PBVec2Abs(PBVec2 v1);
-extern PBMat22 PBMat22Abs(PBMat22 m1);
+static inline int PBAABBContains(PBAABB a, PBAABB b) {
+  return a.lower.x <= b.lower.x && a.lower.y <= b.lower.y && b.upper.x <= a.upper.x && b.upper.y <= a.upper.y;
+}
 
-extern float PBSign(float a);
-extern float PBMin(float a, float b);
-extern float PBMax(float a, float b);
-extern float PBClamp(float a, float low, float high);
+static inline int PBAABBContainsPoint(PBAABB a, PBVec2 p) {
+  return a.lower.x <= p.x && a.lower.y <= p.y && p.x <= a.upper.x && p.y <= a.upper.y;
+}
 
-extern void PBSwap(void** a, void** b);
+static inline float PBAABBGetPerimeter(PBAABB a) {
+  return 2.0f * ((a.upper.x - a.lower.x) + (a.upper.y - a.lower.y));
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -1,10 +1,36 @@
 #ifndef PLAYBOX_PLATFORM_H
 #define PLAYBOX_PLATFORM_H
 
+// Host builds (tools, servers, tests) define PB_HOST and run without the
+// Playdate runtime, using the C library instead.
+#ifdef PB_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define pb_alloc(x) malloc(x)
+#define pb_free(a) free(a)
+#define pb_calloc(a, b) malloc((a) * (b))
+#define pb_realloc realloc
+#define pb_log(s, ...) (fprintf(stderr, (s), ##__VA_ARGS__), fputc('\n', stderr))
+
+static inline unsigned int pb_host_milliseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#define pb_milliseconds() pb_host_milliseconds()
+
+#else
+
 #include "pd_api.h"
 
 extern PlaydateAPI* pd;
 
+#endif
+
 #ifndef pb_alloc
 #define pb_alloc(x) pd->system->realloc(NULL, (x))
 #endif
@@ -22,16 +48,16 @@ extern PlaydateAPI* pd;
 #define pb_log(s, ...) pd->system->logToConsole((s), ##__VA_ARGS__)
 #endif
 
-#ifndef PBPositionCorrection
-#define PBPositionCorrection 1
+#ifndef pb_milliseconds
+#define pb_milliseconds() pd->system->getCurrentTimeMilliseconds()
 #endif
 
-#ifndef PBWarmStarting
-#define PBWarmStarting 0
+#ifndef PB_FORCE_INLINE
+#if defined(__GNUC__)
+#define PB_FORCE_INLINE static inline __attribute__((always_inline))
+#else
+#define PB_FORCE_INLINE static inline
 #endif
-
-#ifndef PBAccumulateImpulses
-#define PBAccumulateImpulses 1
 #endif
 
 #endif
\ No newline at end of file
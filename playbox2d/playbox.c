@@ -5,10 +5,12 @@
 static const lua_reg worldClass[];
 static const lua_reg bodyClass[];
 static const lua_reg jointClass[];
+static const lua_reg streamClass[];
 
 #define CLASSNAME_WORLD "playbox.world"
 #define CLASSNAME_BODY "playbox.body"
 #define CLASSNAME_JOINT "playbox.joint"
+#define CLASSNAME_STREAM "playbox.stream"
 
 void registerPlaybox(void) {
   const char* err = NULL;
@@ -30,6 +32,12 @@ void registerPlaybox(void) {
     pb_log("playbox: Failed to register world class. %s", err);
     return;
   }
+  
+  // Register stream
+  if(!pd->lua->registerClass(CLASSNAME_STREAM, streamClass, NULL, 0, &err)) {
+    pb_log("playbox: Failed to register stream class. %s", err);
+    return;
+  }
 }
 
 // UTILITIES
@@ -37,6 +45,30 @@ void registerPlaybox(void) {
 static PBWorld* getWorldArg(int n) { return pd->lua->getArgObject(n, CLASSNAME_WORLD, NULL); }
 static PBBody* getBodyArg(int n) { return pd->lua->getArgObject(n, CLASSNAME_BODY, NULL); }
 static PBJoint* getJointArg(int n) { return pd->lua->getArgObject(n, CLASSNAME_JOINT, NULL); }
+static PBStream* getStreamArg(int n) { return pd->lua->getArgObject(n, CLASSNAME_STREAM, NULL); }
+
+// Reads a whole file into a new buffer for the caller to free.
+static void* readFile(const char* path, int* size) {
+  FileStat stat;
+  SDFile* file = pd->file->open(path, kFileRead | kFileReadData);
+  if(file == NULL || pd->file->stat(path, &stat) != 0) {
+    pb_log("playbox: couldn't open %s", path);
+    if(file != NULL) {
+      pd->file->close(file);
+    }
+    return NULL;
+  }
+  
+  void* data = pb_alloc(stat.size);
+  *size = pd->file->read(file, data, stat.size);
+  pd->file->close(file);
+  
+  if(*size <= 0) {
+    pb_free(data);
+    return NULL;
+  }
+  return data;
+}
 
 // BODY CLASS
 
@@ -57,9 +89,65 @@ int playbox_body_new(lua_State* L) {
   return 1;
 }
 
+int playbox_body_newCircle(lua_State* L) {
+  PBBody* body = PBBodyCreate();
+  
+  float radius = pd->lua->getArgFloat(1);
+  float m = pd->lua->getArgFloat(2);
+  
+  if(m == 0.0f) {
+    m = FLT_MAX;
+  }
+  
+  PBBodySetCircle(body, radius, m);
+  
+  pd->lua->pushObject(body, CLASSNAME_BODY, 0);
+  return 1;
+}
+
+int playbox_body_newPolygon(lua_State* L) {
+  float m = pd->lua->getArgFloat(1);
+  
+  if(m == 0.0f) {
+    m = FLT_MAX;
+  }
+  
+  int argCount = pd->lua->getArgCount() - 1;
+  if(argCount % 2 != 0) {
+    pb_log("playbox: newPolygon takes x, y pairs but got an odd number of coordinates");
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  PBVec2 vertices[PB_MAX_POLYGON_VERTICES];
+  int count = argCount / 2;
+  if(count > PB_MAX_POLYGON_VERTICES) {
+    count = PB_MAX_POLYGON_VERTICES + 1; // let PBBodySetPolygon reject it
+  }
+  
+  for(int i = 0; i < count && i < PB_MAX_POLYGON_VERTICES; i++) {
+    vertices[i].x = pd->lua->getArgFloat(2 + i * 2);
+    vertices[i].y = pd->lua->getArgFloat(3 + i * 2);
+  }
+  
+  PBBody* body = PBBodyCreate();
+  if(!PBBodySetPolygon(body, vertices, count, m)) {
+    PBBodyFree(body);
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  pd->lua->pushObject(body, CLASSNAME_BODY, 0);
+  return 1;
+}
+
 int playbox_body_delete(lua_State* L) {
   PBBody* body = getBodyArg(1);
-  if(body != NULL) {
+  if(body != NULL && body->scene != NULL) {
+    // Scene bodies keep their world alive instead of owning themselves.
+    pd->lua->releaseObject(body->scene->userData);
+  }
+  else if(body != NULL) {
     PBBodyFree(body);
   }
     
@@ -70,7 +158,7 @@ int playbox_body_addForce(lua_State* L) {
   PBBody* body = getBodyArg(1);
   float x = pd->lua->getArgFloat(2);
   float y = pd->lua->getArgFloat(3);
-  PBBodyAddForce(body, PBVec2Make(x, y));
+  PBWorldAddBodyForce(body->world, body, PBVec2Make(x, y));
   return 0;
 }
 
@@ -78,49 +166,107 @@ int playbox_body_setCenter(lua_State* L) {
   PBBody* body = getBodyArg(1);
   body->position.x = pd->lua->getArgFloat(2);
   body->position.y = pd->lua->getArgFloat(3);
+  if(body->world != NULL) {
+    PBWorldUpdateBody(body->world, body);
+  }
   return 0;
 }
 
 int playbox_body_setRotation(lua_State* L) {
   PBBody* body = getBodyArg(1);
+  if(body->fixedRotation) {
+    return 0;
+  }
   body->rotation = pd->lua->getArgFloat(2);
+  if(body->world != NULL) {
+    PBWorldUpdateBody(body->world, body);
+  }
+  return 0;
+}
+
+int playbox_body_setFixedRotation(lua_State* L) {
+  PBBody* body = getBodyArg(1);
+  PBBodySetFixedRotation(body, pd->lua->getArgBool(2));
+  if(body->world != NULL) {
+    PBWorldUpdateBody(body->world, body);
+  }
+  return 0;
+}
+
+int playbox_body_setBullet(lua_State* L) {
+  PBBody* body = getBodyArg(1);
+  body->bullet = pd->lua->getArgBool(2);
+  return 0;
+}
+
+// 0 picks the level from the distance to the world's LOD focus, 1 is full,
+// 2 reduced and 3 frozen.
+int playbox_body_setLOD(lua_State* L) {
+  PBBody* body = getBodyArg(1);
+  int lod = pd->lua->getArgInt(2);
+  if(lod < PBBodyLODAuto || lod > PBBodyLODFrozen) {
+    pb_log("playbox: invalid level of detail %d", lod);
+    return 0;
+  }
+  body->lod = (PBBodyLOD)lod;
   return 0;
 }
 
 int playbox_body_setVelocity(lua_State* L) {
   PBBody* body = getBodyArg(1);
-  body->velocity.x = pd->lua->getArgFloat(2);
-  body->velocity.y = pd->lua->getArgFloat(3);
+  float x = pd->lua->getArgFloat(2);
+  float y = pd->lua->getArgFloat(3);
+  PBWorldSetBodyVelocity(body->world, body, PBVec2Make(x, y));
   return 0;
 }
 
 int playbox_body_setAngularVelocity(lua_State* L) {
   PBBody* body = getBodyArg(1);
-  body->angularVelocity = pd->lua->getArgFloat(2);
+  PBWorldSetBodyAngularVelocity(body->world, body, pd->lua->getArgFloat(2));
   return 0;
 }
 
 int playbox_body_setForce(lua_State* L) {
   PBBody* body = getBodyArg(1);
-  body->force.x = pd->lua->getArgFloat(2);
-  body->force.y = pd->lua->getArgFloat(3);
+  float x = pd->lua->getArgFloat(2);
+  float y = pd->lua->getArgFloat(3);
+  PBWorldSetBodyForce(body->world, body, PBVec2Make(x, y));
   return 0;
 }
 
 int playbox_body_setTorque(lua_State* L) {
   PBBody* body = getBodyArg(1);
-  body->torque = pd->lua->getArgFloat(2);
+  PBWorldSetBodyTorque(body->world, body, pd->lua->getArgFloat(2));
   return 0;
 }
 
 int playbox_body_setSize(lua_State* L) {
   PBBody* body = getBodyArg(1);
+  if(body->shape.type != PBShapeTypeBox) {
+    pb_log("playbox: setSize only applies to box bodies");
+    return 0;
+  }
   body->width.x = pd->lua->getArgFloat(2);
   body->width.y = pd->lua->getArgFloat(3);
   body->AABBHalfSize = PBVec2GetLength(body->width) * 0.5f;
+  if(body->world != NULL) {
+    PBWorldUpdateBody(body->world, body);
+  }
+  return 0;
+}
+
+int playbox_body_setTag(lua_State* L) {
+  PBBody* body = getBodyArg(1);
+  body->tag = pd->lua->getArgInt(2);
   return 0;
 }
 
+int playbox_body_getTag(lua_State* L) {
+  PBBody* body = getBodyArg(1);
+  pd->lua->pushInt(body->tag);
+  return 1;
+}
+
 int playbox_body_setFriction(lua_State* L) {
   PBBody* body = getBodyArg(1);
   body->friction = pd->lua->getArgFloat(2);
@@ -141,6 +287,9 @@ int playbox_body_setMass(lua_State* L) {
 
 int playbox_body_setI(lua_State* L) {
   PBBody* body = getBodyArg(1);
+  if(body->fixedRotation) {
+    return 0;
+  }
   body->I = pd->lua->getArgFloat(2);
   if(body->I < FLT_MAX) {
     body->invI = 1.0f / body->I;
@@ -171,6 +320,12 @@ int playbox_body_getSize(lua_State* L) {
   return 2;
 }
 
+int playbox_body_getRadius(lua_State* L) {
+  PBBody* body = getBodyArg(1);
+  pd->lua->pushFloat(body->shape.type == PBShapeTypeCircle ? body->shape.radius : 0.0f);
+  return 1;
+}
+
 int playbox_body_getVelocity(lua_State* L) {
   PBBody* body = getBodyArg(1);
   pd->lua->pushFloat(body->velocity.x);
@@ -184,6 +339,32 @@ int playbox_body_getPolygon(lua_State* L) {
   
   PBMat22 R = PBMat22MakeWithAngle(body->rotation);
   PBVec2 x = body->position;
+  
+  float scale = 1.0;
+  if(world != NULL) {
+    scale = world->pixelScale;
+  }
+  
+  if(body->shape.type == PBShapeTypeCircle) {
+    // Approximate the circle outline with the maximum polygon vertex count.
+    for(int i = 0; i < PB_MAX_POLYGON_VERTICES; i++) {
+      float angle = 2.0f * pb_pi * (float)i / (float)PB_MAX_POLYGON_VERTICES;
+      PBVec2 v = PBVec2Add(x, PBMat22MultVec(R, PBVec2Make(cosf(angle) * body->shape.radius, sinf(angle) * body->shape.radius)));
+      pd->lua->pushFloat(v.x * scale);
+      pd->lua->pushFloat(v.y * scale);
+    }
+    return PB_MAX_POLYGON_VERTICES * 2;
+  }
+  
+  if(body->shape.type == PBShapeTypePolygon) {
+    for(int i = 0; i < body->shape.vertexCount; i++) {
+      PBVec2 v = PBVec2Add(x, PBMat22MultVec(R, body->shape.vertices[i]));
+      pd->lua->pushFloat(v.x * scale);
+      pd->lua->pushFloat(v.y * scale);
+    }
+    return body->shape.vertexCount * 2;
+  }
+  
   PBVec2 h = PBVec2MultF(body->width, 0.5f);
 
   PBVec2 v1 = PBVec2Add(x, PBMat22MultVec(R, PBVec2Make(-h.x, -h.y)));
@@ -191,11 +372,6 @@ int playbox_body_getPolygon(lua_State* L) {
   PBVec2 v3 = PBVec2Add(x, PBMat22MultVec(R, PBVec2Make( h.x,  h.y)));
   PBVec2 v4 = PBVec2Add(x, PBMat22MultVec(R, PBVec2Make(-h.x,  h.y)));
   
-  float scale = 1.0;
-  if(world != NULL) {
-    scale = world->pixelScale;
-  }
-  
   pd->lua->pushFloat(v1.x * scale);
   pd->lua->pushFloat(v1.y * scale);
   pd->lua->pushFloat(v2.x * scale);
@@ -210,12 +386,17 @@ int playbox_body_getPolygon(lua_State* L) {
 
 static const lua_reg bodyClass[] = {
 { "new", playbox_body_new },
+{ "newCircle", playbox_body_newCircle },
+{ "newPolygon", playbox_body_newPolygon },
 { "__gc", playbox_body_delete },
 { "addForce", playbox_body_addForce },
 { "setCenter", playbox_body_setCenter },
 { "getCenter", playbox_body_getCenter },
 { "setRotation", playbox_body_setRotation },
 { "getRotation", playbox_body_getRotation },
+{ "setFixedRotation", playbox_body_setFixedRotation },
+{ "setBullet", playbox_body_setBullet },
+{ "setLOD", playbox_body_setLOD },
 { "setVelocity", playbox_body_setVelocity },
 { "getVelocity", playbox_body_getVelocity },
 { "setAngularVelocity", playbox_body_setAngularVelocity },
@@ -223,10 +404,13 @@ static const lua_reg bodyClass[] = {
 { "setTorque", playbox_body_setTorque },
 { "setSize", playbox_body_setSize },
 { "getSize", playbox_body_getSize },
+{ "getRadius", playbox_body_getRadius },
 { "setFriction", playbox_body_setFriction },
 { "setMass", playbox_body_setMass },
 { "setI", playbox_body_setI },
 { "getPolygon", playbox_body_getPolygon },
+{ "setTag", playbox_body_setTag },
+{ "getTag", playbox_body_getTag },
 { NULL, NULL }
 };
 
@@ -247,7 +431,10 @@ int playbox_joint_new(lua_State* L) {
 
 int playbox_joint_delete(lua_State* L) {
   PBJoint* joint = getJointArg(1);
-  if(joint != NULL) {
+  if(joint != NULL && joint->scene != NULL) {
+    pd->lua->releaseObject(joint->scene->userData);
+  }
+  else if(joint != NULL) {
     PBJointFree(joint);
   }
   return 0;
@@ -319,6 +506,66 @@ int playbox_world_new(lua_State* L) {
   return 1;
 }
 
+// Reads a scene file written by tools/scenec into a new world.
+int playbox_world_loadScene(lua_State* L) {
+  int size = 0;
+  void* data = readFile(pd->lua->getArgString(1), &size);
+  PBWorld* world = NULL;
+  if(data != NULL) {
+    world = PBSceneLoad(data, size);
+    pb_free(data);
+  }
+  
+  if(world == NULL) {
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  LuaUDObject* object = pd->lua->pushObject(world, CLASSNAME_WORLD, 0);
+  world->scene->userData = object;
+  return 1;
+}
+
+int playbox_world_getSceneBodyCount(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  pd->lua->pushInt(world->scene != NULL ? world->scene->bodyCount : 0);
+  return 1;
+}
+
+// Scene bodies and joints are only freed with their world, so each object
+// handed to Lua keeps the world alive.
+int playbox_world_getSceneBody(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBBody* body = PBSceneGetBody(world->scene, pd->lua->getArgInt(2) - 1);
+  if(body == NULL) {
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  pd->lua->retainObject(world->scene->userData);
+  pd->lua->pushObject(body, CLASSNAME_BODY, 0);
+  return 1;
+}
+
+int playbox_world_getSceneJointCount(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  pd->lua->pushInt(world->scene != NULL ? world->scene->jointCount : 0);
+  return 1;
+}
+
+int playbox_world_getSceneJoint(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBJoint* joint = PBSceneGetJoint(world->scene, pd->lua->getArgInt(2) - 1);
+  if(joint == NULL) {
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  pd->lua->retainObject(world->scene->userData);
+  pd->lua->pushObject(joint, CLASSNAME_JOINT, 0);
+  return 1;
+}
+
 int playbox_world_delete(lua_State* L) {
   PBWorld* world = getWorldArg(1);
   if(world != NULL) {
@@ -361,6 +608,18 @@ int playbox_world_clear(lua_State* L) {
   return 0;
 }
 
+int playbox_world_setDeferred(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldSetDeferred(world, pd->lua->getArgBool(2));
+  return 0;
+}
+
+int playbox_world_flush(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldFlushCommands(world);
+  return 0;
+}
+
 int playbox_world_step(lua_State* L) {
   PBWorld* world = getWorldArg(1);
   float dt = pd->lua->getArgFloat(2);
@@ -368,6 +627,15 @@ int playbox_world_step(lua_State* L) {
   return 0;
 }
 
+// Returns true when a step finished during the call.
+int playbox_world_updateWithBudget(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  float dt = pd->lua->getArgFloat(2);
+  int milliseconds = pd->lua->getArgInt(3);
+  pd->lua->pushBool(PBWorldStepWithBudget(world, dt, milliseconds));
+  return 1;
+}
+
 int playbox_world_getArbiterCount(lua_State* L) {
   PBWorld* world = getWorldArg(1);
   pd->lua->pushInt(world->arbiters->count);
@@ -379,7 +647,7 @@ int playbox_world_getArbiterPosition(lua_State* L) {
   int i = pd->lua->getArgInt(2);
   
   i -= 1;
-  PBArbiter* arbiter = (PBArbiter*)PBArrayGetItem(world->arbiters, i);
+  PBArbiter* arbiter = PBWorldGetArbiter(world, i);
   
   for(int j = 0; j < arbiter->numContacts; j++) {
     PBVec2 p = arbiter->contacts[j].position;
@@ -390,6 +658,9 @@ int playbox_world_getArbiterPosition(lua_State* L) {
   return arbiter->numContacts * 2;
 }
 
+// Only getPolygon and joint getPoints are scaled, for drawing. Every other
+// position, size and distance, including LOD settings, casts and queries,
+// is in world units.
 int playbox_world_setPixelScale(lua_State* L) {
   PBWorld* world = getWorldArg(1);
   float scale = pd->lua->getArgFloat(2);
@@ -406,18 +677,387 @@ int playbox_world_getNumberOfContacts(lua_State* L) {
   return 1;
 }
 
+int playbox_world_setManifoldReuseTolerance(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  float linearTolerance = pd->lua->getArgFloat(2);
+  float angularTolerance = pd->lua->getArgFloat(3);
+  PBWorldSetManifoldReuseTolerance(world, linearTolerance, angularTolerance);
+  return 0;
+}
+
+int playbox_world_setSolverTolerance(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  float tolerance = pd->lua->getArgFloat(2);
+  int minIterations = pd->lua->getArgInt(3);
+  PBWorldSetSolverTolerance(world, tolerance, minIterations);
+  return 0;
+}
+
+int playbox_world_setBlockSolver(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldSetBlockSolver(world, pd->lua->getArgBool(2));
+  return 0;
+}
+
+int playbox_world_setSplitImpulse(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldSetSplitImpulse(world, pd->lua->getArgBool(2));
+  return 0;
+}
+
+// Booleans for position correction, warm starting and accumulated impulses.
+int playbox_world_setSolverFlags(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  int flags = 0;
+  if(pd->lua->getArgBool(2)) {
+    flags |= PBSolverPositionCorrection;
+  }
+  if(pd->lua->getArgBool(3)) {
+    flags |= PBSolverWarmStarting;
+  }
+  if(pd->lua->getArgBool(4)) {
+    flags |= PBSolverAccumulateImpulses;
+  }
+  PBWorldSetSolverFlags(world, flags);
+  return 0;
+}
+
+int playbox_world_setBulletsHitDynamic(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldSetBulletsHitDynamic(world, pd->lua->getArgBool(2));
+  return 0;
+}
+
+// Focus rectangle, usually the view, in world units like the queries below.
+int playbox_world_setLODFocus(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  float x = pd->lua->getArgFloat(2);
+  float y = pd->lua->getArgFloat(3);
+  float width = pd->lua->getArgFloat(4);
+  float height = pd->lua->getArgFloat(5);
+  PBWorldSetLODFocus(world, PBAABBMake(PBVec2Make(x, y), PBVec2Make(x + width, y + height)));
+  return 0;
+}
+
+int playbox_world_clearLODFocus(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldClearLODFocus(world);
+  return 0;
+}
+
+int playbox_world_setLODDistances(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  float reducedDistance = pd->lua->getArgFloat(2);
+  float frozenDistance = pd->lua->getArgFloat(3);
+  int interval = pd->lua->getArgInt(4);
+  PBWorldSetLODDistances(world, reducedDistance, frozenDistance, interval);
+  return 0;
+}
+
+int playbox_world_setReorder(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  int interval = pd->lua->getArgInt(2);
+  float threshold = pd->lua->getArgFloat(3);
+  PBWorldSetReorder(world, interval, threshold);
+  return 0;
+}
+
+int playbox_world_reorder(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldReorder(world);
+  return 0;
+}
+
+// Enabling restarts the hash.
+int playbox_world_setStateHash(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBWorldSetStateHash(world, pd->lua->getArgBool(2));
+  return 0;
+}
+
+// The hash's 32 bits as a Lua integer.
+int playbox_world_getStateHash(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  pd->lua->pushInt((int)PBWorldGetStateHash(world));
+  return 1;
+}
+
+int playbox_world_getStats(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  pd->lua->pushInt(world->stats.narrowphaseCalls);
+  pd->lua->pushInt(world->stats.narrowphaseSkipped);
+  pd->lua->pushInt(world->stats.bulletSubSteps);
+  pd->lua->pushInt(world->stats.iterations);
+  pd->lua->pushInt(world->stats.islands);
+  pd->lua->pushInt(world->stats.lodSkipped);
+  pd->lua->pushBool(world->stats.reordered);
+  return 7;
+}
+
+// Bodies can't be handed back to Lua without a second owner freeing them, so
+// queries report hit bodies by tag.
+static int pushRayCastHit(PBRayCastHit* hit) {
+  pd->lua->pushFloat(hit->point.x);
+  pd->lua->pushFloat(hit->point.y);
+  pd->lua->pushFloat(hit->normal.x);
+  pd->lua->pushFloat(hit->normal.y);
+  pd->lua->pushFloat(hit->fraction);
+  pd->lua->pushInt(hit->body->tag);
+  return 6;
+}
+
+int playbox_world_rayCast(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBVec2 p1 = PBVec2Make(pd->lua->getArgFloat(2), pd->lua->getArgFloat(3));
+  PBVec2 p2 = PBVec2Make(pd->lua->getArgFloat(4), pd->lua->getArgFloat(5));
+  
+  PBRayCastHit hit;
+  if(!PBWorldRayCastClosest(world, p1, p2, &hit)) {
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  return pushRayCastHit(&hit);
+}
+
+int playbox_world_rayCastAny(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBVec2 p1 = PBVec2Make(pd->lua->getArgFloat(2), pd->lua->getArgFloat(3));
+  PBVec2 p2 = PBVec2Make(pd->lua->getArgFloat(4), pd->lua->getArgFloat(5));
+  pd->lua->pushBool(PBWorldRayCastAny(world, p1, p2, NULL));
+  return 1;
+}
+
+#define PB_LUA_MAX_RAYCAST_HITS 32
+
+typedef struct {
+  PBRayCastHit hits[PB_LUA_MAX_RAYCAST_HITS];
+  int count;
+} PBRayCastAllResult;
+
+static float rayCastAllCallback(const PBRayCastHit* hit, void* context) {
+  PBRayCastAllResult* result = (PBRayCastAllResult*)context;
+  
+  // Insertion sort by fraction. Once full, the farthest hit is dropped.
+  int i = result->count < PB_LUA_MAX_RAYCAST_HITS ? result->count++ : PB_LUA_MAX_RAYCAST_HITS - 1;
+  if(i == PB_LUA_MAX_RAYCAST_HITS - 1 && result->hits[i].body != NULL && result->hits[i].fraction <= hit->fraction) {
+    return 1.0f;
+  }
+  while(i > 0 && result->hits[i - 1].fraction > hit->fraction) {
+    result->hits[i] = result->hits[i - 1];
+    i--;
+  }
+  result->hits[i] = *hit;
+  return 1.0f;
+}
+
+// Returns tag, fraction pairs for every body along the ray, nearest first.
+int playbox_world_rayCastAll(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBVec2 p1 = PBVec2Make(pd->lua->getArgFloat(2), pd->lua->getArgFloat(3));
+  PBVec2 p2 = PBVec2Make(pd->lua->getArgFloat(4), pd->lua->getArgFloat(5));
+  
+  PBRayCastAllResult result;
+  memset(&result, 0, sizeof(PBRayCastAllResult));
+  PBWorldRayCast(world, p1, p2, rayCastAllCallback, &result);
+  
+  for(int i = 0; i < result.count; i++) {
+    pd->lua->pushInt(result.hits[i].body->tag);
+    pd->lua->pushFloat(result.hits[i].fraction);
+  }
+  return result.count * 2;
+}
+
+// Takes up to 32 x1, y1, x2, y2 rays and returns a tag, fraction pair for
+// the closest hit of each, or nil, nil on a miss.
+int playbox_world_rayCastBatch(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  int argCount = pd->lua->getArgCount() - 1;
+  int count = argCount / 4;
+  if(argCount % 4 != 0 || count > PB_LUA_MAX_RAYCAST_HITS) {
+    pb_log("playbox: rayCastBatch takes up to %d rays of x1, y1, x2, y2", PB_LUA_MAX_RAYCAST_HITS);
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  PBRayCastInput rays[PB_LUA_MAX_RAYCAST_HITS];
+  PBRayCastHit hits[PB_LUA_MAX_RAYCAST_HITS];
+  for(int i = 0; i < count; i++) {
+    rays[i].p1 = PBVec2Make(pd->lua->getArgFloat(2 + i * 4), pd->lua->getArgFloat(3 + i * 4));
+    rays[i].p2 = PBVec2Make(pd->lua->getArgFloat(4 + i * 4), pd->lua->getArgFloat(5 + i * 4));
+    rays[i].maxFraction = 1.0f;
+  }
+  
+  PBWorldRayCastBatch(world, rays, count, hits);
+  
+  for(int i = 0; i < count; i++) {
+    if(hits[i].body != NULL) {
+      pd->lua->pushInt(hits[i].body->tag);
+      pd->lua->pushFloat(hits[i].fraction);
+    }
+    else {
+      pd->lua->pushNil();
+      pd->lua->pushNil();
+    }
+  }
+  return count * 2;
+}
+
+int playbox_world_boxCast(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBVec2 size = PBVec2Make(pd->lua->getArgFloat(2), pd->lua->getArgFloat(3));
+  float rotation = pd->lua->getArgFloat(4);
+  PBVec2 p1 = PBVec2Make(pd->lua->getArgFloat(5), pd->lua->getArgFloat(6));
+  PBVec2 p2 = PBVec2Make(pd->lua->getArgFloat(7), pd->lua->getArgFloat(8));
+  
+  PBRayCastHit hit;
+  if(!PBWorldBoxCast(world, size, rotation, p1, p2, &hit)) {
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  return pushRayCastHit(&hit);
+}
+
+#define PB_LUA_MAX_QUERY_BODIES 64
+
+// Playdate's Lua API can't build tables from C, so overlap queries return
+// tags as multiple values. Collect them with { world:queryAABB(...) }.
+static int pushBodyTags(PBBody** bodies, int count) {
+  for(int i = 0; i < count; i++) {
+    pd->lua->pushInt(bodies[i]->tag);
+  }
+  return count;
+}
+
+int playbox_world_queryAABB(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  float x = pd->lua->getArgFloat(2);
+  float y = pd->lua->getArgFloat(3);
+  float w = pd->lua->getArgFloat(4);
+  float h = pd->lua->getArgFloat(5);
+  
+  PBBody* bodies[PB_LUA_MAX_QUERY_BODIES];
+  PBAABB aabb = PBAABBMake(PBVec2Make(x, y), PBVec2Make(x + w, y + h));
+  int count = PBWorldQueryAABBBodies(world, aabb, bodies, PB_LUA_MAX_QUERY_BODIES);
+  return pushBodyTags(bodies, count);
+}
+
+int playbox_world_queryPoint(lua_State* L) {
+  PBWorld* world = getWorldArg(1);
+  PBVec2 p = PBVec2Make(pd->lua->getArgFloat(2), pd->lua->getArgFloat(3));
+  
+  PBBody* bodies[PB_LUA_MAX_QUERY_BODIES];
+  int count = PBWorldQueryPointBodies(world, p, bodies, PB_LUA_MAX_QUERY_BODIES);
+  return pushBodyTags(bodies, count);
+}
+
 static const lua_reg worldClass[] = {
 { "new", playbox_world_new },
+{ "loadScene", playbox_world_loadScene },
 { "__gc", playbox_world_delete },
 { "addBody", playbox_world_addBody },
 { "removeBody", playbox_world_removeBody },
 { "addJoint", playbox_world_addJoint },
 { "removeJoint", playbox_world_removeJoint },
 { "clear", playbox_world_clear },
+{ "setDeferred", playbox_world_setDeferred },
+{ "flush", playbox_world_flush },
 { "update", playbox_world_step },
+{ "updateWithBudget", playbox_world_updateWithBudget },
 { "getArbiterCount", playbox_world_getArbiterCount },
 { "getArbiterPosition", playbox_world_getArbiterPosition },
 { "setPixelScale", playbox_world_setPixelScale },
 { "getNumberOfContacts", playbox_world_getNumberOfContacts },
+{ "setManifoldReuseTolerance", playbox_world_setManifoldReuseTolerance },
+{ "setSolverTolerance", playbox_world_setSolverTolerance },
+{ "setBlockSolver", playbox_world_setBlockSolver },
+{ "setSplitImpulse", playbox_world_setSplitImpulse },
+{ "setSolverFlags", playbox_world_setSolverFlags },
+{ "setBulletsHitDynamic", playbox_world_setBulletsHitDynamic },
+{ "setLODFocus", playbox_world_setLODFocus },
+{ "clearLODFocus", playbox_world_clearLODFocus },
+{ "setLODDistances", playbox_world_setLODDistances },
+{ "setReorder", playbox_world_setReorder },
+{ "reorder", playbox_world_reorder },
+{ "setStateHash", playbox_world_setStateHash },
+{ "getStateHash", playbox_world_getStateHash },
+{ "getStats", playbox_world_getStats },
+{ "rayCast", playbox_world_rayCast },
+{ "rayCastAny", playbox_world_rayCastAny },
+{ "rayCastAll", playbox_world_rayCastAll },
+{ "rayCastBatch", playbox_world_rayCastBatch },
+{ "boxCast", playbox_world_boxCast },
+{ "queryAABB", playbox_world_queryAABB },
+{ "queryPoint", playbox_world_queryPoint },
+{ "getSceneBodyCount", playbox_world_getSceneBodyCount },
+{ "getSceneBody", playbox_world_getSceneBody },
+{ "getSceneJointCount", playbox_world_getSceneJointCount },
+{ "getSceneJoint", playbox_world_getSceneJoint },
+{ NULL, NULL }
+};
+
+
+// STREAM CLASS
+
+// Streams a scene file into world. The stream keeps the world alive.
+int playbox_stream_new(lua_State* L) {
+  LuaUDObject* worldObject = NULL;
+  PBWorld* world = pd->lua->getArgObject(1, CLASSNAME_WORLD, &worldObject);
+  float cellSize = pd->lua->getArgFloat(3);
+  int radius = pd->lua->getArgInt(4);
+  
+  int size = 0;
+  void* data = readFile(pd->lua->getArgString(2), &size);
+  if(data == NULL) {
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  PBStream* stream = PBStreamCreate(world, cellSize, radius);
+  int loaded = PBStreamLoadScene(stream, data, size);
+  pb_free(data);
+  if(!loaded) {
+    PBStreamFree(stream);
+    pd->lua->pushNil();
+    return 1;
+  }
+  
+  stream->userData = pd->lua->retainObject(worldObject);
+  pd->lua->pushObject(stream, CLASSNAME_STREAM, 0);
+  return 1;
+}
+
+int playbox_stream_delete(lua_State* L) {
+  PBStream* stream = getStreamArg(1);
+  if(stream != NULL) {
+    LuaUDObject* worldObject = stream->userData;
+    PBStreamFree(stream);
+    pd->lua->releaseObject(worldObject);
+  }
+  return 0;
+}
+
+// Returns the number of chunks loaded or unloaded.
+int playbox_stream_setFocus(lua_State* L) {
+  PBStream* stream = getStreamArg(1);
+  PBVec2 focus = PBVec2Make(pd->lua->getArgFloat(2), pd->lua->getArgFloat(3));
+  pd->lua->pushInt(PBStreamSetFocus(stream, focus));
+  return 1;
+}
+
+int playbox_stream_getStats(lua_State* L) {
+  PBStream* stream = getStreamArg(1);
+  pd->lua->pushInt(stream->activeChunks);
+  pd->lua->pushInt(stream->bodies->count);
+  pd->lua->pushInt(stream->storedBodies);
+  return 3;
+}
+
+static const lua_reg streamClass[] = {
+{ "new", playbox_stream_new },
+{ "__gc", playbox_stream_delete },
+{ "setFocus", playbox_stream_setFocus },
+{ "getStats", playbox_stream_getStats },
 { NULL, NULL }
 };
@@ -6,6 +6,10 @@
 #include "joint.h"
 #include "arbiter.h"
 #include "world.h"
+#include "query.h"
+#include "snapshot.h"
+#include "scene.h"
+#include "stream.h"
 
 extern void registerPlaybox(void);
 
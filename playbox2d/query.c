@@ -0,0 +1,556 @@
+#include "platform.h"
+#include "query.h"
+
+PBBody* PBWorldGetBody(PBWorld* world, int i);
+
+// SHAPE PRIMITIVES
+
+static int PBRayCastCircle(PBVec2 center, float radius, PBVec2 p1, PBVec2 d, float maxFraction, float* fraction, PBVec2* normal) {
+  PBVec2 s = PBVec2Sub(p1, center);
+  float b = PBVec2Dot(s, s) - radius * radius;
+
+  float c = PBVec2Dot(s, d);
+  float rr = PBVec2Dot(d, d);
+  float sigma = c * c - rr * b;
+
+  if(sigma < 0.0f || rr < FLT_EPSILON) {
+    return 0;
+  }
+
+  // Find the point of intersection of the line with the circle.
+  float a = -(c + sqrtf(sigma));
+  if(a < 0.0f || a > maxFraction * rr) {
+    return 0;
+  }
+
+  a /= rr;
+  *fraction = a;
+  PBVec2 n = PBVec2Add(s, PBVec2MultF(d, a));
+  *normal = PBVec2MultF(n, 1.0f / PBVec2GetLength(n));
+  return 1;
+}
+
+static int PBRayCastPolygon(const PBPolygon* polygon, PBVec2 p1, PBVec2 d, float maxFraction, float* fraction, PBVec2* normal) {
+  float lower = 0.0f;
+  float upper = maxFraction;
+  int index = -1;
+
+  for(int i = 0; i < polygon->count; i++) {
+    // p = p1 + a * d
+    // dot(normal, p - v) = 0
+    // dot(normal, p1 - v) + a * dot(normal, d) = 0
+    float numerator = PBVec2Dot(polygon->normals[i], PBVec2Sub(polygon->vertices[i], p1));
+    float denominator = PBVec2Dot(polygon->normals[i], d);
+
+    if(denominator == 0.0f) {
+      if(numerator < 0.0f) {
+        return 0;
+      }
+    }
+    else if(denominator < 0.0f && numerator < lower * denominator) {
+      // The segment enters this half-space.
+      lower = numerator / denominator;
+      index = i;
+    }
+    else if(denominator > 0.0f && numerator < upper * denominator) {
+      // The segment exits this half-space.
+      upper = numerator / denominator;
+    }
+
+    if(upper < lower) {
+      return 0;
+    }
+  }
+
+  // Rays starting inside the polygon don't report a hit.
+  if(index < 0) {
+    return 0;
+  }
+
+  *fraction = lower;
+  *normal = polygon->normals[index];
+  return 1;
+}
+
+// Ray against a polygon grown by radius, with rounded corners.
+static int PBRayCastRoundedPolygon(const PBPolygon* polygon, float radius, PBVec2 p1, PBVec2 d, float maxFraction, float* fraction, PBVec2* normal) {
+  float best = maxFraction;
+  int found = 0;
+
+  for(int i = 0; i < polygon->count; i++) {
+    PBVec2 n = polygon->normals[i];
+    float denominator = PBVec2Dot(n, d);
+    if(denominator >= 0.0f) {
+      continue;
+    }
+
+    PBVec2 a = PBVec2Add(polygon->vertices[i], PBVec2MultF(n, radius));
+    float t = PBVec2Dot(n, PBVec2Sub(a, p1)) / denominator;
+    if(t < 0.0f || t > best) {
+      continue;
+    }
+
+    PBVec2 tangent = PBVec2Sub(polygon->vertices[i + 1 < polygon->count ? i + 1 : 0], polygon->vertices[i]);
+    float s = PBVec2Dot(PBVec2Sub(PBVec2Add(p1, PBVec2MultF(d, t)), a), tangent);
+    if(s < 0.0f || s > PBVec2Dot(tangent, tangent)) {
+      continue;
+    }
+
+    best = t;
+    *normal = n;
+    found = 1;
+  }
+
+  for(int i = 0; i < polygon->count; i++) {
+    float t;
+    PBVec2 n;
+    if(PBRayCastCircle(polygon->vertices[i], radius, p1, d, best, &t, &n) && t < best) {
+      best = t;
+      *normal = n;
+      found = 1;
+    }
+  }
+
+  *fraction = best;
+  return found;
+}
+
+// Signed distance from a point to a polygon, negative inside. The normal
+// points from the polygon towards the point.
+static float PBPolygonGetDistance(const PBPolygon* polygon, PBVec2 p, PBVec2* normal) {
+  int index = 0;
+  float separation = -FLT_MAX;
+  for(int i = 0; i < polygon->count; i++) {
+    float s = PBVec2Dot(polygon->normals[i], PBVec2Sub(p, polygon->vertices[i]));
+    if(s > separation) {
+      separation = s;
+      index = i;
+    }
+  }
+
+  if(separation <= 0.0f) {
+    *normal = polygon->normals[index];
+    return separation;
+  }
+
+  float best = FLT_MAX;
+  for(int i = 0; i < polygon->count; i++) {
+    PBVec2 v1 = polygon->vertices[i];
+    PBVec2 e = PBVec2Sub(polygon->vertices[i + 1 < polygon->count ? i + 1 : 0], v1);
+    float u = PBClamp(PBVec2Dot(PBVec2Sub(p, v1), e) / PBVec2Dot(e, e), 0.0f, 1.0f);
+    PBVec2 delta = PBVec2Sub(p, PBVec2Add(v1, PBVec2MultF(e, u)));
+    float distance = PBVec2GetLength(delta);
+    if(distance < best) {
+      best = distance;
+      *normal = distance > FLT_EPSILON ? PBVec2MultF(delta, 1.0f / distance) : polygon->normals[i];
+    }
+  }
+  return best;
+}
+
+static PBVec2 PBPolygonGetSupport(const PBPolygon* polygon, PBVec2 direction) {
+  int best = 0;
+  float bestValue = PBVec2Dot(polygon->vertices[0], direction);
+  for(int i = 1; i < polygon->count; i++) {
+    float value = PBVec2Dot(polygon->vertices[i], direction);
+    if(value > bestValue) {
+      best = i;
+      bestValue = value;
+    }
+  }
+  return polygon->vertices[best];
+}
+
+static void PBPolygonProject(const PBPolygon* polygon, PBVec2 axis, float* lower, float* upper) {
+  *lower = FLT_MAX;
+  *upper = -FLT_MAX;
+  for(int i = 0; i < polygon->count; i++) {
+    float p = PBVec2Dot(axis, polygon->vertices[i]);
+    *lower = PBMin(*lower, p);
+    *upper = PBMax(*upper, p);
+  }
+}
+
+// Swept separating axis test for a translating polygon. Convex polygons only
+// need their own face normals as axes.
+static int PBSweepPolygons(const PBPolygon* polyA, PBVec2 d, const PBPolygon* polyB, float* fraction, PBVec2* normal, PBVec2* point) {
+  float enter = -FLT_MAX;
+  float exit = FLT_MAX;
+  PBVec2 enterNormal = PBVec2Make(0.0f, 0.0f);
+  int enterFaceOfA = 0;
+
+  for(int k = 0; k < polyA->count + polyB->count; k++) {
+    int faceOfA = k < polyA->count;
+    PBVec2 axis = faceOfA ? polyA->normals[k] : polyB->normals[k - polyA->count];
+
+    float lowerA, upperA, lowerB, upperB;
+    PBPolygonProject(polyA, axis, &lowerA, &upperA);
+    PBPolygonProject(polyB, axis, &lowerB, &upperB);
+
+    float v = PBVec2Dot(d, axis);
+    if(PBAbs(v) < FLT_EPSILON) {
+      if(upperA < lowerB || lowerA > upperB) {
+        return 0;
+      }
+      continue;
+    }
+
+    float t1 = (lowerB - upperA) / v;
+    float t2 = (upperB - lowerA) / v;
+    float axisEnter = PBMin(t1, t2);
+    float axisExit = PBMax(t1, t2);
+
+    if(axisEnter > enter) {
+      enter = axisEnter;
+      enterNormal = v > 0.0f ? PBVec2Invert(axis) : axis;
+      enterFaceOfA = faceOfA;
+    }
+    exit = PBMin(exit, axisExit);
+
+    if(enter > exit || exit < 0.0f || enter > 1.0f) {
+      return 0;
+    }
+  }
+
+  *fraction = PBMax(enter, 0.0f);
+  *normal = enterNormal;
+
+  // The touching feature is a vertex of whichever polygon did not supply the axis.
+  if(enterFaceOfA) {
+    *point = PBPolygonGetSupport(polyB, enterNormal);
+  }
+  else {
+    *point = PBVec2Add(PBPolygonGetSupport(polyA, PBVec2Invert(enterNormal)), PBVec2MultF(d, *fraction));
+  }
+  return 1;
+}
+
+int PBBodyTestPoint(PBBody* body, PBVec2 p) {
+  if(body->shape.type == PBShapeTypeCircle) {
+    PBVec2 d = PBVec2Sub(p, body->position);
+    return PBVec2Dot(d, d) <= body->shape.radius * body->shape.radius;
+  }
+
+  PBPolygon polygon;
+  PBBodyGetWorldPolygon(body, &polygon);
+  for(int i = 0; i < polygon.count; i++) {
+    if(PBVec2Dot(polygon.normals[i], PBVec2Sub(p, polygon.vertices[i])) > 0.0f) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int PBBodyRayCast(PBBody* body, const PBRayCastInput* input, PBRayCastHit* hit) {
+  PBVec2 d = PBVec2Sub(input->p2, input->p1);
+  float fraction;
+  PBVec2 normal;
+  int found;
+
+  if(body->shape.type == PBShapeTypeCircle) {
+    found = PBRayCastCircle(body->position, body->shape.radius, input->p1, d, input->maxFraction, &fraction, &normal);
+  }
+  else {
+    PBPolygon polygon;
+    PBBodyGetWorldPolygon(body, &polygon);
+    found = PBRayCastPolygon(&polygon, input->p1, d, input->maxFraction, &fraction, &normal);
+  }
+
+  if(!found) {
+    return 0;
+  }
+
+  hit->body = body;
+  hit->fraction = fraction;
+  hit->normal = normal;
+  hit->point = PBVec2Add(input->p1, PBVec2MultF(d, fraction));
+  return 1;
+}
+
+// Sweeps shape along translation against target, ignoring rotation. Hits
+// at the start of the sweep report a fraction of zero.
+int PBBodyShapeCast(PBBody* shape, PBVec2 translation, PBBody* target, PBRayCastHit* hit) {
+  float fraction = 0.0f;
+  PBVec2 normal = PBVec2MakeEmpty();
+  PBVec2 point;
+
+  int shapeIsCircle = shape->shape.type == PBShapeTypeCircle;
+  int targetIsCircle = target->shape.type == PBShapeTypeCircle;
+
+  if(shapeIsCircle && targetIsCircle) {
+    float radius = shape->shape.radius + target->shape.radius;
+    PBVec2 delta = PBVec2Sub(shape->position, target->position);
+    float distance = PBVec2GetLength(delta);
+
+    if(distance < radius) {
+      normal = distance > FLT_EPSILON ? PBVec2MultF(delta, 1.0f / distance) : PBVec2Make(0.0f, -1.0f);
+    }
+    else if(!PBRayCastCircle(target->position, radius, shape->position, translation, 1.0f, &fraction, &normal)) {
+      return 0;
+    }
+
+    point = PBVec2Add(target->position, PBVec2MultF(normal, target->shape.radius));
+  }
+  else if(shapeIsCircle) {
+    PBPolygon polygon;
+    PBBodyGetWorldPolygon(target, &polygon);
+
+    float radius = shape->shape.radius;
+    if(PBPolygonGetDistance(&polygon, shape->position, &normal) >= radius) {
+      if(!PBRayCastRoundedPolygon(&polygon, radius, shape->position, translation, 1.0f, &fraction, &normal)) {
+        return 0;
+      }
+    }
+
+    PBVec2 center = PBVec2Add(shape->position, PBVec2MultF(translation, fraction));
+    point = PBVec2Sub(center, PBVec2MultF(normal, radius));
+  }
+  else if(targetIsCircle) {
+    // Sweep the circle backwards against the moving polygon instead.
+    PBPolygon polygon;
+    PBBodyGetWorldPolygon(shape, &polygon);
+
+    float radius = target->shape.radius;
+    PBVec2 polygonNormal;
+    if(PBPolygonGetDistance(&polygon, target->position, &polygonNormal) >= radius) {
+      if(!PBRayCastRoundedPolygon(&polygon, radius, target->position, PBVec2Invert(translation), 1.0f, &fraction, &polygonNormal)) {
+        return 0;
+      }
+    }
+
+    normal = PBVec2Invert(polygonNormal);
+    point = PBVec2Add(target->position, PBVec2MultF(normal, radius));
+  }
+  else {
+    PBPolygon polyA, polyB;
+    PBBodyGetWorldPolygon(shape, &polyA);
+    PBBodyGetWorldPolygon(target, &polyB);
+
+    if(!PBSweepPolygons(&polyA, translation, &polyB, &fraction, &normal, &point)) {
+      return 0;
+    }
+  }
+
+  hit->body = target;
+  hit->fraction = fraction;
+  hit->normal = normal;
+  hit->point = point;
+  return 1;
+}
+
+// OVERLAP QUERIES
+
+typedef struct {
+  PBWorld* world;
+  PBAABB aabb;
+  PBVec2 point;
+  PBQueryCallback callback;
+  void* context;
+} PBWorldQueryContext;
+
+static int PBWorldQueryAABBTreeCallback(int proxyId, void* context) {
+  PBWorldQueryContext* query = (PBWorldQueryContext*)context;
+  PBBody* body = (PBBody*)PBDynamicTreeGetUserData(query->world->tree, proxyId);
+
+  // The tree holds fattened AABBs, so check against the body's own.
+  if(!PBAABBOverlaps(PBBodyGetAABB(body), query->aabb)) {
+    return 1;
+  }
+  return query->callback(body, query->context);
+}
+
+static int PBWorldQueryPointTreeCallback(int proxyId, void* context) {
+  PBWorldQueryContext* query = (PBWorldQueryContext*)context;
+  PBBody* body = (PBBody*)PBDynamicTreeGetUserData(query->world->tree, proxyId);
+
+  if(!PBBodyTestPoint(body, query->point)) {
+    return 1;
+  }
+  return query->callback(body, query->context);
+}
+
+typedef struct {
+  PBBody** bodies;
+  int count;
+  int maxBodies;
+} PBQueryBodiesResult;
+
+static int PBQueryBodiesCallback(PBBody* body, void* context) {
+  PBQueryBodiesResult* result = (PBQueryBodiesResult*)context;
+  result->bodies[result->count++] = body;
+  return result->count < result->maxBodies;
+}
+
+// Bodies whose AABB overlaps aabb. This is conservative for rotated and
+// round shapes.
+void PBWorldQueryAABB(PBWorld* world, PBAABB aabb, PBQueryCallback callback, void* context) {
+  PBWorldQueryContext query = { .world = world, .aabb = aabb, .callback = callback, .context = context };
+  PBDynamicTreeQuery(world->tree, aabb, PBWorldQueryAABBTreeCallback, &query);
+}
+
+int PBWorldQueryAABBBodies(PBWorld* world, PBAABB aabb, PBBody** bodies, int maxBodies) {
+  if(maxBodies <= 0) {
+    return 0;
+  }
+
+  PBQueryBodiesResult result = { .bodies = bodies, .count = 0, .maxBodies = maxBodies };
+  PBWorldQueryAABB(world, aabb, PBQueryBodiesCallback, &result);
+  return result.count;
+}
+
+// Bodies whose shape contains p.
+void PBWorldQueryPoint(PBWorld* world, PBVec2 p, PBQueryCallback callback, void* context) {
+  PBWorldQueryContext query = { .world = world, .point = p, .callback = callback, .context = context };
+  PBDynamicTreeQuery(world->tree, PBAABBMake(p, p), PBWorldQueryPointTreeCallback, &query);
+}
+
+int PBWorldQueryPointBodies(PBWorld* world, PBVec2 p, PBBody** bodies, int maxBodies) {
+  if(maxBodies <= 0) {
+    return 0;
+  }
+
+  PBQueryBodiesResult result = { .bodies = bodies, .count = 0, .maxBodies = maxBodies };
+  PBWorldQueryPoint(world, p, PBQueryBodiesCallback, &result);
+  return result.count;
+}
+
+// RAY CASTS
+
+typedef struct {
+  PBWorld* world;
+  PBRayCastCallback callback;
+  void* context;
+} PBWorldRayCastContext;
+
+static float PBWorldRayCastTreeCallback(const PBRayCastInput* input, int proxyId, void* context) {
+  PBWorldRayCastContext* rayCast = (PBWorldRayCastContext*)context;
+  PBBody* body = (PBBody*)PBDynamicTreeGetUserData(rayCast->world->tree, proxyId);
+
+  PBRayCastHit hit;
+  if(!PBBodyRayCast(body, input, &hit)) {
+    return input->maxFraction;
+  }
+
+  float value = rayCast->callback(&hit, rayCast->context);
+
+  // Ignoring the hit leaves the ray as it was.
+  return value < 0.0f ? input->maxFraction : value;
+}
+
+void PBWorldRayCast(PBWorld* world, PBVec2 p1, PBVec2 p2, PBRayCastCallback callback, void* context) {
+  PBWorldRayCastContext rayCast = { .world = world, .callback = callback, .context = context };
+  PBRayCastInput input = { .p1 = p1, .p2 = p2, .maxFraction = 1.0f };
+  PBDynamicTreeRayCast(world->tree, &input, PBWorldRayCastTreeCallback, &rayCast);
+}
+
+typedef struct {
+  PBRayCastHit hit;
+  int found;
+} PBRayCastResult;
+
+static float PBRayCastClosestCallback(const PBRayCastHit* hit, void* context) {
+  PBRayCastResult* result = (PBRayCastResult*)context;
+  result->hit = *hit;
+  result->found = 1;
+  return hit->fraction;
+}
+
+static float PBRayCastAnyCallback(const PBRayCastHit* hit, void* context) {
+  PBRayCastResult* result = (PBRayCastResult*)context;
+  result->hit = *hit;
+  result->found = 1;
+  return 0.0f;
+}
+
+int PBWorldRayCastClosest(PBWorld* world, PBVec2 p1, PBVec2 p2, PBRayCastHit* hit) {
+  PBRayCastResult result = { .found = 0 };
+  PBWorldRayCast(world, p1, p2, PBRayCastClosestCallback, &result);
+  if(result.found && hit != NULL) {
+    *hit = result.hit;
+  }
+  return result.found;
+}
+
+int PBWorldRayCastAny(PBWorld* world, PBVec2 p1, PBVec2 p2, PBRayCastHit* hit) {
+  PBRayCastResult result = { .found = 0 };
+  PBWorldRayCast(world, p1, p2, PBRayCastAnyCallback, &result);
+  if(result.found && hit != NULL) {
+    *hit = result.hit;
+  }
+  return result.found;
+}
+
+// Closest hit for each ray. Rays that miss get a NULL body. Returns the number of hits.
+int PBWorldRayCastBatch(PBWorld* world, const PBRayCastInput* rays, int count, PBRayCastHit* hits) {
+  int numHits = 0;
+
+  for(int i = 0; i < count; i++) {
+    PBRayCastResult result = { .found = 0 };
+    PBWorldRayCastContext rayCast = { .world = world, .callback = PBRayCastClosestCallback, .context = &result };
+    PBDynamicTreeRayCast(world->tree, rays + i, PBWorldRayCastTreeCallback, &rayCast);
+
+    if(result.found) {
+      hits[i] = result.hit;
+      numHits++;
+    }
+    else {
+      memset(hits + i, 0, sizeof(PBRayCastHit));
+      hits[i].fraction = rays[i].maxFraction;
+    }
+  }
+
+  return numHits;
+}
+
+// SHAPE CASTS
+
+typedef struct {
+  PBWorld* world;
+  PBBody* shape;
+  PBVec2 translation;
+  PBRayCastResult result;
+} PBWorldShapeCastContext;
+
+static int PBWorldShapeCastQueryCallback(int proxyId, void* context) {
+  PBWorldShapeCastContext* shapeCast = (PBWorldShapeCastContext*)context;
+  PBBody* body = (PBBody*)PBDynamicTreeGetUserData(shapeCast->world->tree, proxyId);
+
+  if(body == shapeCast->shape) {
+    return 1;
+  }
+
+  PBRayCastHit hit;
+  if(PBBodyShapeCast(shapeCast->shape, shapeCast->translation, body, &hit)) {
+    if(!shapeCast->result.found || hit.fraction < shapeCast->result.hit.fraction) {
+      shapeCast->result.hit = hit;
+      shapeCast->result.found = 1;
+    }
+  }
+  return 1;
+}
+
+// Closest body hit by shape's body moving along translation. The shape does
+// not need to be in the world, and is skipped if it is.
+int PBWorldShapeCast(PBWorld* world, PBBody* shape, PBVec2 translation, PBRayCastHit* hit) {
+  PBAABB start = PBBodyGetAABB(shape);
+  PBAABB end = PBAABBMake(PBVec2Add(start.lower, translation), PBVec2Add(start.upper, translation));
+
+  PBWorldShapeCastContext shapeCast = { .world = world, .shape = shape, .translation = translation };
+  PBDynamicTreeQuery(world->tree, PBAABBCombine(start, end), PBWorldShapeCastQueryCallback, &shapeCast);
+
+  if(shapeCast.result.found && hit != NULL) {
+    *hit = shapeCast.result.hit;
+  }
+  return shapeCast.result.found;
+}
+
+int PBWorldBoxCast(PBWorld* world, PBVec2 size, float rotation, PBVec2 p1, PBVec2 p2, PBRayCastHit* hit) {
+  PBBody box;
+  memset(&box, 0, sizeof(PBBody));
+  PBBodySet(&box, size, FLT_MAX);
+  box.position = p1;
+  box.rotation = rotation;
+  box.proxyId = PB_NULL_NODE;
+
+  return PBWorldShapeCast(world, &box, PBVec2Sub(p2, p1), hit);
+}
@@ -0,0 +1,39 @@
+#ifndef PLAYBOX_QUERY_H
+#define PLAYBOX_QUERY_H
+
+#include "maths.h"
+#include "body.h"
+#include "world.h"
+#include "broadphase.h"
+
+typedef struct {
+  PBBody* body;
+  PBVec2 point;
+  PBVec2 normal;  // surface normal of the hit body
+  float fraction;  // along the ray or cast translation
+} PBRayCastHit;
+
+// Called for each hit in no particular order. Return -1 to ignore the hit,
+// 0 to stop, hit->fraction to clip the ray to it, or 1 to continue unclipped.
+typedef float (*PBRayCastCallback)(const PBRayCastHit* hit, void* context);
+
+// Called for each body found by an overlap query. Return 0 to stop the query.
+typedef int (*PBQueryCallback)(PBBody* body, void* context);
+
+extern int PBBodyTestPoint(PBBody* body, PBVec2 p);
+extern int PBBodyRayCast(PBBody* body, const PBRayCastInput* input, PBRayCastHit* hit);
+extern int PBBodyShapeCast(PBBody* shape, PBVec2 translation, PBBody* target, PBRayCastHit* hit);
+
+extern void PBWorldRayCast(PBWorld* world, PBVec2 p1, PBVec2 p2, PBRayCastCallback callback, void* context);
+extern int PBWorldRayCastClosest(PBWorld* world, PBVec2 p1, PBVec2 p2, PBRayCastHit* hit);
+extern int PBWorldRayCastAny(PBWorld* world, PBVec2 p1, PBVec2 p2, PBRayCastHit* hit);
+extern int PBWorldRayCastBatch(PBWorld* world, const PBRayCastInput* rays, int count, PBRayCastHit* hits);
+extern int PBWorldShapeCast(PBWorld* world, PBBody* shape, PBVec2 translation, PBRayCastHit* hit);
+extern int PBWorldBoxCast(PBWorld* world, PBVec2 size, float rotation, PBVec2 p1, PBVec2 p2, PBRayCastHit* hit);
+
+extern void PBWorldQueryAABB(PBWorld* world, PBAABB aabb, PBQueryCallback callback, void* context);
+extern int PBWorldQueryAABBBodies(PBWorld* world, PBAABB aabb, PBBody** bodies, int maxBodies);
+extern void PBWorldQueryPoint(PBWorld* world, PBVec2 p, PBQueryCallback callback, void* context);
+extern int PBWorldQueryPointBodies(PBWorld* world, PBVec2 p, PBBody** bodies, int maxBodies);
+
+#endif
@@ -0,0 +1,171 @@
+#include "platform.h"
+#include "scene.h"
+
+// Sets up a body from a scene record. Returns 0 if the record is invalid.
+int PBSceneInitBody(PBBody* body, const PBSceneBody* record) {
+  PBBodyInit(body);
+  
+  float mass = record->mass > 0.0f ? record->mass : FLT_MAX;
+  switch(record->shapeType) {
+    case PBShapeTypeBox:
+      PBBodySet(body, record->size, mass);
+      break;
+    case PBShapeTypeCircle:
+      PBBodySetCircle(body, record->radius, mass);
+      break;
+    case PBShapeTypePolygon:
+      if(record->vertexCount > PB_SCENE_MAX_VERTICES || !PBBodySetPolygon(body, record->vertices, record->vertexCount, mass)) {
+        return 0;
+      }
+      break;
+    default:
+      pb_log("playbox: PBSceneLoad: unknown shape type %i", (int)record->shapeType);
+      return 0;
+  }
+  
+  body->friction = record->friction;
+  body->position = record->position;
+  body->rotation = record->rotation;
+  body->velocity = record->velocity;
+  body->angularVelocity = record->angularVelocity;
+  body->tag = record->tag;
+  body->bullet = (record->flags & PBSceneBodyBullet) != 0;
+  if(record->flags & PBSceneBodyFixedRotation) {
+    PBBodySetFixedRotation(body, 1);
+  }
+  return 1;
+}
+
+// The inverse of PBSceneInitBody, for the body's current state.
+void PBSceneWriteBody(const PBBody* body, PBSceneBody* record) {
+  memset(record, 0, sizeof(PBSceneBody));
+  record->shapeType = body->shape.type;
+  record->size = body->width;
+  record->radius = body->shape.radius;
+  if(body->shape.type == PBShapeTypePolygon) {
+    record->vertexCount = body->shape.vertexCount;
+    memcpy(record->vertices, body->shape.vertices, sizeof(PBVec2) * body->shape.vertexCount);
+  }
+  record->mass = body->mass < FLT_MAX ? body->mass : 0.0f;
+  record->friction = body->friction;
+  record->position = body->position;
+  record->rotation = body->rotation;
+  record->velocity = body->velocity;
+  record->angularVelocity = body->angularVelocity;
+  record->flags = (body->fixedRotation ? PBSceneBodyFixedRotation : 0) | (body->bullet ? PBSceneBodyBullet : 0);
+  record->tag = body->tag;
+}
+
+void PBSceneApplySettings(PBWorld* world, const PBSceneHeader* header) {
+  world->gravity = header->gravity;
+  world->iterations = header->iterations;
+  world->pixelScale = header->pixelScale;
+  PBWorldSetSolverTolerance(world, header->solverTolerance, header->minIterations);
+  PBWorldSetManifoldReuseTolerance(world, header->manifoldReuseLinearTolerance, header->manifoldReuseAngularTolerance);
+  PBWorldSetBlockSolver(world, (header->flags & PBSceneWorldBlockSolver) != 0);
+  PBWorldSetSplitImpulse(world, (header->flags & PBSceneWorldSplitImpulse) != 0);
+  PBWorldSetBulletsHitDynamic(world, (header->flags & PBSceneWorldBulletsHitDynamic) != 0);
+}
+
+// Checks the header and that the records fit. Returns NULL if the data is not a valid scene.
+const PBSceneHeader* PBSceneGetHeader(const void* data, int size) {
+  const PBSceneHeader* header = (const PBSceneHeader*)data;
+  if(size < (int)sizeof(PBSceneHeader) || header->magic != PB_SCENE_MAGIC) {
+    pb_log("playbox: PBSceneLoad: not a scene");
+    return NULL;
+  }
+  if(header->version != PB_SCENE_VERSION) {
+    pb_log("playbox: PBSceneLoad: unsupported scene version %i", (int)header->version);
+    return NULL;
+  }
+  // Bound the counts by division so a hostile header can't wrap size_t on the device.
+  if(header->size < sizeof(PBSceneHeader) || header->size > (uint32_t)size ||
+     header->bodyCount < 0 || header->jointCount < 0 ||
+     (uint32_t)header->bodyCount > (header->size - sizeof(PBSceneHeader)) / sizeof(PBSceneBody)) {
+    pb_log("playbox: PBSceneLoad: scene is truncated");
+    return NULL;
+  }
+  uint32_t jointBytes = header->size - sizeof(PBSceneHeader) - header->bodyCount * sizeof(PBSceneBody);
+  if((uint32_t)header->jointCount > jointBytes / sizeof(PBSceneJoint)) {
+    pb_log("playbox: PBSceneLoad: scene is truncated");
+    return NULL;
+  }
+  return header;
+}
+
+// Creates a world from a scene in one pass. All bodies and joints share one
+// allocation and the world's arrays are sized up front. Returns NULL if the
+// data is not a valid scene.
+PBWorld* PBSceneLoad(const void* data, int size) {
+  const PBSceneHeader* header = PBSceneGetHeader(data, size);
+  if(header == NULL) {
+    return NULL;
+  }
+  
+  int bodyCount = header->bodyCount;
+  int jointCount = header->jointCount;
+
+  const PBSceneBody* bodyRecords = (const PBSceneBody*)(header + 1);
+  const PBSceneJoint* jointRecords = (const PBSceneJoint*)(bodyRecords + bodyCount);
+  
+  PBScene* scene = pb_alloc(sizeof(PBScene) + bodyCount * sizeof(PBBody) + jointCount * sizeof(PBJoint));
+  memset(scene, 0, sizeof(PBScene));
+  scene->bodies = (PBBody*)(scene + 1);
+  scene->bodyCount = bodyCount;
+  scene->joints = (PBJoint*)(scene->bodies + bodyCount);
+  scene->jointCount = jointCount;
+  
+  PBWorld* world = PBWorldCreate(header->gravity, header->iterations);
+  world->scene = scene;
+  PBSceneApplySettings(world, header);
+  
+  PBArrayReserve(world->bodies, bodyCount);
+  PBArrayReserve(world->joints, jointCount);
+  
+  for(int i = 0; i < bodyCount; i++) {
+    PBBody* body = scene->bodies + i;
+    if(!PBSceneInitBody(body, bodyRecords + i)) {
+      pb_log("playbox: PBSceneLoad: invalid body %i", i);
+      PBWorldFree(world);
+      return NULL;
+    }
+    body->scene = scene;
+    PBWorldAddBody(world, body);
+  }
+  
+  for(int i = 0; i < jointCount; i++) {
+    const PBSceneJoint* record = jointRecords + i;
+    if(record->body1 < 0 || record->body1 >= bodyCount || record->body2 < 0 || record->body2 >= bodyCount) {
+      pb_log("playbox: PBSceneLoad: joint %i has an invalid body", i);
+      PBWorldFree(world);
+      return NULL;
+    }
+    
+    PBJoint* joint = scene->joints + i;
+    PBJointInit(joint, scene->bodies + record->body1, scene->bodies + record->body2, record->anchor);
+    joint->softness = record->softness;
+    joint->biasFactor = record->biasFactor;
+    joint->scene = scene;
+    PBWorldAddJoint(world, joint);
+  }
+  
+  return world;
+}
+
+PBScene* PBWorldGetScene(PBWorld* world) {
+  return world->scene;
+}
+
+PBBody* PBSceneGetBody(PBScene* scene, int i) {
+  if(scene == NULL || i < 0 || i >= scene->bodyCount) {
+    return NULL;
+  }
+  return scene->bodies + i;
+}
+
+PBJoint* PBSceneGetJoint(PBScene* scene, int i) {
+  if(scene == NULL || i < 0 || i >= scene->jointCount) {
+    return NULL;
+  }
+  return scene->joints + i;
+}
@@ -0,0 +1,90 @@
+#ifndef PLAYBOX_SCENE_H
+#define PLAYBOX_SCENE_H
+
+#include <stdint.h>
+
+#include "maths.h"
+#include "body.h"
+#include "joint.h"
+#include "world.h"
+
+// Flat binary scene: a PBSceneHeader, then bodyCount PBSceneBody records,
+// then jointCount PBSceneJoint records. Every field is 4 bytes and stored
+// little-endian, so a loaded or memory-mapped file can be read in place.
+
+#define PB_SCENE_MAGIC 0x4E435350  // "PSCN"
+#define PB_SCENE_VERSION 1
+#define PB_SCENE_MAX_VERTICES 8
+
+typedef enum {
+  PBSceneWorldBlockSolver = 1 << 0,
+  PBSceneWorldSplitImpulse = 1 << 1,
+  PBSceneWorldBulletsHitDynamic = 1 << 2
+} PBSceneWorldFlags;
+
+typedef enum {
+  PBSceneBodyFixedRotation = 1 << 0,
+  PBSceneBodyBullet = 1 << 1
+} PBSceneBodyFlags;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;  // bytes in the whole scene
+  int32_t bodyCount;
+  int32_t jointCount;
+  
+  // World settings
+  PBVec2 gravity;
+  int32_t iterations;
+  float pixelScale;
+  uint32_t flags;  // PBSceneWorldFlags
+  float solverTolerance;
+  int32_t minIterations;
+  float manifoldReuseLinearTolerance;
+  float manifoldReuseAngularTolerance;
+} PBSceneHeader;
+
+typedef struct {
+  int32_t shapeType;  // PBShapeType
+  PBVec2 size;  // box
+  float radius;  // circle
+  int32_t vertexCount;  // polygon
+  PBVec2 vertices[PB_SCENE_MAX_VERTICES];
+  float mass;  // 0 for static bodies
+  float friction;
+  PBVec2 position;
+  float rotation;
+  PBVec2 velocity;
+  float angularVelocity;
+  uint32_t flags;  // PBSceneBodyFlags
+  int32_t tag;
+} PBSceneBody;
+
+typedef struct {
+  int32_t body1, body2;  // indices of scene bodies
+  PBVec2 anchor;
+  float softness;
+  float biasFactor;
+} PBSceneJoint;
+
+// Bodies and joints created by PBSceneLoad. They live in one block that is
+// freed with the world, so PBBodyFree and PBJointFree ignore them.
+typedef struct PBScene {
+  PBBody* bodies;
+  int bodyCount;
+  PBJoint* joints;
+  int jointCount;
+  void* userData;  // for bindings, e.g. the object that owns the world
+} PBScene;
+
+extern PBWorld* PBSceneLoad(const void* data, int size);
+extern const PBSceneHeader* PBSceneGetHeader(const void* data, int size);
+extern void PBSceneApplySettings(PBWorld* world, const PBSceneHeader* header);
+extern int PBSceneInitBody(PBBody* body, const PBSceneBody* record);
+extern void PBSceneWriteBody(const PBBody* body, PBSceneBody* record);
+extern PBScene* PBWorldGetScene(PBWorld* world);
+extern PBBody* PBSceneGetBody(PBScene* scene, int i);
+extern PBJoint* PBSceneGetJoint(PBScene* scene, int i);
+
+#endif
@@ -0,0 +1,444 @@
+#include "platform.h"
+#include "snapshot.h"
+
+PBBody* PBWorldGetBody(PBWorld* world, int i);
+PBJoint* PBWorldGetJoint(PBWorld* world, int i);
+void PBWorldAddArbiter(PBWorld* world, PBArbiter* arbiter);
+void PBWorldDestroyArbiter(PBWorld* world, PBArbiter* arbiter);
+
+typedef struct {
+  PBVec2 position;
+  float rotation;
+  PBVec2 velocity;
+  float angularVelocity;
+  PBVec2 force;
+  float torque;
+  float lodTime;
+} PBSnapshotBody;
+
+typedef struct {
+  int32_t x, y;
+  int16_t rotation;
+  int16_t vx, vy;
+  int16_t angularVelocity;
+  float lodTime;  // kept exact so skipped time is made up in full
+} PBSnapshotQuantizedBody;
+
+typedef struct {
+  PBVec2 P;
+} PBSnapshotJoint;
+
+// Followed by numContacts PBContacts
+typedef struct {
+  int32_t body1, body2;  // indices in the world's body array
+  int32_t numContacts;
+  PBVec2 manifoldRelativePosition;
+  float manifoldRelativeRotation;
+  PBVec2 contactsRelativePosition;
+  PBVec2 contactsPosition;
+  float contactsRotation;
+} PBSnapshotArbiter;
+
+static int PBSnapshotBodyRecordSize(int flags) {
+  return (flags & PBSnapshotQuantized) ? sizeof(PBSnapshotQuantizedBody) : sizeof(PBSnapshotBody);
+}
+
+static int PBSnapshotMaskSize(int count) {
+  return ((count + 31) / 32) * sizeof(uint32_t);
+}
+
+// QUANTIZATION
+
+static int32_t PBSnapshotQuantize(float v, float step, int32_t min, int32_t max) {
+  float q = floorf(v / step + 0.5f);
+  if(q <= (float)min) {
+    return min;
+  }
+  if(q >= (float)max) {
+    return max;
+  }
+  return (int32_t)q;
+}
+
+static int16_t PBSnapshotQuantizeAngle(float angle) {
+  float turns = angle / (2.0f * pb_pi);
+  turns -= floorf(turns + 0.5f);
+  return (int16_t)PBSnapshotQuantize(turns, 1.0f / 65536.0f, INT16_MIN, INT16_MAX);
+}
+
+// BODY RECORDS
+
+static void PBSnapshotEncodeQuantizedBody(PBBody* body, uint8_t* record) {
+  PBSnapshotQuantizedBody q = {
+    .x = PBSnapshotQuantize(body->position.x, PB_SNAPSHOT_POSITION_STEP, INT32_MIN, INT32_MAX),
+    .y = PBSnapshotQuantize(body->position.y, PB_SNAPSHOT_POSITION_STEP, INT32_MIN, INT32_MAX),
+    .rotation = PBSnapshotQuantizeAngle(body->rotation),
+    .vx = PBSnapshotQuantize(body->velocity.x, PB_SNAPSHOT_VELOCITY_STEP, INT16_MIN, INT16_MAX),
+    .vy = PBSnapshotQuantize(body->velocity.y, PB_SNAPSHOT_VELOCITY_STEP, INT16_MIN, INT16_MAX),
+    .angularVelocity = PBSnapshotQuantize(body->angularVelocity, PB_SNAPSHOT_ANGULAR_VELOCITY_STEP, INT16_MIN, INT16_MAX),
+    .lodTime = body->lodTime
+  };
+  memcpy(record, &q, sizeof(q));
+}
+
+static void PBSnapshotEncodeBody(PBBody* body, uint8_t* record) {
+  PBSnapshotBody b = {
+    .position = body->position,
+    .rotation = body->rotation,
+    .velocity = body->velocity,
+    .angularVelocity = body->angularVelocity,
+    .force = body->force,
+    .torque = body->torque,
+    .lodTime = body->lodTime
+  };
+  memcpy(record, &b, sizeof(b));
+}
+
+static void PBSnapshotDecodeQuantizedBody(PBBody* body, const uint8_t* record) {
+  PBSnapshotQuantizedBody q;
+  memcpy(&q, record, sizeof(q));
+  body->position = PBVec2Make(q.x * PB_SNAPSHOT_POSITION_STEP, q.y * PB_SNAPSHOT_POSITION_STEP);
+  body->rotation = q.rotation * (2.0f * pb_pi / 65536.0f);
+  body->velocity = PBVec2Make(q.vx * PB_SNAPSHOT_VELOCITY_STEP, q.vy * PB_SNAPSHOT_VELOCITY_STEP);
+  body->angularVelocity = q.angularVelocity * PB_SNAPSHOT_ANGULAR_VELOCITY_STEP;
+  body->force = PBVec2MakeEmpty();
+  body->torque = 0.0f;
+  body->lodTime = q.lodTime;
+}
+
+static void PBSnapshotDecodeBody(PBBody* body, const uint8_t* record) {
+  PBSnapshotBody b;
+  memcpy(&b, record, sizeof(b));
+  body->position = b.position;
+  body->rotation = b.rotation;
+  body->velocity = b.velocity;
+  body->angularVelocity = b.angularVelocity;
+  body->force = b.force;
+  body->torque = b.torque;
+  body->lodTime = b.lodTime;
+}
+
+static void PBSnapshotEncodeJoint(PBJoint* joint, uint8_t* record) {
+  PBSnapshotJoint j = { .P = joint->P };
+  memcpy(record, &j, sizeof(j));
+}
+
+static void PBSnapshotDecodeJoint(PBJoint* joint, const uint8_t* record) {
+  PBSnapshotJoint j;
+  memcpy(&j, record, sizeof(j));
+  joint->P = j.P;
+}
+
+// SECTIONS
+
+typedef void (*PBSnapshotEncodeFunction)(void* object, uint8_t* record);
+typedef void (*PBSnapshotDecodeFunction)(void* object, const uint8_t* record);
+
+// Writes count fixed size records. With a base, only records that differ
+// from the base's are written, after a bitmask of which ones they are.
+static uint8_t* PBSnapshotWriteRecords(uint8_t* p, PBArray* objects, int recordSize, const uint8_t* baseRecords, PBSnapshotEncodeFunction encode) {
+  int count = objects->count;
+  void** items = (void**)objects->first;
+  
+  if(baseRecords == NULL) {
+    for(int i = 0; i < count; i++) {
+      encode(items[i], p);
+      p += recordSize;
+    }
+    return p;
+  }
+  
+  uint8_t* mask = p;
+  memset(mask, 0, PBSnapshotMaskSize(count));
+  p += PBSnapshotMaskSize(count);
+  for(int i = 0; i < count; i++) {
+    encode(items[i], p);
+    if(memcmp(p, baseRecords + i * recordSize, recordSize) != 0) {
+      uint32_t word;
+      memcpy(&word, mask + (i / 32) * sizeof(uint32_t), sizeof(word));
+      word |= 1u << (i % 32);
+      memcpy(mask + (i / 32) * sizeof(uint32_t), &word, sizeof(word));
+      p += recordSize;
+    }
+  }
+  return p;
+}
+
+static const uint8_t* PBSnapshotReadRecords(const uint8_t* p, PBArray* objects, int recordSize, const uint8_t* baseRecords, PBSnapshotDecodeFunction decode) {
+  int count = objects->count;
+  void** items = (void**)objects->first;
+  
+  if(baseRecords == NULL) {
+    for(int i = 0; i < count; i++) {
+      decode(items[i], p);
+      p += recordSize;
+    }
+    return p;
+  }
+  
+  const uint8_t* mask = p;
+  p += PBSnapshotMaskSize(count);
+  for(int i = 0; i < count; i++) {
+    uint32_t word;
+    memcpy(&word, mask + (i / 32) * sizeof(uint32_t), sizeof(word));
+    if(word & (1u << (i % 32))) {
+      decode(items[i], p);
+      p += recordSize;
+    }
+    else {
+      decode(items[i], baseRecords + i * recordSize);
+    }
+  }
+  return p;
+}
+
+// Returns the end of a section written by PBSnapshotWriteRecords, or NULL if
+// it runs past end.
+static const uint8_t* PBSnapshotSkipRecords(const uint8_t* p, const uint8_t* end, int count, int recordSize, int delta) {
+  if(!delta) {
+    return (end - p) / recordSize >= count ? p + count * recordSize : NULL;
+  }
+  
+  if(end - p < PBSnapshotMaskSize(count)) {
+    return NULL;
+  }
+  const uint8_t* mask = p;
+  p += PBSnapshotMaskSize(count);
+  for(int i = 0; i < count; i++) {
+    uint32_t word;
+    memcpy(&word, mask + (i / 32) * sizeof(uint32_t), sizeof(word));
+    if(word & (1u << (i % 32))) {
+      if(end - p < recordSize) {
+        return NULL;
+      }
+      p += recordSize;
+    }
+  }
+  return p;
+}
+
+// Checks that the arbiter section holds count well formed records for a
+// world with bodyCount bodies and ends at end.
+static int PBSnapshotCheckArbiters(const uint8_t* p, const uint8_t* end, int count, int bodyCount) {
+  for(int i = 0; i < count; i++) {
+    PBSnapshotArbiter record;
+    if(end - p < (int)sizeof(record)) {
+      return 0;
+    }
+    memcpy(&record, p, sizeof(record));
+    p += sizeof(record);
+    if(record.numContacts < 0 || record.numContacts > MAX_ARBITER_POINTS) {
+      return 0;
+    }
+    if(record.body1 < 0 || record.body1 >= bodyCount || record.body2 < 0 || record.body2 >= bodyCount) {
+      return 0;
+    }
+    if(end - p < (int)sizeof(PBContact) * record.numContacts) {
+      return 0;
+    }
+    p += sizeof(PBContact) * record.numContacts;
+  }
+  return p == end;
+}
+
+static const PBSnapshotHeader* PBSnapshotCheckBase(PBWorld* world, const void* base, int flags) {
+  const PBSnapshotHeader* header = (const PBSnapshotHeader*)base;
+  if(header == NULL || header->magic != PB_SNAPSHOT_MAGIC || header->version != PB_SNAPSHOT_VERSION) {
+    pb_log("playbox: PBWorldSnapshot: invalid base snapshot");
+    return NULL;
+  }
+  if((header->flags & PBSnapshotDelta) || (header->flags & PBSnapshotQuantized) != (flags & PBSnapshotQuantized)) {
+    pb_log("playbox: PBWorldSnapshot: base snapshot must be a full snapshot with the same encoding");
+    return NULL;
+  }
+  if(header->bodyCount != world->bodies->count || header->jointCount != world->joints->count ||
+     header->orderGeneration != world->orderGeneration) {
+    pb_log("playbox: PBWorldSnapshot: base snapshot has different bodies or joints");
+    return NULL;
+  }
+  return header;
+}
+
+// SNAPSHOT AND RESTORE
+
+// Upper bound on the bytes PBWorldSnapshot needs with these flags.
+int PBWorldSnapshotSize(PBWorld* world, int flags) {
+  int size = sizeof(PBSnapshotHeader);
+  size += world->bodies->count * PBSnapshotBodyRecordSize(flags);
+  size += world->joints->count * sizeof(PBSnapshotJoint);
+  size += world->arbiters->count * (sizeof(PBSnapshotArbiter) + sizeof(PBContact) * MAX_ARBITER_POINTS);
+  if(flags & PBSnapshotDelta) {
+    size += PBSnapshotMaskSize(world->bodies->count) + PBSnapshotMaskSize(world->joints->count);
+  }
+  return size;
+}
+
+// Writes the dynamic state of the world: body poses and velocities, joint
+// impulses and arbiters with their contact impulses. Delta snapshots need a
+// full base snapshot of the same world and encoding. Returns the number of
+// bytes written, or 0 if the buffer is too small or the world is mid-step.
+int PBWorldSnapshot(PBWorld* world, void* buffer, int capacity, int flags, const void* base) {
+  if(world->stepState.stage != PBWorldStepStageIdle) {
+    pb_log("playbox: PBWorldSnapshot: cannot snapshot during a step");
+    return 0;
+  }
+  if(capacity < PBWorldSnapshotSize(world, flags)) {
+    pb_log("playbox: PBWorldSnapshot: buffer too small");
+    return 0;
+  }
+  
+  const uint8_t* baseBodies = NULL;
+  const uint8_t* baseJoints = NULL;
+  if(flags & PBSnapshotDelta) {
+    const PBSnapshotHeader* baseHeader = PBSnapshotCheckBase(world, base, flags);
+    if(baseHeader == NULL) {
+      return 0;
+    }
+    baseBodies = (const uint8_t*)(baseHeader + 1);
+    baseJoints = baseBodies + baseHeader->bodyCount * PBSnapshotBodyRecordSize(flags);
+  }
+  
+  PBSnapshotHeader header = {
+    .magic = PB_SNAPSHOT_MAGIC,
+    .version = PB_SNAPSHOT_VERSION,
+    .flags = flags,
+    .bodyCount = world->bodies->count,
+    .jointCount = world->joints->count,
+    .arbiterCount = world->arbiters->count,
+    .orderGeneration = world->orderGeneration,
+    .reorderStep = world->reorderStep,
+    .lodStep = world->lodStep
+  };
+  
+  uint8_t* p = (uint8_t*)buffer + sizeof(PBSnapshotHeader);
+  PBSnapshotEncodeFunction encodeBody = (flags & PBSnapshotQuantized) ? (PBSnapshotEncodeFunction)PBSnapshotEncodeQuantizedBody : (PBSnapshotEncodeFunction)PBSnapshotEncodeBody;
+  p = PBSnapshotWriteRecords(p, world->bodies, PBSnapshotBodyRecordSize(flags), baseBodies, encodeBody);
+  p = PBSnapshotWriteRecords(p, world->joints, sizeof(PBSnapshotJoint), baseJoints, (PBSnapshotEncodeFunction)PBSnapshotEncodeJoint);
+  
+  // Arbiters refer to their bodies by index.
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBWorldGetBody(world, i)->solverIndex = i;
+  }
+  for(int i = 0; i < world->arbiters->count; i++) {
+    PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+    PBSnapshotArbiter record = {
+      .body1 = arbiter->body1->solverIndex,
+      .body2 = arbiter->body2->solverIndex,
+      .numContacts = arbiter->numContacts,
+      .manifoldRelativePosition = arbiter->manifoldRelativePosition,
+      .manifoldRelativeRotation = arbiter->manifoldRelativeRotation,
+      .contactsRelativePosition = arbiter->contactsRelativePosition,
+      .contactsPosition = arbiter->contactsPosition,
+      .contactsRotation = arbiter->contactsRotation
+    };
+    memcpy(p, &record, sizeof(record));
+    p += sizeof(record);
+    memcpy(p, arbiter->contacts, sizeof(PBContact) * arbiter->numContacts);
+    p += sizeof(PBContact) * arbiter->numContacts;
+  }
+  
+  header.size = (uint32_t)(p - (uint8_t*)buffer);
+  memcpy(buffer, &header, sizeof(header));
+  return header.size;
+}
+
+static void PBSnapshotRestoreArbiter(PBArbiter* arbiter, const PBSnapshotArbiter* record, const uint8_t* contacts) {
+  arbiter->numContacts = record->numContacts;
+  memcpy(arbiter->contacts, contacts, sizeof(PBContact) * record->numContacts);
+  arbiter->manifoldRelativePosition = record->manifoldRelativePosition;
+  arbiter->manifoldRelativeRotation = record->manifoldRelativeRotation;
+  arbiter->contactsRelativePosition = record->contactsRelativePosition;
+  arbiter->contactsPosition = record->contactsPosition;
+  arbiter->contactsRotation = record->contactsRotation;
+}
+
+// Puts the world back into the state of a snapshot taken from it. The world
+// must not have added, removed or reordered bodies or joints since. Delta snapshots
+// need the base they were written against. Returns 1 on success.
+int PBWorldRestore(PBWorld* world, const void* buffer, int size, const void* base) {
+  PBSnapshotHeader header;
+  if(size < (int)sizeof(header)) {
+    pb_log("playbox: PBWorldRestore: invalid snapshot");
+    return 0;
+  }
+  memcpy(&header, buffer, sizeof(header));
+  if(header.magic != PB_SNAPSHOT_MAGIC || header.version != PB_SNAPSHOT_VERSION || header.size < sizeof(header) || header.size > (uint32_t)size) {
+    pb_log("playbox: PBWorldRestore: invalid snapshot");
+    return 0;
+  }
+  if(header.bodyCount != world->bodies->count || header.jointCount != world->joints->count ||
+     header.orderGeneration != world->orderGeneration) {
+    pb_log("playbox: PBWorldRestore: snapshot has different bodies or joints");
+    return 0;
+  }
+  if(world->stepState.stage != PBWorldStepStageIdle) {
+    pb_log("playbox: PBWorldRestore: cannot restore during a step");
+    return 0;
+  }
+  
+  int flags = header.flags;
+  const uint8_t* baseBodies = NULL;
+  const uint8_t* baseJoints = NULL;
+  if(flags & PBSnapshotDelta) {
+    const PBSnapshotHeader* baseHeader = PBSnapshotCheckBase(world, base, flags);
+    if(baseHeader == NULL) {
+      return 0;
+    }
+    baseBodies = (const uint8_t*)(baseHeader + 1);
+    baseJoints = baseBodies + baseHeader->bodyCount * PBSnapshotBodyRecordSize(flags);
+  }
+  
+  // Check the whole buffer before touching the world so a truncated or
+  // corrupt snapshot leaves it as it was.
+  const uint8_t* p = (const uint8_t*)buffer + sizeof(PBSnapshotHeader);
+  const uint8_t* end = (const uint8_t*)buffer + header.size;
+  int delta = (flags & PBSnapshotDelta) != 0;
+  const uint8_t* arbiters = PBSnapshotSkipRecords(p, end, header.bodyCount, PBSnapshotBodyRecordSize(flags), delta);
+  if(arbiters != NULL) {
+    arbiters = PBSnapshotSkipRecords(arbiters, end, header.jointCount, sizeof(PBSnapshotJoint), delta);
+  }
+  if(arbiters == NULL || header.arbiterCount < 0 || !PBSnapshotCheckArbiters(arbiters, end, header.arbiterCount, header.bodyCount)) {
+    pb_log("playbox: PBWorldRestore: invalid snapshot");
+    return 0;
+  }
+  
+  PBSnapshotDecodeFunction decodeBody = (flags & PBSnapshotQuantized) ? (PBSnapshotDecodeFunction)PBSnapshotDecodeQuantizedBody : (PBSnapshotDecodeFunction)PBSnapshotDecodeBody;
+  p = PBSnapshotReadRecords(p, world->bodies, PBSnapshotBodyRecordSize(flags), baseBodies, decodeBody);
+  p = PBSnapshotReadRecords(p, world->joints, sizeof(PBSnapshotJoint), baseJoints, (PBSnapshotDecodeFunction)PBSnapshotDecodeJoint);
+  
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBWorldUpdateBody(world, PBWorldGetBody(world, i));
+  }
+  world->reorderStep = header.reorderStep;
+  world->lodStep = header.lodStep;
+  
+  // Arbiters that still match the snapshot are rewritten in place. From the
+  // first mismatch on, the rest are destroyed and created again.
+  int i = 0;
+  for(; i < header.arbiterCount; i++) {
+    PBSnapshotArbiter record;
+    memcpy(&record, p, sizeof(record));
+    const uint8_t* contacts = p + sizeof(record);
+    PBBody* body1 = PBWorldGetBody(world, record.body1);
+    PBBody* body2 = PBWorldGetBody(world, record.body2);
+    
+    PBArbiter* arbiter = i < world->arbiters->count ? PBWorldGetArbiter(world, i) : NULL;
+    if(arbiter == NULL || arbiter->body1 != body1 || arbiter->body2 != body2) {
+      while(world->arbiters->count > i) {
+        PBWorldDestroyArbiter(world, PBWorldGetArbiter(world, world->arbiters->count - 1));
+      }
+      PBContact newContacts[MAX_ARBITER_POINTS];
+      memcpy(newContacts, contacts, sizeof(PBContact) * record.numContacts);
+      arbiter = PBArbiterCreateWithContacts(body1, body2, newContacts, record.numContacts);
+      PBWorldAddArbiter(world, arbiter);
+    }
+    PBSnapshotRestoreArbiter(arbiter, &record, contacts);
+    p += sizeof(record) + sizeof(PBContact) * record.numContacts;
+  }
+  
+  while(world->arbiters->count > i) {
+    PBWorldDestroyArbiter(world, PBWorldGetArbiter(world, world->arbiters->count - 1));
+  }
+  
+  return 1;
+}
@@ -0,0 +1,48 @@
+#ifndef PLAYBOX_SNAPSHOT_H
+#define PLAYBOX_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "world.h"
+
+#define PB_SNAPSHOT_MAGIC 0x53534250  // "PBSS"
+#define PB_SNAPSHOT_VERSION 3
+
+// Quantization steps for PBSnapshotQuantized
+#ifndef PB_SNAPSHOT_POSITION_STEP
+#define PB_SNAPSHOT_POSITION_STEP (1.0f / 4096.0f)
+#endif
+#ifndef PB_SNAPSHOT_VELOCITY_STEP
+#define PB_SNAPSHOT_VELOCITY_STEP (1.0f / 128.0f)
+#endif
+#ifndef PB_SNAPSHOT_ANGULAR_VELOCITY_STEP
+#define PB_SNAPSHOT_ANGULAR_VELOCITY_STEP (1.0f / 512.0f)
+#endif
+
+typedef enum {
+  // Store body state as fixed point. Smaller but lossy, and drops applied forces.
+  PBSnapshotQuantized = 1 << 0,
+  // Only store body and joint records that differ from a base snapshot.
+  PBSnapshotDelta = 1 << 1
+} PBSnapshotFlags;
+
+// Snapshots are raw memory for the build that wrote them, meant for
+// rollback and look-ahead rather than saving to disk.
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint32_t size;  // bytes, including this header
+  int32_t bodyCount;
+  int32_t jointCount;
+  int32_t arbiterCount;
+  uint32_t orderGeneration;  // the world's, records only fit a world with the same order
+  int32_t reorderStep;
+  int32_t lodStep;
+} PBSnapshotHeader;
+
+extern int PBWorldSnapshotSize(PBWorld* world, int flags);
+extern int PBWorldSnapshot(PBWorld* world, void* buffer, int capacity, int flags, const void* base);
+extern int PBWorldRestore(PBWorld* world, const void* buffer, int size, const void* base);
+
+#endif
@@ -0,0 +1,222 @@
+#include "platform.h"
+#include "solver.h"
+
+static void PBSolverBodyApplyImpulse(PBSolverBody* b1, PBSolverBody* b2, PBContactConstraintPoint* cp, PBVec2 P) {
+  b1->velocity = PBVec2Sub(b1->velocity, PBVec2MultF(P, b1->invMass));
+  b1->angularVelocity -= b1->invI * PBVec2Cross(cp->r1, P);
+
+  b2->velocity = PBVec2Add(b2->velocity, PBVec2MultF(P, b2->invMass));
+  b2->angularVelocity += b2->invI * PBVec2Cross(cp->r2, P);
+}
+
+static PBVec2 PBSolverBodyGetRelativeVelocity(PBSolverBody* b1, PBSolverBody* b2, PBContactConstraintPoint* cp) {
+  return PBVec2Sub(PBVec2Sub(PBVec2Add(b2->velocity, PBVec2FCross(b2->angularVelocity, cp->r2)), b1->velocity), PBVec2FCross(b1->angularVelocity, cp->r1));
+}
+
+void PBContactConstraintWarmStart(PBContactConstraint* constraint, PBSolverBody* bodies) {
+  PBSolverBody* b1 = bodies + constraint->solverIndex1;
+  PBSolverBody* b2 = bodies + constraint->solverIndex2;
+
+  for(int i = 0; i < constraint->numPoints; i++) {
+    PBContactConstraintPoint* cp = constraint->points + i;
+
+    // Apply normal + friction impulse
+    PBVec2 P = PBVec2Add(PBVec2MultF(constraint->normal, cp->Pn), PBVec2MultF(constraint->tangent, cp->Pt));
+    PBSolverBodyApplyImpulse(b1, b2, cp, P);
+  }
+}
+
+// The solve functions take the accumulate flag as a constant so each variant
+// generated below compiles without the branches it doesn't take.
+PB_FORCE_INLINE float PBContactConstraintSolve(PBContactConstraint* constraint, PBSolverBody* bodies, const int accumulateImpulses) {
+  PBSolverBody* b1 = bodies + constraint->solverIndex1;
+  PBSolverBody* b2 = bodies + constraint->solverIndex2;
+  PBVec2 normal = constraint->normal;
+  PBVec2 tangent = constraint->tangent;
+  float maxImpulse = 0.0f;
+
+  for(int i = 0; i < constraint->numPoints; ++i) {
+    PBContactConstraintPoint* cp = constraint->points + i;
+
+    // Relative velocity at contact
+    PBVec2 dv = PBSolverBodyGetRelativeVelocity(b1, b2, cp);
+
+    // Compute normal impulse
+    float vn = PBVec2Dot(dv, normal);
+
+    float dPn = cp->massNormal * (-vn + cp->bias);
+
+    if(accumulateImpulses) {
+      // Clamp the accumulated impulse
+      float Pn0 = cp->Pn;
+      cp->Pn = PBMax(Pn0 + dPn, 0.0f);
+      dPn = cp->Pn - Pn0;
+    }
+    else {
+      dPn = PBMax(dPn, 0.0f);
+    }
+
+    // Apply contact impulse
+    PBSolverBodyApplyImpulse(b1, b2, cp, PBVec2MultF(normal, dPn));
+
+    // Relative velocity at contact
+    dv = PBSolverBodyGetRelativeVelocity(b1, b2, cp);
+
+    float vt = PBVec2Dot(dv, tangent);
+    float dPt = cp->massTangent * (-vt);
+
+    if(accumulateImpulses) {
+      // Compute friction impulse
+      float maxPt = constraint->friction * cp->Pn;
+
+      // Clamp friction
+      float oldTangentImpulse = cp->Pt;
+      cp->Pt = PBClamp(oldTangentImpulse + dPt, -maxPt, maxPt);
+      dPt = cp->Pt - oldTangentImpulse;
+    }
+    else
+    {
+      float maxPt = constraint->friction * dPn;
+      dPt = PBClamp(dPt, -maxPt, maxPt);
+    }
+
+    // Apply contact impulse
+    PBSolverBodyApplyImpulse(b1, b2, cp, PBVec2MultF(tangent, dPt));
+
+    maxImpulse = PBMax(maxImpulse, PBMax(PBAbs(dPn), PBAbs(dPt)));
+  }
+
+  return maxImpulse;
+}
+
+// Solves friction per contact, then both normal impulses of a two-point
+// manifold together as a 2x2 LCP by testing each of its four possible
+// solutions. Converges stacks in fewer iterations than PBContactConstraintSolve.
+// Needs accumulated impulses.
+static float PBContactConstraintSolveBlock(PBContactConstraint* constraint, PBSolverBody* bodies) {
+  if(!constraint->blockSolve) {
+    return PBContactConstraintSolve(constraint, bodies, 1);
+  }
+
+  PBSolverBody* b1 = bodies + constraint->solverIndex1;
+  PBSolverBody* b2 = bodies + constraint->solverIndex2;
+  PBContactConstraintPoint* cp1 = constraint->points;
+  PBContactConstraintPoint* cp2 = constraint->points + 1;
+  PBVec2 n = constraint->normal;
+  PBVec2 tangent = constraint->tangent;
+  float maxImpulse = 0.0f;
+
+  // Friction first so the normal impulses are the last word on penetration.
+  for(int i = 0; i < 2; i++) {
+    PBContactConstraintPoint* cp = constraint->points + i;
+
+    float vt = PBVec2Dot(PBSolverBodyGetRelativeVelocity(b1, b2, cp), tangent);
+    float dPt = cp->massTangent * (-vt);
+
+    float maxPt = constraint->friction * cp->Pn;
+    float oldTangentImpulse = cp->Pt;
+    cp->Pt = PBClamp(oldTangentImpulse + dPt, -maxPt, maxPt);
+    dPt = cp->Pt - oldTangentImpulse;
+
+    PBSolverBodyApplyImpulse(b1, b2, cp, PBVec2MultF(tangent, dPt));
+    maxImpulse = PBMax(maxImpulse, PBAbs(dPt));
+  }
+
+  PBVec2 a = PBVec2Make(cp1->Pn, cp2->Pn);
+
+  float vn1 = PBVec2Dot(PBSolverBodyGetRelativeVelocity(b1, b2, cp1), n);
+  float vn2 = PBVec2Dot(PBSolverBodyGetRelativeVelocity(b1, b2, cp2), n);
+
+  // b = vn - bias - K * a, so the new total impulse x satisfies K * x + b = vn_new - bias.
+  PBVec2 b = PBVec2Sub(PBVec2Make(vn1 - cp1->bias, vn2 - cp2->bias), PBMat22MultVec(constraint->K, a));
+  PBVec2 x;
+
+  for(;;) {
+    // Both contacts active: vn_new = bias for both.
+    x = PBVec2Invert(PBMat22MultVec(constraint->normalMass, b));
+    if(x.x >= 0.0f && x.y >= 0.0f) {
+      break;
+    }
+
+    // Only the first contact active.
+    x = PBVec2Make(-cp1->massNormal * b.x, 0.0f);
+    vn2 = constraint->K.col1.y * x.x + b.y;
+    if(x.x >= 0.0f && vn2 >= 0.0f) {
+      break;
+    }
+
+    // Only the second contact active.
+    x = PBVec2Make(0.0f, -cp2->massNormal * b.y);
+    vn1 = constraint->K.col2.x * x.y + b.x;
+    if(x.y >= 0.0f && vn1 >= 0.0f) {
+      break;
+    }
+
+    // Neither active, if both are separating.
+    x = PBVec2MakeEmpty();
+    if(b.x >= 0.0f && b.y >= 0.0f) {
+      break;
+    }
+
+    // No solution. Keep the old impulses.
+    x = a;
+    break;
+  }
+
+  PBVec2 d = PBVec2Sub(x, a);
+  PBSolverBodyApplyImpulse(b1, b2, cp1, PBVec2MultF(n, d.x));
+  PBSolverBodyApplyImpulse(b1, b2, cp2, PBVec2MultF(n, d.y));
+  cp1->Pn = x.x;
+  cp2->Pn = x.y;
+
+  return PBMax(maxImpulse, PBMax(PBAbs(d.x), PBAbs(d.y)));
+}
+
+static float PBContactConstraintSolveIncremental(PBContactConstraint* constraint, PBSolverBody* bodies) {
+  return PBContactConstraintSolve(constraint, bodies, 0);
+}
+
+static float PBContactConstraintSolveAccumulated(PBContactConstraint* constraint, PBSolverBody* bodies) {
+  return PBContactConstraintSolve(constraint, bodies, 1);
+}
+
+// Picks the specialized solve function for a set of PBSolverFlags once per
+// step, so the iterations don't test the flags for every contact. The block
+// solver relies on accumulated impulses and is skipped without them.
+PBContactSolveFunction PBContactConstraintGetSolveFunction(int flags, int blockSolve) {
+  if(!(flags & PBSolverAccumulateImpulses)) {
+    return PBContactConstraintSolveIncremental;
+  }
+  return blockSolve ? PBContactConstraintSolveBlock : PBContactConstraintSolveAccumulated;
+}
+
+// Pushes penetrating contacts apart through bias velocities only. Pnb
+// accumulates the impulse so it can be clamped like Pn.
+void PBContactConstraintApplyPositionImpulse(PBContactConstraint* constraint, PBSolverBody* bodies) {
+  PBSolverBody* b1 = bodies + constraint->solverIndex1;
+  PBSolverBody* b2 = bodies + constraint->solverIndex2;
+
+  for(int i = 0; i < constraint->numPoints; i++) {
+    PBContactConstraintPoint* cp = constraint->points + i;
+    if(cp->positionBias <= 0.0f && cp->Pnb <= 0.0f) {
+      continue;
+    }
+
+    // Relative bias velocity at contact
+    PBVec2 dv = PBVec2Sub(PBVec2Sub(PBVec2Add(b2->biasVelocity, PBVec2FCross(b2->biasAngularVelocity, cp->r2)), b1->biasVelocity), PBVec2FCross(b1->biasAngularVelocity, cp->r1));
+    float vnb = PBVec2Dot(dv, constraint->normal);
+
+    float dPnb = cp->massNormal * (-vnb + cp->positionBias);
+    float Pnb0 = cp->Pnb;
+    cp->Pnb = PBMax(Pnb0 + dPnb, 0.0f);
+    dPnb = cp->Pnb - Pnb0;
+
+    PBVec2 Pb = PBVec2MultF(constraint->normal, dPnb);
+
+    b1->biasVelocity = PBVec2Sub(b1->biasVelocity, PBVec2MultF(Pb, b1->invMass));
+    b1->biasAngularVelocity -= b1->invI * PBVec2Cross(cp->r1, Pb);
+
+    b2->biasVelocity = PBVec2Add(b2->biasVelocity, PBVec2MultF(Pb, b2->invMass));
+    b2->biasAngularVelocity += b2->invI * PBVec2Cross(cp->r2, Pb);
+  }
+}
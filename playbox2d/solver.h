@@ -0,0 +1,73 @@
+#ifndef PLAYBOX_SOLVER_H
+#define PLAYBOX_SOLVER_H
+
+#include "maths.h"
+
+#ifndef MAX_ARBITER_POINTS
+#define MAX_ARBITER_POINTS 2
+#endif
+
+// Solver behaviour a world can change at runtime, see PBWorldSetSolverFlags.
+typedef enum {
+  PBSolverPositionCorrection = 1 << 0,  // Baumgarte or split impulse bias
+  PBSolverWarmStarting = 1 << 1,  // carry impulses over from the last step
+  PBSolverAccumulateImpulses = 1 << 2,  // clamp the accumulated rather than the incremental impulse
+} PBSolverFlags;
+
+#define PB_SOLVER_DEFAULT_FLAGS (PBSolverPositionCorrection | PBSolverAccumulateImpulses)
+
+// Per-step copy of the body state the constraint iterations touch, packed
+// into one array so the inner loops don't chase body pointers.
+typedef struct {
+  PBVec2 velocity;
+  float angularVelocity;
+  float invMass;
+  float invI;
+  
+  // Split impulse position correction
+  PBVec2 biasVelocity;
+  float biasAngularVelocity;
+} PBSolverBody;
+
+typedef struct {
+  PBVec2 r1, r2;  // contact point relative to each body's center
+  float massNormal, massTangent;
+  float bias;  // velocity bias, zero when splitting impulses
+  float positionBias;  // target for the split impulse bias velocity
+  float Pn;  // accumulated normal impulse
+  float Pt;  // accumulated tangent impulse
+  float Pnb;  // accumulated normal impulse for position bias
+} PBContactConstraintPoint;
+
+// Everything the iterations read for one arbiter, built by PBArbiterPreStep
+// into a per-step array that parallels the world's arbiters.
+typedef struct {
+  PBVec2 normal;
+  PBVec2 tangent;
+  int solverIndex1, solverIndex2;
+  int island;  // only assigned when the solver stops early
+  float friction;
+  int numPoints;
+  PBContactConstraintPoint points[MAX_ARBITER_POINTS];
+  
+  // Two-point normal block, valid when blockSolve is set
+  PBMat22 K;
+  PBMat22 normalMass;
+  int blockSolve;
+} PBContactConstraint;
+
+// Convergence state of one group of connected bodies
+typedef struct {
+  float maxImpulse;  // largest impulse change in the current pass
+  int solving;
+} PBSolverIsland;
+
+// Applies one iteration of a contact constraint. Returns the largest
+// impulse change, for convergence checks.
+typedef float (*PBContactSolveFunction)(PBContactConstraint* constraint, PBSolverBody* bodies);
+
+extern void PBContactConstraintWarmStart(PBContactConstraint* constraint, PBSolverBody* bodies);
+extern PBContactSolveFunction PBContactConstraintGetSolveFunction(int flags, int blockSolve);
+extern void PBContactConstraintApplyPositionImpulse(PBContactConstraint* constraint, PBSolverBody* bodies);
+
+#endif
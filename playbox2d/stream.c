@@ -0,0 +1,548 @@
+#include "platform.h"
+#include "stream.h"
+
+PBBody* PBWorldGetBody(PBWorld* world, int i);
+PBJoint* PBWorldGetJoint(PBWorld* world, int i);
+PBArbiter* PBWorldFindArbiter(PBWorld* world, PBBody* body1, PBBody* body2);
+void PBWorldAddArbiter(PBWorld* world, PBArbiter* arbiter);
+
+#define PB_STREAM_NO_BODY INT32_MIN
+
+static PBBody* PBStreamGetBody(PBStream* stream, int i) {
+  return (PBBody*)(*((size_t*)PBArrayGetItem(stream->bodies, i)));
+}
+
+static PBStreamStatic* PBStreamGetStatic(PBStream* stream, int i) {
+  return (PBStreamStatic*)PBArrayGetItem(stream->statics, i);
+}
+
+// Chunk arrays are created on first use since most chunks never need all of them.
+static PBArray* PBStreamChunkArray(PBArray** array, size_t itemSize) {
+  if(*array == NULL) {
+    *array = PBArrayCreate(itemSize);
+  }
+  return *array;
+}
+
+static int PBStreamGetCell(float v, float origin, float cellSize, int count) {
+  int cell = (int)floorf((v - origin) / cellSize);
+  return cell < 0 ? 0 : (cell >= count ? count - 1 : cell);
+}
+
+static int PBStreamGetChunkIndex(PBStream* stream, PBVec2 p) {
+  int x = PBStreamGetCell(p.x, stream->origin.x, stream->cellSize, stream->columns);
+  int y = PBStreamGetCell(p.y, stream->origin.y, stream->cellSize, stream->rows);
+  return y * stream->columns + x;
+}
+
+static PBBody* PBStreamCreateBody(PBStream* stream, const PBSceneBody* record) {
+  PBBody* body = PBBodyCreate();
+  PBSceneInitBody(body, record);
+  body->stream = stream;
+  PBWorldAddBody(stream->world, body);
+  return body;
+}
+
+static void PBStreamRetainStatic(PBStream* stream, int i) {
+  PBStreamStatic* s = PBStreamGetStatic(stream, i);
+  if(s->activeChunks++ == 0) {
+    s->body = PBStreamCreateBody(stream, &s->record);
+  }
+}
+
+static void PBStreamReleaseStatic(PBStream* stream, int i) {
+  PBStreamStatic* s = PBStreamGetStatic(stream, i);
+  if(--s->activeChunks == 0) {
+    PBWorldRemoveBody(stream->world, s->body);
+    PBBodyFree(s->body);
+    s->body = NULL;
+  }
+}
+
+// CREATION
+
+PBStream* PBStreamCreate(PBWorld* world, float cellSize, int radius) {
+  PBStream* stream = pb_alloc(sizeof(PBStream));
+  memset(stream, 0, sizeof(PBStream));
+  
+  stream->world = world;
+  stream->cellSize = cellSize > 0.0f ? cellSize : 1.0f;
+  stream->radius = radius;
+  stream->statics = PBArrayCreate(sizeof(PBStreamStatic));
+  stream->bodies = PBArrayCreate(sizeof(size_t));
+  stream->marks = PBArrayCreate(sizeof(PBStreamMark));
+  stream->objects = PBArrayCreate(sizeof(size_t));
+  
+  return stream;
+}
+
+static void PBStreamFreeChunks(PBStream* stream) {
+  for(int i = 0; i < stream->columns * stream->rows; i++) {
+    PBStreamChunk* chunk = stream->chunks + i;
+    if(chunk->bodies != NULL) {
+      PBArrayFree(chunk->bodies);
+    }
+    if(chunk->joints != NULL) {
+      PBArrayFree(chunk->joints);
+    }
+    if(chunk->arbiters != NULL) {
+      PBArrayFree(chunk->arbiters);
+    }
+    if(chunk->statics != NULL) {
+      PBArrayFree(chunk->statics);
+    }
+  }
+  if(stream->chunks != NULL) {
+    pb_free(stream->chunks);
+  }
+  stream->chunks = NULL;
+}
+
+// Removes everything the stream created from the world.
+void PBStreamFree(PBStream* stream) {
+  PBWorld* world = stream->world;
+  
+  // Joints between stream bodies belong to the stream.
+  for(int i = world->joints->count - 1; i >= 0; i--) {
+    PBJoint* joint = PBWorldGetJoint(world, i);
+    if(joint->body1->stream == stream && joint->body2->stream == stream) {
+      PBWorldRemoveJoint(world, joint);
+      PBJointFree(joint);
+    }
+  }
+  
+  for(int i = 0; i < stream->bodies->count; i++) {
+    PBBody* body = PBStreamGetBody(stream, i);
+    PBWorldRemoveBody(world, body);
+    PBBodyFree(body);
+  }
+  for(int i = 0; i < stream->statics->count; i++) {
+    PBStreamStatic* s = PBStreamGetStatic(stream, i);
+    if(s->body != NULL) {
+      PBWorldRemoveBody(world, s->body);
+      PBBodyFree(s->body);
+    }
+  }
+  
+  PBStreamFreeChunks(stream);
+  PBArrayFree(stream->statics);
+  PBArrayFree(stream->bodies);
+  PBArrayFree(stream->marks);
+  PBArrayFree(stream->objects);
+  pb_free(stream);
+}
+
+// LOADING
+
+static int PBStreamFindGroup(int* parents, int i) {
+  while(parents[i] != i) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+  }
+  return i;
+}
+
+static PBVec2 PBStreamGetLocalAnchor(const PBSceneBody* record, PBVec2 anchor) {
+  PBMat22 RotT = PBMat22Transpose(PBMat22MakeWithAngle(record->rotation));
+  return PBMat22MultVec(RotT, PBVec2Sub(anchor, record->position));
+}
+
+// Sets the grid to cover the scene and stores all of its bodies in their
+// chunks. Jointed bodies go in the chunk of the first of them. Nothing is
+// created in the world until PBStreamSetFocus. Returns 0 if the scene is invalid.
+int PBStreamLoadScene(PBStream* stream, const void* data, int size) {
+  const PBSceneHeader* header = PBSceneGetHeader(data, size);
+  if(header == NULL) {
+    return 0;
+  }
+  if(stream->chunks != NULL) {
+    pb_log("playbox: PBStream: a scene is already loaded");
+    return 0;
+  }
+  
+  const PBSceneBody* bodyRecords = (const PBSceneBody*)(header + 1);
+  const PBSceneJoint* jointRecords = (const PBSceneJoint*)(bodyRecords + header->bodyCount);
+  int bodyCount = header->bodyCount;
+  
+  PBSceneApplySettings(stream->world, header);
+  
+  // Bound the level. Static bodies can span chunks, dynamic ones are placed by center.
+  PBBody body;
+  PBAABB* bounds = pb_alloc(sizeof(PBAABB) * (bodyCount > 0 ? bodyCount : 1));
+  PBVec2 lower = PBVec2MakeEmpty(), upper = PBVec2MakeEmpty();
+  for(int i = 0; i < bodyCount; i++) {
+    if(!PBSceneInitBody(&body, bodyRecords + i)) {
+      pb_log("playbox: PBStream: invalid body %i", i);
+      pb_free(bounds);
+      return 0;
+    }
+    bounds[i] = body.invMass == 0.0f ? PBBodyGetAABB(&body) : (PBAABB){ .lower = body.position, .upper = body.position };
+    lower = i == 0 ? bounds[i].lower : PBVec2Make(fminf(lower.x, bounds[i].lower.x), fminf(lower.y, bounds[i].lower.y));
+    upper = i == 0 ? bounds[i].upper : PBVec2Make(fmaxf(upper.x, bounds[i].upper.x), fmaxf(upper.y, bounds[i].upper.y));
+  }
+  
+  stream->origin = lower;
+  stream->columns = (int)ceilf((upper.x - lower.x) / stream->cellSize);
+  stream->rows = (int)ceilf((upper.y - lower.y) / stream->cellSize);
+  stream->columns = stream->columns > 0 ? stream->columns : 1;
+  stream->rows = stream->rows > 0 ? stream->rows : 1;
+  stream->chunks = pb_alloc(sizeof(PBStreamChunk) * stream->columns * stream->rows);
+  memset(stream->chunks, 0, sizeof(PBStreamChunk) * stream->columns * stream->rows);
+  
+  // Group jointed dynamic bodies so each group lands in one chunk.
+  int* parents = pb_alloc(sizeof(int) * (bodyCount > 0 ? bodyCount : 1) * 2);
+  int* refs = parents + bodyCount;
+  for(int i = 0; i < bodyCount; i++) {
+    parents[i] = i;
+  }
+  for(int i = 0; i < header->jointCount; i++) {
+    int a = jointRecords[i].body1, b = jointRecords[i].body2;
+    if(a < 0 || a >= bodyCount || b < 0 || b >= bodyCount) {
+      pb_log("playbox: PBStream: joint %i has an invalid body", i);
+      continue;
+    }
+    if(bodyRecords[a].mass > 0.0f && bodyRecords[b].mass > 0.0f) {
+      int ra = PBStreamFindGroup(parents, a), rb = PBStreamFindGroup(parents, b);
+      parents[ra > rb ? ra : rb] = ra < rb ? ra : rb;
+    }
+  }
+  
+  for(int i = 0; i < bodyCount; i++) {
+    const PBSceneBody* record = bodyRecords + i;
+    
+    if(record->mass <= 0.0f) {
+      PBStreamStatic s = { .record = *record };
+      int index = stream->statics->count;
+      PBArrayAppendItem(stream->statics, &s);
+      refs[i] = -1 - index;
+      
+      int x0 = PBStreamGetCell(bounds[i].lower.x, lower.x, stream->cellSize, stream->columns);
+      int x1 = PBStreamGetCell(bounds[i].upper.x, lower.x, stream->cellSize, stream->columns);
+      int y0 = PBStreamGetCell(bounds[i].lower.y, lower.y, stream->cellSize, stream->rows);
+      int y1 = PBStreamGetCell(bounds[i].upper.y, lower.y, stream->cellSize, stream->rows);
+      for(int y = y0; y <= y1; y++) {
+        for(int x = x0; x <= x1; x++) {
+          PBArrayAppendItem(PBStreamChunkArray(&stream->chunks[y * stream->columns + x].statics, sizeof(int)), &index);
+        }
+      }
+    }
+    else {
+      PBStreamChunk* chunk = stream->chunks + PBStreamGetChunkIndex(stream, bodyRecords[PBStreamFindGroup(parents, i)].position);
+      PBArray* bodies = PBStreamChunkArray(&chunk->bodies, sizeof(PBSceneBody));
+      refs[i] = bodies->count;
+      PBArrayAppendItem(bodies, (void*)record);
+      stream->storedBodies++;
+    }
+  }
+  
+  for(int i = 0; i < header->jointCount; i++) {
+    const PBSceneJoint* record = jointRecords + i;
+    int a = record->body1, b = record->body2;
+    if(a < 0 || a >= bodyCount || b < 0 || b >= bodyCount) {
+      continue;
+    }
+    if(refs[a] < 0 && refs[b] < 0) {
+      pb_log("playbox: PBStream: joint %i connects two static bodies", i);
+      continue;
+    }
+    
+    // Statics with joints stay loaded so the joint always has both bodies.
+    for(int k = 0; k < 2; k++) {
+      int ref = refs[k == 0 ? a : b];
+      if(ref < 0 && PBStreamGetStatic(stream, -1 - ref)->activeChunks == 0) {
+        PBStreamRetainStatic(stream, -1 - ref);
+      }
+    }
+    
+    int dynamic = refs[a] >= 0 ? a : b;
+    PBStreamChunk* chunk = stream->chunks + PBStreamGetChunkIndex(stream, bodyRecords[PBStreamFindGroup(parents, dynamic)].position);
+    PBStreamJoint joint = {
+      .body1 = refs[a],
+      .body2 = refs[b],
+      .localAnchor1 = PBStreamGetLocalAnchor(bodyRecords + a, record->anchor),
+      .localAnchor2 = PBStreamGetLocalAnchor(bodyRecords + b, record->anchor),
+      .softness = record->softness,
+      .biasFactor = record->biasFactor
+    };
+    PBArrayAppendItem(PBStreamChunkArray(&chunk->joints, sizeof(PBStreamJoint)), &joint);
+  }
+  
+  pb_free(parents);
+  pb_free(bounds);
+  return 1;
+}
+
+// ACTIVATION
+
+static PBBody* PBStreamResolve(PBStream* stream, int ref) {
+  if(ref < 0) {
+    return PBStreamGetStatic(stream, -1 - ref)->body;
+  }
+  return (PBBody*)(*((size_t*)PBArrayGetItem(stream->objects, ref)));
+}
+
+static void PBStreamActivateChunk(PBStream* stream, PBStreamChunk* chunk) {
+  PBWorld* world = stream->world;
+  chunk->active = 1;
+  stream->activeChunks++;
+  
+  if(chunk->statics != NULL && !chunk->staticsLoaded) {
+    for(int i = 0; i < chunk->statics->count; i++) {
+      PBStreamRetainStatic(stream, *(int*)PBArrayGetItem(chunk->statics, i));
+    }
+    chunk->staticsLoaded = 1;
+  }
+  
+  if(chunk->bodies == NULL) {
+    return;
+  }
+  
+  PBArraySetCount(stream->objects, 0);
+  PBArrayReserve(stream->bodies, stream->bodies->count + chunk->bodies->count);
+  for(int i = 0; i < chunk->bodies->count; i++) {
+    size_t addr = (size_t)PBStreamCreateBody(stream, (PBSceneBody*)PBArrayGetItem(chunk->bodies, i));
+    PBArrayAppendItem(stream->bodies, &addr);
+    PBArrayAppendItem(stream->objects, &addr);
+  }
+  stream->storedBodies -= chunk->bodies->count;
+  PBArraySetCount(chunk->bodies, 0);
+  
+  if(chunk->joints != NULL) {
+    for(int i = 0; i < chunk->joints->count; i++) {
+      PBStreamJoint* record = (PBStreamJoint*)PBArrayGetItem(chunk->joints, i);
+      PBJoint* joint = PBJointCreateEmpty();
+      joint->body1 = PBStreamResolve(stream, record->body1);
+      joint->body2 = PBStreamResolve(stream, record->body2);
+      joint->localAnchor1 = record->localAnchor1;
+      joint->localAnchor2 = record->localAnchor2;
+      joint->softness = record->softness;
+      joint->biasFactor = record->biasFactor;
+      joint->P = record->P;
+      PBWorldAddJoint(world, joint);
+    }
+    PBArraySetCount(chunk->joints, 0);
+  }
+  
+  // Put the arbiters back so resting contacts keep their impulses. Records
+  // keep the arbiter's body order, which the contacts were built for.
+  if(chunk->arbiters != NULL) {
+    for(int i = 0; i < chunk->arbiters->count; i++) {
+      PBStreamArbiter* record = (PBStreamArbiter*)PBArrayGetItem(chunk->arbiters, i);
+      PBBody* b1 = PBStreamResolve(stream, record->body1);
+      PBBody* b2 = PBStreamResolve(stream, record->body2);
+      if(b1 == NULL || b2 == NULL || PBWorldFindArbiter(world, b1, b2) != NULL) {
+        continue;
+      }
+      PBWorldAddArbiter(world, PBArbiterCreateWithContacts(b1, b2, record->contacts, record->numContacts));
+    }
+    PBArraySetCount(chunk->arbiters, 0);
+  }
+}
+
+// STORING
+
+static PBStreamMark* PBStreamGetMark(PBStream* stream, int i) {
+  return (PBStreamMark*)PBArrayGetItem(stream->marks, i);
+}
+
+// The chunk a dynamic body is being stored in, -1 if it stays live, or -2
+// if the stream doesn't own it.
+static int PBStreamGetTarget(PBStream* stream, PBBody* body) {
+  if(body->stream != stream) {
+    return -2;
+  }
+  return PBStreamGetMark(stream, body->solverIndex)->chunk;
+}
+
+// How a stored record refers to a body, or PB_STREAM_NO_BODY if it can't.
+static int PBStreamGetRef(PBStream* stream, PBBody* body, int chunk) {
+  if(body->stream != stream) {
+    return PB_STREAM_NO_BODY;
+  }
+  if(body->invMass == 0.0f) {
+    return body->solverIndex;
+  }
+  PBStreamMark* mark = PBStreamGetMark(stream, body->solverIndex);
+  return mark->chunk == chunk ? mark->local : PB_STREAM_NO_BODY;
+}
+
+// Stores every live body whose center is in an inactive chunk, unless it
+// is jointed to a body that stays live.
+static void PBStreamStoreBodies(PBStream* stream) {
+  PBWorld* world = stream->world;
+  int count = stream->bodies->count;
+  
+  // Body indices are only needed during this pass, so solverIndex holds them.
+  for(int i = 0; i < stream->statics->count; i++) {
+    PBStreamStatic* s = PBStreamGetStatic(stream, i);
+    if(s->body != NULL) {
+      s->body->solverIndex = -1 - i;
+    }
+  }
+  
+  int storing = 0;
+  PBArraySetCount(stream->marks, count);
+  for(int i = 0; i < count; i++) {
+    PBBody* body = PBStreamGetBody(stream, i);
+    PBStreamMark* mark = PBStreamGetMark(stream, i);
+    body->solverIndex = i;
+    mark->chunk = PBStreamGetChunkIndex(stream, body->position);
+    if(stream->chunks[mark->chunk].active) {
+      mark->chunk = -1;
+    }
+    else {
+      storing++;
+    }
+  }
+  if(storing == 0) {
+    return;
+  }
+  
+  int changed = 1;
+  while(changed) {
+    changed = 0;
+    for(int i = 0; i < count; i++) {
+      PBStreamMark* mark = PBStreamGetMark(stream, i);
+      if(mark->chunk < 0) {
+        continue;
+      }
+      for(PBJointEdge* edge = PBStreamGetBody(stream, i)->jointList; edge != NULL; edge = edge->next) {
+        PBBody* other = edge->other;
+        if(other->stream == stream && other->invMass == 0.0f) {
+          continue;
+        }
+        if(PBStreamGetTarget(stream, other) != mark->chunk) {
+          mark->chunk = -1;
+          changed = 1;
+          break;
+        }
+      }
+    }
+  }
+  
+  storing = 0;
+  for(int i = 0; i < count; i++) {
+    PBStreamMark* mark = PBStreamGetMark(stream, i);
+    if(mark->chunk >= 0) {
+      storing++;
+      PBStreamChunk* chunk = stream->chunks + mark->chunk;
+      PBArray* bodies = PBStreamChunkArray(&chunk->bodies, sizeof(PBSceneBody));
+      PBSceneBody record;
+      PBSceneWriteBody(PBStreamGetBody(stream, i), &record);
+      mark->local = bodies->count;
+      PBArrayAppendItem(bodies, &record);
+    }
+  }
+  
+  // Each arbiter and joint is stored once, by its first stored body.
+  PBArraySetCount(stream->objects, 0);
+  for(int i = 0; i < count; i++) {
+    PBStreamMark* mark = PBStreamGetMark(stream, i);
+    if(mark->chunk < 0) {
+      continue;
+    }
+    PBBody* body = PBStreamGetBody(stream, i);
+    PBStreamChunk* chunk = stream->chunks + mark->chunk;
+    
+    for(PBArbiterEdge* edge = body->arbiterList; edge != NULL; edge = edge->next) {
+      PBArbiter* arbiter = edge->arbiter;
+      int other = PBStreamGetRef(stream, edge->other, mark->chunk);
+      if(other == PB_STREAM_NO_BODY || (other >= 0 && arbiter->body1 != body)) {
+        continue;
+      }
+      PBStreamArbiter record = {
+        .body1 = PBStreamGetRef(stream, arbiter->body1, mark->chunk),
+        .body2 = PBStreamGetRef(stream, arbiter->body2, mark->chunk),
+        .numContacts = arbiter->numContacts
+      };
+      memcpy(record.contacts, arbiter->contacts, sizeof(PBContact) * arbiter->numContacts);
+      PBArrayAppendItem(PBStreamChunkArray(&chunk->arbiters, sizeof(PBStreamArbiter)), &record);
+    }
+    
+    for(PBJointEdge* edge = body->jointList; edge != NULL; edge = edge->next) {
+      PBJoint* joint = edge->joint;
+      int other = PBStreamGetRef(stream, edge->other, mark->chunk);
+      if(other >= 0 && joint->body1 != body) {
+        continue;
+      }
+      PBStreamJoint record = {
+        .body1 = PBStreamGetRef(stream, joint->body1, mark->chunk),
+        .body2 = PBStreamGetRef(stream, joint->body2, mark->chunk),
+        .localAnchor1 = joint->localAnchor1,
+        .localAnchor2 = joint->localAnchor2,
+        .softness = joint->softness,
+        .biasFactor = joint->biasFactor,
+        .P = joint->P
+      };
+      PBArrayAppendItem(PBStreamChunkArray(&chunk->joints, sizeof(PBStreamJoint)), &record);
+      size_t addr = (size_t)joint;
+      PBArrayAppendItem(stream->objects, &addr);
+    }
+  }
+  
+  // Removing from the back keeps the marks of bodies not yet visited in place.
+  for(int i = count - 1; i >= 0; i--) {
+    if(PBStreamGetMark(stream, i)->chunk >= 0) {
+      PBBody* body = PBStreamGetBody(stream, i);
+      PBWorldRemoveBody(world, body);
+      PBBodyFree(body);
+      PBArraySwapRemoveItemAt(stream->bodies, i);
+    }
+  }
+  for(int i = 0; i < stream->objects->count; i++) {
+    PBJointFree((PBJoint*)(*((size_t*)PBArrayGetItem(stream->objects, i))));
+  }
+  stream->storedBodies += storing;
+}
+
+// Activates the chunks within the stream's radius of focus and stores
+// bodies in chunks more than one chunk beyond it. The world can't be
+// stepping or deferred. Returns the number of chunks that changed.
+int PBStreamSetFocus(PBStream* stream, PBVec2 focus) {
+  PBWorld* world = stream->world;
+  if(world->stepState.stage != PBWorldStepStageIdle || world->deferred) {
+    pb_log("playbox: PBStream: can't load or unload chunks while the world is stepping or deferred");
+    return 0;
+  }
+  if(stream->chunks == NULL) {
+    return 0;
+  }
+  
+  int fx = (int)floorf((focus.x - stream->origin.x) / stream->cellSize);
+  int fy = (int)floorf((focus.y - stream->origin.y) / stream->cellSize);
+  
+  int changed = 0;
+  for(int y = 0; y < stream->rows; y++) {
+    for(int x = 0; x < stream->columns; x++) {
+      PBStreamChunk* chunk = stream->chunks + y * stream->columns + x;
+      int dx = abs(x - fx), dy = abs(y - fy);
+      int distance = dx > dy ? dx : dy;
+      
+      if(!chunk->active && distance <= stream->radius) {
+        PBStreamActivateChunk(stream, chunk);
+        changed++;
+      }
+      else if(chunk->active && distance > stream->radius + 1) {
+        chunk->active = 0;
+        stream->activeChunks--;
+        changed++;
+      }
+    }
+  }
+  
+  // Bodies also drift out of active chunks, so this runs every time.
+  PBStreamStoreBodies(stream);
+  
+  // Release statics after storing, so arbiters with them are kept.
+  for(int i = 0; i < stream->columns * stream->rows && changed > 0; i++) {
+    PBStreamChunk* chunk = stream->chunks + i;
+    if(!chunk->active && chunk->staticsLoaded) {
+      for(int j = 0; j < chunk->statics->count; j++) {
+        PBStreamReleaseStatic(stream, *(int*)PBArrayGetItem(chunk->statics, j));
+      }
+      chunk->staticsLoaded = 0;
+    }
+  }
+  
+  return changed;
+}
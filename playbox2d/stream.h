@@ -0,0 +1,84 @@
+#ifndef PLAYBOX_STREAM_H
+#define PLAYBOX_STREAM_H
+
+#include "maths.h"
+#include "body.h"
+#include "joint.h"
+#include "arbiter.h"
+#include "array.h"
+#include "world.h"
+#include "scene.h"
+
+// A joint stored in an inactive chunk. Body indices are local to the chunk,
+// or -1 - i for stream static body i.
+typedef struct {
+  int32_t body1, body2;
+  PBVec2 localAnchor1, localAnchor2;
+  float softness;
+  float biasFactor;
+  PBVec2 P;
+} PBStreamJoint;
+
+// An arbiter stored in an inactive chunk, with bodies indexed as in PBStreamJoint.
+typedef struct {
+  int32_t body1, body2;
+  int32_t numContacts;
+  PBContact contacts[MAX_ARBITER_POINTS];
+} PBStreamArbiter;
+
+typedef struct {
+  int active;
+  int staticsLoaded;
+  
+  // Dynamic bodies and what connects them while the chunk is inactive
+  PBArray* bodies;  // PBSceneBody
+  PBArray* joints;  // PBStreamJoint
+  PBArray* arbiters;  // PBStreamArbiter
+  
+  PBArray* statics;  // indices of the stream static bodies overlapping the chunk
+} PBStreamChunk;
+
+typedef struct {
+  PBSceneBody record;
+  PBBody* body;  // live while an active chunk overlaps it
+  int activeChunks;
+} PBStreamStatic;
+
+typedef struct {
+  int chunk;  // chunk the body is being stored in, or -1 if it stays live
+  int local;  // index in that chunk's bodies
+} PBStreamMark;
+
+// Splits a level into a grid of chunks and keeps only the chunks around a
+// focus point in the world. Static bodies are created while any chunk they
+// overlap is active. Dynamic bodies belong to the chunk under their center
+// and are stored as records, with their joints and arbiters, when that
+// chunk is inactive.
+typedef struct PBStream {
+  PBWorld* world;
+  
+  PBVec2 origin;
+  float cellSize;
+  int columns, rows;
+  int radius;  // chunks around the focus that are kept active
+  PBStreamChunk* chunks;
+  
+  PBArray* statics;  // PBStreamStatic
+  PBArray* bodies;  // live dynamic bodies the stream owns
+  
+  // Scratch for loading and unloading chunks
+  PBArray* marks;  // PBStreamMark per live body
+  PBArray* objects;  // bodies being loaded, joints being freed
+  
+  int activeChunks;
+  int storedBodies;
+  
+  void* userData;  // for bindings, e.g. the object that owns the world
+} PBStream;
+
+extern PBStream* PBStreamCreate(PBWorld* world, float cellSize, int radius);
+extern void PBStreamFree(PBStream* stream);
+extern int PBStreamLoadScene(PBStream* stream, const void* data, int size);
+extern int PBStreamSetFocus(PBStream* stream, PBVec2 focus);
+
+#endif
@@ -1,10 +1,10 @@
 #include "world.h"
 #include "platform.h"
 #include "arbiter.h"
+#include "query.h"
+#include <stdint.h>
 
-int PBWorldFindArbiter(PBWorld* world, PBBody* body1, PBBody* body2);
-int PBWorldFindFirstArbiterForBody(PBWorld* world, PBBody* body);
-int PBWorldFindFirstJointForBody(PBWorld* world, PBBody* body);
+PBArbiter* PBWorldFindArbiter(PBWorld* world, PBBody* body1, PBBody* body2);
 
 PBBody* PBWorldGetBody(PBWorld* world, int i);
 PBJoint* PBWorldGetJoint(PBWorld* world, int i);
@@ -18,64 +18,516 @@ PBWorld* PBWorldCreate(PBVec2 gravity, int iterations) {
   
   world->bodies = PBArrayCreate(sizeof(size_t));
   world->joints = PBArrayCreate(sizeof(size_t));
+  world->arbiters = PBArrayCreate(sizeof(size_t));
+  world->commands = PBArrayCreate(sizeof(PBWorldCommand));
+  world->bodyEdits = PBArrayCreate(sizeof(PBWorldBodyEdit));
   
-  world->arbiters = PBArrayCreate(sizeof(PBArbiter));
+  world->tree = PBDynamicTreeCreate();
+  world->pairs = PBArrayCreate(sizeof(PBBodyPair));
+  world->solverBodies = PBArrayCreate(sizeof(PBSolverBody));
+  world->contactConstraints = PBArrayCreate(sizeof(PBContactConstraint));
+  world->islandIds = PBArrayCreate(sizeof(int));
+  world->islands = PBArrayCreate(sizeof(PBSolverIsland));
+  world->minIterations = 1;
+  world->solverFlags = PB_SOLVER_DEFAULT_FLAGS;
+  world->lodReducedDistance = 0.0f;
+  world->lodFrozenDistance = FLT_MAX;
+  world->lodInterval = 2;
   
   return world;
 }
 
+static void PBWorldFreeArbiters(PBWorld* world) {
+  for(int i = 0; i < world->arbiters->count; i++) {
+    PBArbiterFree(PBWorldGetArbiter(world, i));
+  }
+  PBArrayRemoveAllItems(world->arbiters);
+}
+
 void PBWorldFree(PBWorld* world) {
+  PBWorldFreeArbiters(world);
   PBArrayFree(world->bodies);
   PBArrayFree(world->joints);
   PBArrayFree(world->arbiters);
+  PBArrayFree(world->commands);
+  PBArrayFree(world->bodyEdits);
+  PBArrayFree(world->pairs);
+  PBArrayFree(world->solverBodies);
+  PBArrayFree(world->contactConstraints);
+  PBArrayFree(world->islandIds);
+  PBArrayFree(world->islands);
+  PBDynamicTreeFree(world->tree);
+  if(world->scene != NULL) {
+    pb_free(world->scene);
+  }
   pb_free(world);
 }
 
+// ARBITER AND JOINT EDGES
+
+static void PBWorldLinkArbiterEdge(PBArbiterEdge* edge, PBArbiter* arbiter, PBBody* body, PBBody* other) {
+  edge->arbiter = arbiter;
+  edge->other = other;
+  edge->prev = NULL;
+  edge->next = body->arbiterList;
+  if(body->arbiterList != NULL) {
+    body->arbiterList->prev = edge;
+  }
+  body->arbiterList = edge;
+}
+
+static void PBWorldUnlinkArbiterEdge(PBArbiterEdge* edge, PBBody* body) {
+  if(edge->prev != NULL) {
+    edge->prev->next = edge->next;
+  }
+  else {
+    body->arbiterList = edge->next;
+  }
+  if(edge->next != NULL) {
+    edge->next->prev = edge->prev;
+  }
+  edge->prev = NULL;
+  edge->next = NULL;
+}
+
+static void PBWorldLinkJointEdge(PBJointEdge* edge, PBJoint* joint, PBBody* body, PBBody* other) {
+  edge->joint = joint;
+  edge->other = other;
+  edge->prev = NULL;
+  edge->next = body->jointList;
+  if(body->jointList != NULL) {
+    body->jointList->prev = edge;
+  }
+  body->jointList = edge;
+}
+
+static void PBWorldUnlinkJointEdge(PBJointEdge* edge, PBBody* body) {
+  if(edge->prev != NULL) {
+    edge->prev->next = edge->next;
+  }
+  else {
+    body->jointList = edge->next;
+  }
+  if(edge->next != NULL) {
+    edge->next->prev = edge->prev;
+  }
+  edge->prev = NULL;
+  edge->next = NULL;
+}
+
+void PBWorldAddArbiter(PBWorld* world, PBArbiter* arbiter) {
+  size_t addr = (size_t)arbiter;
+  arbiter->index = world->arbiters->count;
+  PBArrayAppendItem(world->arbiters, &addr);
+  
+  PBWorldLinkArbiterEdge(&arbiter->edge1, arbiter, arbiter->body1, arbiter->body2);
+  PBWorldLinkArbiterEdge(&arbiter->edge2, arbiter, arbiter->body2, arbiter->body1);
+}
+
+void PBWorldDestroyArbiter(PBWorld* world, PBArbiter* arbiter) {
+  PBWorldUnlinkArbiterEdge(&arbiter->edge1, arbiter->body1);
+  PBWorldUnlinkArbiterEdge(&arbiter->edge2, arbiter->body2);
+  
+  // Fill the hole with the last arbiter so removal stays O(1).
+  int i = arbiter->index;
+  PBArraySwapRemoveItemAt(world->arbiters, i);
+  if(i < world->arbiters->count) {
+    PBWorldGetArbiter(world, i)->index = i;
+  }
+  
+  PBArbiterFree(arbiter);
+}
+
+// BROADPHASE PROXIES
+
+static void PBWorldCreateProxy(PBWorld* world, PBBody* body) {
+  body->proxyId = PBDynamicTreeCreateProxy(world->tree, PBBodyGetAABB(body), body);
+}
+
+static void PBWorldDestroyProxy(PBWorld* world, PBBody* body) {
+  if(body->proxyId != PB_NULL_NODE) {
+    PBDynamicTreeDestroyProxy(world->tree, body->proxyId);
+    body->proxyId = PB_NULL_NODE;
+  }
+}
+
+// Call after moving, rotating or resizing a body outside of PBWorldStep so
+// queries and the next step's broadphase see it.
+void PBWorldUpdateBody(PBWorld* world, PBBody* body) {
+  if(body->proxyId != PB_NULL_NODE) {
+    PBDynamicTreeMoveProxy(world->tree, body->proxyId, PBBodyGetAABB(body));
+  }
+}
+
+static void PBWorldSynchronizeProxies(PBWorld* world) {
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBWorldUpdateBody(world, PBWorldGetBody(world, i));
+  }
+}
+
+// BODY EDITS
+
+static void PBWorldApplyBodyEdit(const PBWorldBodyEdit* edit) {
+  PBBody* body = edit->body;
+  
+  switch(edit->type) {
+    case PBWorldBodyEditSetVelocity:
+      body->velocity = edit->v;
+      break;
+    case PBWorldBodyEditSetAngularVelocity:
+      body->angularVelocity = edit->f;
+      break;
+    case PBWorldBodyEditSetForce:
+      body->force = edit->v;
+      break;
+    case PBWorldBodyEditSetTorque:
+      body->torque = edit->f;
+      break;
+    case PBWorldBodyEditAddForce:
+      PBBodyAddForce(body, edit->v);
+      break;
+  }
+}
+
+// A step copies velocities out at PreStep, writes them back and clears
+// forces at Integrate, so changes in between would be lost. They wait for
+// the step to finish instead. world may be NULL for a body in no world.
+static void PBWorldEditBody(PBWorld* world, PBWorldBodyEdit edit) {
+  if(world != NULL && world->stepState.stage != PBWorldStepStageIdle) {
+    PBArrayAppendItem(world->bodyEdits, &edit);
+  }
+  else {
+    PBWorldApplyBodyEdit(&edit);
+  }
+}
+
+static void PBWorldApplyBodyEdits(PBWorld* world) {
+  const PBWorldBodyEdit* edits = world->bodyEdits->first;
+  for(int i = 0; i < world->bodyEdits->count; i++) {
+    PBWorldApplyBodyEdit(edits + i);
+  }
+  PBArraySetCount(world->bodyEdits, 0);
+}
+
+void PBWorldSetBodyVelocity(PBWorld* world, PBBody* body, PBVec2 velocity) {
+  PBWorldEditBody(world, (PBWorldBodyEdit){ .type = PBWorldBodyEditSetVelocity, .body = body, .v = velocity });
+}
+
+void PBWorldSetBodyAngularVelocity(PBWorld* world, PBBody* body, float angularVelocity) {
+  PBWorldEditBody(world, (PBWorldBodyEdit){ .type = PBWorldBodyEditSetAngularVelocity, .body = body, .f = angularVelocity });
+}
+
+void PBWorldSetBodyForce(PBWorld* world, PBBody* body, PBVec2 force) {
+  PBWorldEditBody(world, (PBWorldBodyEdit){ .type = PBWorldBodyEditSetForce, .body = body, .v = force });
+}
+
+void PBWorldSetBodyTorque(PBWorld* world, PBBody* body, float torque) {
+  PBWorldEditBody(world, (PBWorldBodyEdit){ .type = PBWorldBodyEditSetTorque, .body = body, .f = torque });
+}
+
+void PBWorldAddBodyForce(PBWorld* world, PBBody* body, PBVec2 force) {
+  PBWorldEditBody(world, (PBWorldBodyEdit){ .type = PBWorldBodyEditAddForce, .body = body, .v = force });
+}
+
+// BODIES AND JOINTS
+
+static void PBWorldQueueCommand(PBWorld* world, PBWorldCommandType type, void* object) {
+  PBWorldCommand command = { .type = type, .object = object };
+  PBArrayAppendItem(world->commands, &command);
+}
+
+// Queued changes only take effect in PBWorldFlushCommands. An add and a
+// remove of the same object cancel out.
+static void PBWorldQueueChange(PBWorld* world, PBWorldCommandType type, void* object, int* pending, int inWorld, int change) {
+  if(change > 0 ? inWorld : !inWorld) {
+    if(*pending == -change) {
+      *pending = 0;
+    }
+    return;
+  }
+  
+  if(*pending != change) {
+    *pending = change;
+    PBWorldQueueCommand(world, type, object);
+  }
+}
+
+// Changes are queued in deferred mode and while a budgeted step is unfinished.
+static int PBWorldIsDeferring(PBWorld* world) {
+  return world->deferred || world->stepState.stage != PBWorldStepStageIdle;
+}
+
 void PBWorldAddBody(PBWorld* world, PBBody* body) {
+  if(PBWorldIsDeferring(world)) {
+    PBWorldQueueChange(world, PBWorldCommandAddBody, body, &body->pending, body->world == world, 1);
+    return;
+  }
+  
+  if(body->world == world) {
+    return;
+  }
+  if(body->world != NULL) {
+    pb_log("playbox: PBWorld: attempt to add body that is in another world");
+    return;
+  }
+  
   size_t addr = (size_t)body;
   body->world = world;
+  body->index = world->bodies->count;
   PBArrayAppendItem(world->bodies, &addr);
+  PBWorldCreateProxy(world, body);
+  world->orderGeneration++;
 }
 
 void PBWorldRemoveBody(PBWorld* world, PBBody* body) {
-  size_t addr = (size_t)body;
+  if(PBWorldIsDeferring(world)) {
+    PBWorldQueueChange(world, PBWorldCommandRemoveBody, body, &body->pending, body->world == world, -1);
+    return;
+  }
+  
+  if(body->world != world) {
+    if(body->world != NULL) {
+      pb_log("playbox: PBWorld: attempt to remove body that is in another world");
+    }
+    return;
+  }
+  
   body->world = NULL;
   
-  // Remove body
-  PBArrayRemoveItem(world->bodies, &addr);
+  // Remove body, filling the hole with the last one
+  int i = body->index;
+  PBArraySwapRemoveItemAt(world->bodies, i);
+  if(i < world->bodies->count) {
+    PBWorldGetBody(world, i)->index = i;
+  }
+  PBWorldDestroyProxy(world, body);
+  world->orderGeneration++;
   
   // Remove all related arbiters
-  int i = PBWorldFindFirstArbiterForBody(world, body);
-  while(i != -1) {
-    PBArrayRemoveItemAt(world->arbiters, i);
-    i = PBWorldFindFirstArbiterForBody(world, body);
+  while(body->arbiterList != NULL) {
+    PBWorldDestroyArbiter(world, body->arbiterList->arbiter);
   }
   
   // Remove all related joints
-  i = PBWorldFindFirstJointForBody(world, body);
-  while(i != -1) {
-    PBJoint* joint = PBWorldGetJoint(world, i);
-    joint->world = NULL;
-    PBArrayRemoveItemAt(world->joints, i);
-    i = PBWorldFindFirstJointForBody(world, body);
+  while(body->jointList != NULL) {
+    PBWorldRemoveJoint(world, body->jointList->joint);
   }
 }
 
 void PBWorldAddJoint(PBWorld* world, PBJoint* joint) {
+  if(PBWorldIsDeferring(world)) {
+    PBWorldQueueChange(world, PBWorldCommandAddJoint, joint, &joint->pending, joint->world == world, 1);
+    return;
+  }
+  
+  // The solver finds joint bodies by their index in this world.
+  if(joint->body1->world != world || joint->body2->world != world) {
+    pb_log("playbox: PBWorld: attempt to add joint whose bodies are not in world");
+    return;
+  }
+  
   size_t addr = (size_t)joint;
   joint->world = world;
+  joint->index = world->joints->count;
   PBArrayAppendItem(world->joints, &addr);
+  world->orderGeneration++;
+  
+  PBWorldLinkJointEdge(&joint->edge1, joint, joint->body1, joint->body2);
+  PBWorldLinkJointEdge(&joint->edge2, joint, joint->body2, joint->body1);
 }
 
 void PBWorldRemoveJoint(PBWorld* world, PBJoint* joint) {
-  size_t addr = (size_t)joint;
+  if(PBWorldIsDeferring(world)) {
+    PBWorldQueueChange(world, PBWorldCommandRemoveJoint, joint, &joint->pending, joint->world == world, -1);
+    return;
+  }
+  
+  if(joint->world != world) {
+    pb_log("playbox: PBWorld: attempt to remove joint that is not in world");
+    return;
+  }
+  
   joint->world = NULL;
-  PBArrayRemoveItem(world->joints, &addr);
+  PBWorldUnlinkJointEdge(&joint->edge1, joint->body1);
+  PBWorldUnlinkJointEdge(&joint->edge2, joint->body2);
+  
+  int i = joint->index;
+  PBArraySwapRemoveItemAt(world->joints, i);
+  if(i < world->joints->count) {
+    PBWorldGetJoint(world, i)->index = i;
+  }
+  world->orderGeneration++;
+}
+
+static void PBWorldDiscardCommands(PBWorld* world) {
+  for(int i = 0; i < world->commands->count; i++) {
+    PBWorldCommand* command = (PBWorldCommand*)PBArrayGetItem(world->commands, i);
+    if(command->type == PBWorldCommandAddBody || command->type == PBWorldCommandRemoveBody) {
+      ((PBBody*)command->object)->pending = 0;
+    }
+    else {
+      ((PBJoint*)command->object)->pending = 0;
+    }
+  }
+  PBArraySetCount(world->commands, 0);
+}
+
+void PBWorldSetDeferred(PBWorld* world, int deferred) {
+  if(world->deferred && !deferred) {
+    PBWorldFlushCommands(world);
+  }
+  world->deferred = deferred;
+}
+
+static int PBWorldIsRemovingBody(PBWorld* world, PBBody* body) {
+  return body->world == world && body->pending == -1;
+}
+
+// Applies all queued adds and removes. Each array is compacted once and
+// arbiters and joints attached to removed bodies are dropped in the same sweep.
+void PBWorldFlushCommands(PBWorld* world) {
+  if(world->commands->count == 0 || world->stepState.stage != PBWorldStepStageIdle) {
+    return;
+  }
+  
+  // Drop arbiters touching removed bodies.
+  size_t* arbiters = (size_t*)world->arbiters->first;
+  int count = 0;
+  for(int i = 0; i < world->arbiters->count; i++) {
+    PBArbiter* arbiter = (PBArbiter*)arbiters[i];
+    int removed1 = PBWorldIsRemovingBody(world, arbiter->body1);
+    int removed2 = PBWorldIsRemovingBody(world, arbiter->body2);
+    
+    if(removed1 || removed2) {
+      if(!removed1) {
+        PBWorldUnlinkArbiterEdge(&arbiter->edge1, arbiter->body1);
+      }
+      if(!removed2) {
+        PBWorldUnlinkArbiterEdge(&arbiter->edge2, arbiter->body2);
+      }
+      PBArbiterFree(arbiter);
+      continue;
+    }
+    
+    arbiter->index = count;
+    arbiters[count++] = (size_t)arbiter;
+  }
+  PBArraySetCount(world->arbiters, count);
+  
+  // Drop removed joints and joints attached to removed bodies.
+  size_t* joints = (size_t*)world->joints->first;
+  count = 0;
+  for(int i = 0; i < world->joints->count; i++) {
+    PBJoint* joint = (PBJoint*)joints[i];
+    int removed1 = PBWorldIsRemovingBody(world, joint->body1);
+    int removed2 = PBWorldIsRemovingBody(world, joint->body2);
+    
+    if(joint->pending == -1 || removed1 || removed2) {
+      if(!removed1) {
+        PBWorldUnlinkJointEdge(&joint->edge1, joint->body1);
+      }
+      if(!removed2) {
+        PBWorldUnlinkJointEdge(&joint->edge2, joint->body2);
+      }
+      joint->world = NULL;
+      joint->pending = 0;
+      continue;
+    }
+    
+    joint->index = count;
+    joints[count++] = (size_t)joint;
+  }
+  PBArraySetCount(world->joints, count);
+  
+  // Drop removed bodies.
+  size_t* bodies = (size_t*)world->bodies->first;
+  count = 0;
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBBody* body = (PBBody*)bodies[i];
+    
+    if(body->pending == -1) {
+      PBWorldDestroyProxy(world, body);
+      body->world = NULL;
+      body->pending = 0;
+      body->arbiterList = NULL;
+      body->jointList = NULL;
+      continue;
+    }
+    
+    body->index = count;
+    bodies[count++] = (size_t)body;
+  }
+  PBArraySetCount(world->bodies, count);
+  world->orderGeneration++;
+  
+  // Append added bodies, then joints, in the order they were queued.
+  int numBodies = 0;
+  int numJoints = 0;
+  for(int i = 0; i < world->commands->count; i++) {
+    PBWorldCommand* command = (PBWorldCommand*)PBArrayGetItem(world->commands, i);
+    numBodies += command->type == PBWorldCommandAddBody;
+    numJoints += command->type == PBWorldCommandAddJoint;
+  }
+  PBArrayReserve(world->bodies, world->bodies->count + numBodies);
+  PBArrayReserve(world->joints, world->joints->count + numJoints);
+  
+  int deferred = world->deferred;
+  world->deferred = 0;
+  
+  for(int i = 0; i < world->commands->count; i++) {
+    PBWorldCommand* command = (PBWorldCommand*)PBArrayGetItem(world->commands, i);
+    if(command->type == PBWorldCommandAddBody) {
+      PBBody* body = (PBBody*)command->object;
+      if(body->pending == 1) {
+        body->pending = 0;
+        PBWorldAddBody(world, body);
+      }
+    }
+  }
+  
+  for(int i = 0; i < world->commands->count; i++) {
+    PBWorldCommand* command = (PBWorldCommand*)PBArrayGetItem(world->commands, i);
+    if(command->type == PBWorldCommandAddJoint) {
+      PBJoint* joint = (PBJoint*)command->object;
+      if(joint->pending == 1) {
+        joint->pending = 0;
+        // A body queued for removal after the joint was queued takes it along.
+        if(joint->body1->world == world && joint->body2->world == world) {
+          PBWorldAddJoint(world, joint);
+        }
+      }
+    }
+  }
+  
+  world->deferred = deferred;
+  
+  // Keep the storage for the next batch of commands.
+  PBArraySetCount(world->commands, 0);
 }
 
 void PBWorldClear(PBWorld* world) {
+  // Abandon any unfinished step.
+  world->stepState.stage = PBWorldStepStageIdle;
+  
+  PBWorldDiscardCommands(world);
+  PBArraySetCount(world->bodyEdits, 0);
+  PBWorldFreeArbiters(world);
+  
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBBody* body = PBWorldGetBody(world, i);
+    PBWorldDestroyProxy(world, body);
+    body->world = NULL;
+    body->arbiterList = NULL;
+    body->jointList = NULL;
+  }
+  
+  for(int i = 0; i < world->joints->count; i++) {
+    PBWorldGetJoint(world, i)->world = NULL;
+  }
+  
   PBArrayRemoveAllItems(world->bodies);
   PBArrayRemoveAllItems(world->joints);
+  world->orderGeneration++;
 }
 
 inline PBBody* PBWorldGetBody(PBWorld* world, int i) {
@@ -86,174 +538,1109 @@ inline PBJoint* PBWorldGetJoint(PBWorld* world, int i) {
   return (PBJoint*)(*((size_t*)PBArrayGetItem(world->joints, i)));
 }
 
-int PBWorldFindFirstArbiterForBody(PBWorld* world, PBBody* body) {
-  if(world->arbiters->count == 0) {
-    return -1;
+PBArbiter* PBWorldGetArbiter(PBWorld* world, int i) {
+  return (PBArbiter*)(*((size_t*)PBArrayGetItem(world->arbiters, i)));
+}
+
+// Walks body1's arbiter list, so the cost is its number of contacts.
+PBArbiter* PBWorldFindArbiter(PBWorld* world, PBBody* body1, PBBody* body2) {
+  if(body1->world != world) {
+    return NULL;
   }
-    
-  for(int i = 0; i < world->arbiters->count; i++) {
-    PBArbiter* arbiter = (PBArbiter*)PBArrayGetItem(world->arbiters, i);
-    if(arbiter->body1 == body || arbiter->body2 == body) {
-      return i;
+  
+  for(PBArbiterEdge* edge = body1->arbiterList; edge != NULL; edge = edge->next) {
+    if(edge->other == body2) {
+      return edge->arbiter;
     }
   }
   
-  return -1;
+  return NULL;
+}
+
+int PBWorldNumberOfContactsBetweenBodies(PBWorld* world, PBBody* body1, PBBody* body2) {
+  PBArbiter* arbiter = PBWorldFindArbiter(world, body1, body2);
+  return arbiter != NULL ? arbiter->numContacts : 0;
+}
+
+int PBWorldGetTouchingBodies(PBWorld* world, PBBody* body, PBBody** bodies, int maxBodies) {
+  if(body->world != world) {
+    return 0;
+  }
+  
+  int count = 0;
+  for(PBArbiterEdge* edge = body->arbiterList; edge != NULL; edge = edge->next) {
+    if(count < maxBodies) {
+      bodies[count] = edge->other;
+    }
+    count++;
+  }
+  return count;
+}
+
+void PBWorldSetManifoldReuseTolerance(PBWorld* world, float linearTolerance, float angularTolerance) {
+  world->manifoldReuseLinearTolerance = linearTolerance;
+  world->manifoldReuseAngularTolerance = angularTolerance;
+}
+
+void PBWorldSetSolverTolerance(PBWorld* world, float tolerance, int minIterations) {
+  world->solverTolerance = tolerance;
+  world->minIterations = minIterations > 1 ? minIterations : 1;
+}
+
+void PBWorldSetBlockSolver(PBWorld* world, int blockSolver) {
+  world->blockSolver = blockSolver;
+}
+
+void PBWorldSetSplitImpulse(PBWorld* world, int splitImpulse) {
+  world->splitImpulse = splitImpulse;
 }
 
-int PBWorldFindFirstJointForBody(PBWorld* world, PBBody* body) {
-  if(world->joints->count == 0) {
-    return -1;
+// Takes effect from the next step, so one already started by
+// PBWorldStepWithBudget finishes with the flags it began with.
+void PBWorldSetSolverFlags(PBWorld* world, int flags) {
+  world->solverFlags = flags;
+}
+
+// Full detail inside focus, usually the view in world units.
+void PBWorldSetLODFocus(PBWorld* world, PBAABB focus) {
+  world->lodEnabled = 1;
+  world->lodFocus = focus;
+}
+
+// Simulates every body fully again.
+void PBWorldClearLODFocus(PBWorld* world) {
+  world->lodEnabled = 0;
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBBody* body = PBWorldGetBody(world, i);
+    body->lodSkipped = 0;
   }
+}
+
+void PBWorldSetLODDistances(PBWorld* world, float reducedDistance, float frozenDistance, int interval) {
+  world->lodReducedDistance = reducedDistance;
+  world->lodFrozenDistance = frozenDistance;
+  world->lodInterval = interval > 1 ? interval : 1;
+}
+
+// Reorders bodies, arbiters and joints every interval steps, or as soon as
+// more than threshold of the contacts between dynamic bodies join bodies
+// that are far apart in the body array. 0 disables either trigger.
+// Reordering changes body indices, so it also invalidates snapshots.
+void PBWorldSetReorder(PBWorld* world, int interval, float threshold) {
+  world->reorderInterval = interval > 0 ? interval : 0;
+  world->reorderThreshold = threshold;
+  world->reorderStep = 0;
+}
+
+void PBWorldSetBulletsHitDynamic(PBWorld* world, int hitDynamic) {
+  world->bulletsHitDynamic = hitDynamic;
+}
+
+// CONTINUOUS COLLISION
+
+typedef struct {
+  PBWorld* world;
+  PBBody* bullet;
+  PBBody* ignore;
+  PBVec2 translation;
+  PBRayCastHit hit;
+  int found;
+} PBWorldBulletSweep;
+
+static int PBWorldBulletSweepCallback(int proxyId, void* context) {
+  PBWorldBulletSweep* sweep = (PBWorldBulletSweep*)context;
+  PBBody* other = (PBBody*)PBDynamicTreeGetUserData(sweep->world->tree, proxyId);
+  
+  if(other == sweep->bullet || other == sweep->ignore || (other->invMass != 0.0f && !sweep->world->bulletsHitDynamic)) {
+    return 1;
+  }
+  
+  PBRayCastHit hit;
+  if(!PBBodyShapeCast(sweep->bullet, sweep->translation, other, &hit)) {
+    return 1;
+  }
+  
+  // Surfaces the bullet is moving away from are left to the contact solver.
+  // Bodies it already overlaps hit at a fraction of zero, so a bullet that
+  // starts a sweep inside a thin wall stops there instead of passing through.
+  if(PBVec2Dot(sweep->translation, hit.normal) >= 0.0f) {
+    return 1;
+  }
+  
+  if(!sweep->found || hit.fraction < sweep->hit.fraction) {
+    sweep->hit = hit;
+    sweep->found = 1;
+  }
+  return 1;
+}
+
+// Moves a bullet through dt, stopping at each time of impact to remove the
+// approaching velocity and then continuing with the time that is left.
+// Rotation is integrated once and ignored by the sweeps.
+static void PBWorldAdvanceBullet(PBWorld* world, PBBody* b, float dt) {
+  float remaining = dt;
+  PBBody* ignore = NULL;
+  
+  for(int subStep = 0; subStep < PB_MAX_BULLET_SUB_STEPS && remaining > 0.0f; subStep++) {
+    PBVec2 translation = PBVec2MultF(b->velocity, remaining);
+    float distance = PBVec2GetLength(translation);
+    if(distance < FLT_EPSILON) {
+      return;
+    }
+    
+    PBAABB start = PBBodyGetAABB(b);
+    PBAABB end = PBAABBMake(PBVec2Add(start.lower, translation), PBVec2Add(start.upper, translation));
+    
+    PBWorldBulletSweep sweep = { .world = world, .bullet = b, .ignore = ignore, .translation = translation, .found = 0 };
+    PBDynamicTreeQuery(world->tree, PBAABBCombine(start, end), PBWorldBulletSweepCallback, &sweep);
+    
+    if(!sweep.found) {
+      break;
+    }
     
+    float fraction = PBMax(sweep.hit.fraction - PB_BULLET_SLOP / distance, 0.0f);
+    b->position = PBVec2Add(b->position, PBVec2MultF(translation, fraction));
+    remaining -= remaining * fraction;
+    world->stats.bulletSubSteps++;
+    
+    // Inelastic response along the normal. Friction and restitution are
+    // left to the contact that forms on the next step.
+    PBBody* other = sweep.hit.body;
+    PBVec2 n = sweep.hit.normal;
+    float vn = PBVec2Dot(PBVec2Sub(b->velocity, other->velocity), n);
+    if(vn < 0.0f) {
+      float P = -vn / (b->invMass + other->invMass);
+      b->velocity = PBVec2Add(b->velocity, PBVec2MultF(n, P * b->invMass));
+      
+      if(other->invMass != 0.0f) {
+        // The other body has already moved for this step, so apply its
+        // velocity change over the time that is left. Both now share the
+        // same normal velocity and the solver takes over next step.
+        PBVec2 dv = PBVec2MultF(n, -P * other->invMass);
+        other->velocity = PBVec2Add(other->velocity, dv);
+        other->position = PBVec2Add(other->position, PBVec2MultF(dv, remaining));
+        PBWorldUpdateBody(world, other);
+        ignore = other;
+      }
+    }
+  }
+  
+  b->position = PBVec2Add(b->position, PBVec2MultF(b->velocity, remaining));
+}
+
+// ISLANDS
+
+static int PBWorldFindIsland(int* parents, int i) {
+  while(parents[i] != i) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+  }
+  return i;
+}
+
+// Static bodies don't connect the bodies resting on them.
+static void PBWorldJoinIslands(int* parents, const PBSolverBody* bodies, int a, int b) {
+  if(bodies[a].invMass == 0.0f || bodies[b].invMass == 0.0f) {
+    return;
+  }
+  
+  a = PBWorldFindIsland(parents, a);
+  b = PBWorldFindIsland(parents, b);
+  if(a != b) {
+    parents[a < b ? b : a] = a < b ? a : b;
+  }
+}
+
+static int PBWorldGetIsland(const int* islandIds, const PBSolverBody* bodies, int a, int b) {
+  return bodies[a].invMass != 0.0f ? islandIds[a] : islandIds[b];
+}
+
+// LEVEL OF DETAIL
+
+static PBBodyLOD PBWorldGetBodyLOD(PBWorld* world, PBBody* body) {
+  if(body->lod != PBBodyLODAuto) {
+    return body->lod;
+  }
+  
+  PBAABB focus = world->lodFocus;
+  float dx = PBMax(PBMax(focus.lower.x - body->position.x, body->position.x - focus.upper.x), 0.0f);
+  float dy = PBMax(PBMax(focus.lower.y - body->position.y, body->position.y - focus.upper.y), 0.0f);
+  float distance = PBMax(dx, dy);
+  
+  if(distance > world->lodFrozenDistance) {
+    return PBBodyLODFrozen;
+  }
+  if(distance > world->lodReducedDistance) {
+    return PBBodyLODReduced;
+  }
+  return PBBodyLODFull;
+}
+
+// Decides which bodies are simulated this step. Groups of bodies touching
+// through last step's arbiters and joints move together at the level of
+// their most detailed member. Reduced groups all run on the same steps so
+// two of them never collide while one is standing still. Body indices must
+// be current.
+static void PBWorldUpdateLOD(PBWorld* world) {
+  int numBodies = world->bodies->count;
+  float dt = world->stepState.dt;
+  world->lodStep++;
+  
+  // Borrow the island ids, which aren't built until the iterations.
+  PBArraySetCount(world->islandIds, numBodies * 2);
+  int* parents = (int*)world->islandIds->first;
+  int* levels = parents + numBodies;
+  
+  for(int i = 0; i < numBodies; i++) {
+    parents[i] = i;
+    levels[i] = PBWorldGetBodyLOD(world, PBWorldGetBody(world, i));
+  }
+  
+  for(int i = 0; i < world->arbiters->count; i++) {
+    PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+    if(arbiter->body1->invMass != 0.0f && arbiter->body2->invMass != 0.0f) {
+      int a = PBWorldFindIsland(parents, arbiter->body1->solverIndex);
+      int b = PBWorldFindIsland(parents, arbiter->body2->solverIndex);
+      parents[a < b ? b : a] = a < b ? a : b;
+    }
+  }
   for(int i = 0; i < world->joints->count; i++) {
     PBJoint* joint = PBWorldGetJoint(world, i);
-    if(joint->body1 == body || joint->body2 == body) {
-      return i;
+    if(joint->body1->invMass != 0.0f && joint->body2->invMass != 0.0f) {
+      int a = PBWorldFindIsland(parents, joint->body1->solverIndex);
+      int b = PBWorldFindIsland(parents, joint->body2->solverIndex);
+      parents[a < b ? b : a] = a < b ? a : b;
+    }
+  }
+  
+  for(int i = 0; i < numBodies; i++) {
+    int root = PBWorldFindIsland(parents, i);
+    levels[root] = levels[root] < levels[i] ? levels[root] : levels[i];
+  }
+  
+  for(int i = 0; i < numBodies; i++) {
+    PBBody* body = PBWorldGetBody(world, i);
+    int root = PBWorldFindIsland(parents, i);
+    int level = levels[root];
+    
+    if(body->invMass == 0.0f || level == PBBodyLODFull) {
+      body->lodSkipped = 0;
+    }
+    else if(level == PBBodyLODReduced) {
+      body->lodSkipped = world->lodStep % world->lodInterval != 0;
+    }
+    else {
+      // Frozen bodies keep their velocity for when they come back.
+      body->lodSkipped = 1;
+      body->lodTime = 0.0f;
+    }
+    
+    if(body->lodSkipped) {
+      if(level == PBBodyLODReduced) {
+        body->lodTime += dt;
+      }
+      world->stats.lodSkipped++;
     }
   }
+}
+
+// Contacts and joints with no simulated body do nothing this step.
+static int PBWorldIsLODSkipped(PBBody* body1, PBBody* body2) {
+  return (body1->lodSkipped || body1->invMass == 0.0f) && (body2->lodSkipped || body2->invMass == 0.0f);
+}
+
+// Bias velocities are sized for the time the bodies will actually move.
+static void PBWorldPreStepLODArbiter(PBWorld* world, PBArbiter* arbiter, PBContactConstraint* constraint, PBSolverBody* bodies) {
+  if(PBWorldIsLODSkipped(arbiter->body1, arbiter->body2)) {
+    constraint->solverIndex1 = arbiter->body1->solverIndex;
+    constraint->solverIndex2 = arbiter->body2->solverIndex;
+    constraint->numPoints = 0;
+    constraint->blockSolve = 0;
+    return;
+  }
   
-  return -1;
+  float dt = world->stepState.dt + PBMax(arbiter->body1->lodTime, arbiter->body2->lodTime);
+  PBArbiterPreStep(arbiter, constraint, bodies, dt > 0.0f ? 1.0f / dt : 0.0f, world->splitImpulse, world->stepState.solverFlags);
 }
 
-int PBWorldFindArbiter(PBWorld* world, PBBody* body1, PBBody* body2) {
-  if(world->arbiters->count == 0) {
-    return -1;
+// SOLVING
+
+// Labels every solver body with the index of its island's root body and
+// marks the islands that have constraints to solve. Returns their number.
+static int PBWorldBuildIslands(PBWorld* world, PBContactConstraint* constraints, int numConstraints, PBSolverBody* bodies) {
+  int numBodies = world->solverBodies->count;
+  PBArraySetCount(world->islandIds, numBodies);
+  PBArraySetCount(world->islands, numBodies);
+  int* islandIds = (int*)world->islandIds->first;
+  PBSolverIsland* islands = (PBSolverIsland*)world->islands->first;
+  
+  for(int i = 0; i < numBodies; i++) {
+    islandIds[i] = i;
+    islands[i].maxImpulse = 0.0f;
+    islands[i].solving = 0;
   }
   
-  PBBody* b1;
-  PBBody* b2;
-  if(body1 < body2) {
-    b1 = body1;
-    b2 = body2;
+  for(int i = 0; i < numConstraints; i++) {
+    PBWorldJoinIslands(islandIds, bodies, constraints[i].solverIndex1, constraints[i].solverIndex2);
   }
-  else {
-    b1 = body2;
-    b2 = body1;
+  for(int i = 0; i < world->joints->count; i++) {
+    PBJoint* joint = PBWorldGetJoint(world, i);
+    PBWorldJoinIslands(islandIds, bodies, joint->solverIndex1, joint->solverIndex2);
   }
   
-  for(int i = 0; i < world->arbiters->count; i++) {
-    PBArbiter* arbiter = (PBArbiter*)PBArrayGetItem(world->arbiters, i);
-    if(arbiter->body1 == b1 && arbiter->body2 == b2) {
-      return i;
+  for(int i = 0; i < numBodies; i++) {
+    islandIds[i] = PBWorldFindIsland(islandIds, i);
+  }
+  
+  int numIslands = 0;
+  for(int i = 0; i < numConstraints; i++) {
+    PBContactConstraint* constraint = constraints + i;
+    constraint->island = PBWorldGetIsland(islandIds, bodies, constraint->solverIndex1, constraint->solverIndex2);
+    if(!islands[constraint->island].solving) {
+      islands[constraint->island].solving = 1;
+      numIslands++;
+    }
+  }
+  for(int i = 0; i < world->joints->count; i++) {
+    PBJoint* joint = PBWorldGetJoint(world, i);
+    int island = PBWorldGetIsland(islandIds, bodies, joint->solverIndex1, joint->solverIndex2);
+    if(!islands[island].solving) {
+      islands[island].solving = 1;
+      numIslands++;
     }
   }
   
-  return -1;
+  return numIslands;
 }
 
-int PBWorldNumberOfContactsBetweenBodies(PBWorld* world, PBBody* body1, PBBody* body2) {
-  if(world->arbiters->count == 0) {
-    return 0;
+// Runs one velocity pass over the constraints. With a solver tolerance set,
+// islands stop once a pass changes no impulse by more than the tolerance,
+// after at least minIterations passes. Returns 1 while more passes are needed.
+static int PBWorldSolveVelocityPass(PBWorld* world, int pass) {
+  PBSolverBody* bodies = (PBSolverBody*)world->solverBodies->first;
+  PBContactConstraint* constraints = (PBContactConstraint*)world->contactConstraints->first;
+  int numConstraints = world->contactConstraints->count;
+  PBContactSolveFunction solve = world->stepState.solve;
+  world->stats.iterations = pass + 1;
+  
+  if(world->solverTolerance <= 0.0f) {
+    for(int j = 0; j < numConstraints; j++) {
+      solve(constraints + j, bodies);
+    }
+
+    for(int j = 0; j < world->joints->count; j++) {
+      PBJoint* joint = PBWorldGetJoint(world, j);
+      if(world->lodEnabled && PBWorldIsLODSkipped(joint->body1, joint->body2)) {
+        continue;
+      }
+      PBJointApplyImpulse(joint, bodies);
+    }
+    
+    return pass + 1 < world->iterations;
   }
   
-  PBBody* b1;
-  PBBody* b2;
-  if(body1 < body2) {
-    b1 = body1;
-    b2 = body2;
+  int* islandIds = (int*)world->islandIds->first;
+  PBSolverIsland* islands = (PBSolverIsland*)world->islands->first;
+  
+  for(int j = 0; j < numConstraints; j++) {
+    PBContactConstraint* constraint = constraints + j;
+    PBSolverIsland* island = islands + constraint->island;
+    if(!island->solving) {
+      continue;
+    }
+    
+    island->maxImpulse = PBMax(island->maxImpulse, solve(constraint, bodies));
   }
-  else {
-    b1 = body2;
-    b2 = body1;
+
+  for(int j = 0; j < world->joints->count; j++) {
+    PBJoint* joint = PBWorldGetJoint(world, j);
+    PBSolverIsland* island = islands + PBWorldGetIsland(islandIds, bodies, joint->solverIndex1, joint->solverIndex2);
+    if(!island->solving || (world->lodEnabled && PBWorldIsLODSkipped(joint->body1, joint->body2))) {
+      continue;
+    }
+    island->maxImpulse = PBMax(island->maxImpulse, PBJointApplyImpulse(joint, bodies));
   }
   
-  for(int i = 0; i < world->arbiters->count; i++) {
-    PBArbiter* arbiter = (PBArbiter*)PBArrayGetItem(world->arbiters, i);
-    if(arbiter->body1 == b1 && arbiter->body2 == b2) {
-      return arbiter->numContacts;
+  // Retire converged islands. Only roots carry island state.
+  for(int j = 0; j < world->islands->count; j++) {
+    PBSolverIsland* island = islands + j;
+    if(!island->solving) {
+      continue;
     }
+    if(pass + 1 >= world->minIterations && island->maxImpulse <= world->solverTolerance) {
+      island->solving = 0;
+      world->stepState.numSolving--;
+    }
+    island->maxImpulse = 0.0f;
   }
   
-  return 0;
+  return world->stepState.numSolving > 0 && pass + 1 < world->iterations;
 }
 
-void PBWorldStep(PBWorld* world, float dt) {
-  float inv_dt = dt > 0.0f ? 1.0f / dt : 0.0f;
+// REORDERING
 
-  // Determine overlapping bodies and update contact points.
-  PBWorldBroadphase(world);
+#ifndef PB_REORDER_WINDOW
+#define PB_REORDER_WINDOW 16  // body index distance counted as far apart
+#endif
 
-  // Integrate forces.
-  for(int i = 0; i < world->bodies->count; ++i) {
-    PBBody* b = PBWorldGetBody(world, i);
+typedef struct {
+  uint64_t key;
+  int index;
+} PBWorldSortKey;
+
+static int PBWorldCompareSortKeys(const void* a, const void* b) {
+  const PBWorldSortKey* k1 = (const PBWorldSortKey*)a;
+  const PBWorldSortKey* k2 = (const PBWorldSortKey*)b;
+  if(k1->key != k2->key) {
+    return k1->key < k2->key ? -1 : 1;
+  }
+  return k1->index - k2->index;
+}
+
+// Spreads the low 16 bits of x over the even bits.
+static uint32_t PBWorldSpreadBits(uint32_t x) {
+  x &= 0xffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+static uint64_t PBWorldGetPairKey(PBBody* body1, PBBody* body2) {
+  uint32_t i1 = (uint32_t)body1->solverIndex;
+  uint32_t i2 = (uint32_t)body2->solverIndex;
+  return i1 < i2 ? ((uint64_t)i1 << 32) | i2 : ((uint64_t)i2 << 32) | i1;
+}
 
-    if(b->invMass == 0.0f) {
+// Sorts an array of pointers by keys[i].key, using scratch for the copy.
+static void PBWorldPermute(PBArray* array, PBWorldSortKey* keys, void** scratch) {
+  int count = array->count;
+  if(count < 2) {
+    return;
+  }
+  void** items = (void**)array->first;
+  qsort(keys, count, sizeof(PBWorldSortKey), PBWorldCompareSortKeys);
+  memcpy(scratch, items, count * sizeof(void*));
+  for(int i = 0; i < count; i++) {
+    items[i] = scratch[keys[i].index];
+  }
+}
+
+// Fraction of contacts between dynamic bodies whose indices are more than
+// PB_REORDER_WINDOW apart. Body indices must be current.
+static float PBWorldGetFragmentation(PBWorld* world) {
+  int numDynamic = 0;
+  int numFar = 0;
+  for(int i = 0; i < world->arbiters->count; i++) {
+    PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+    if(arbiter->body1->invMass == 0.0f || arbiter->body2->invMass == 0.0f) {
       continue;
     }
+    int distance = arbiter->body1->solverIndex - arbiter->body2->solverIndex;
+    numFar += distance > PB_REORDER_WINDOW || distance < -PB_REORDER_WINDOW;
+    numDynamic++;
+  }
+  return numDynamic > 0 ? (float)numFar / numDynamic : 0.0f;
+}
 
-    b->velocity = PBVec2Add(b->velocity, PBVec2MultF(PBVec2Add(world->gravity, PBVec2MultF(b->force, b->invMass)), dt));
-    b->angularVelocity += dt * b->invI * b->torque;
+// Sorts bodies along a Morton curve through their positions, then arbiters
+// and joints by the indices of their bodies. The solver bodies and contact
+// constraints built from them each step are then laid out so neighbouring
+// constraints touch neighbouring memory. Only the pointer arrays move, the
+// bodies themselves stay where they were allocated.
+static void PBWorldSortSpatially(PBWorld* world) {
+  int numBodies = world->bodies->count;
+  int numArbiters = world->arbiters->count;
+  int numJoints = world->joints->count;
+  int maxCount = numBodies;
+  maxCount = numArbiters > maxCount ? numArbiters : maxCount;
+  maxCount = numJoints > maxCount ? numJoints : maxCount;
+  if(maxCount < 2) {
+    return;
+  }
+  
+  PBWorldSortKey* keys = pb_alloc(maxCount * sizeof(PBWorldSortKey));
+  void** scratch = pb_alloc(maxCount * sizeof(void*));
+  
+  PBVec2 lower = PBVec2Make(FLT_MAX, FLT_MAX);
+  PBVec2 upper = PBVec2Make(-FLT_MAX, -FLT_MAX);
+  for(int i = 0; i < numBodies; i++) {
+    PBVec2 p = PBWorldGetBody(world, i)->position;
+    lower = PBVec2Make(PBMin(lower.x, p.x), PBMin(lower.y, p.y));
+    upper = PBVec2Make(PBMax(upper.x, p.x), PBMax(upper.y, p.y));
+  }
+  
+  // Quantize positions to 16 bits per axis over the bodies' bounds.
+  float scaleX = upper.x > lower.x ? 65535.0f / (upper.x - lower.x) : 0.0f;
+  float scaleY = upper.y > lower.y ? 65535.0f / (upper.y - lower.y) : 0.0f;
+  for(int i = 0; i < numBodies; i++) {
+    PBVec2 p = PBWorldGetBody(world, i)->position;
+    uint32_t x = (uint32_t)((p.x - lower.x) * scaleX);
+    uint32_t y = (uint32_t)((p.y - lower.y) * scaleY);
+    keys[i].key = PBWorldSpreadBits(x) | (PBWorldSpreadBits(y) << 1);
+    keys[i].index = i;
+  }
+  PBWorldPermute(world->bodies, keys, scratch);
+  
+  for(int i = 0; i < numBodies; i++) {
+    PBBody* body = PBWorldGetBody(world, i);
+    body->index = i;
+    body->solverIndex = i;
+  }
+  
+  for(int i = 0; i < numArbiters; i++) {
+    PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+    keys[i].key = PBWorldGetPairKey(arbiter->body1, arbiter->body2);
+    keys[i].index = i;
   }
+  PBWorldPermute(world->arbiters, keys, scratch);
+  for(int i = 0; i < numArbiters; i++) {
+    PBWorldGetArbiter(world, i)->index = i;
+  }
+  
+  for(int i = 0; i < numJoints; i++) {
+    PBJoint* joint = PBWorldGetJoint(world, i);
+    keys[i].key = PBWorldGetPairKey(joint->body1, joint->body2);
+    keys[i].index = i;
+  }
+  PBWorldPermute(world->joints, keys, scratch);
+  for(int i = 0; i < numJoints; i++) {
+    PBWorldGetJoint(world, i)->index = i;
+  }
+  
+  pb_free(keys);
+  pb_free(scratch);
+  world->reorderStep = 0;
+  world->orderGeneration++;
+}
+
+// Call between steps.
+void PBWorldReorder(PBWorld* world) {
+  if(PBWorldIsStepping(world)) {
+    pb_log("playbox: can't reorder during a step");
+    return;
+  }
+  PBWorldSortSpatially(world);
+}
+
+// Called at the start of a step with body indices current.
+static int PBWorldShouldReorder(PBWorld* world) {
+  world->reorderStep++;
+  if(world->reorderInterval > 0 && world->reorderStep >= world->reorderInterval) {
+    return 1;
+  }
+  return world->reorderThreshold > 0.0f && PBWorldGetFragmentation(world) > world->reorderThreshold;
+}
+
+// STATE HASH
+
+#define PB_STATE_HASH_SEED 0x9747b28cu
 
-  // Perform pre-steps.
+// One word of MurmurHash3's body.
+static uint32_t PBWorldHashFloat(uint32_t h, float f) {
+  uint32_t k;
+  memcpy(&k, &f, sizeof(k));
+  k *= 0xcc9e2d51u;
+  k = (k << 15) | (k >> 17);
+  k *= 0x1b873593u;
+  h ^= k;
+  h = (h << 13) | (h >> 19);
+  return h * 5u + 0xe6546b64u;
+}
+
+// Folds the bodies' poses and velocities and the arbiters' impulses into
+// the running hash. Both arrays are in the same order on every machine
+// that adds the same bodies in the same order.
+static void PBWorldUpdateStateHash(PBWorld* world) {
+  uint32_t h = world->stateHash;
+  
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBBody* b = PBWorldGetBody(world, i);
+    h = PBWorldHashFloat(h, b->position.x);
+    h = PBWorldHashFloat(h, b->position.y);
+    h = PBWorldHashFloat(h, b->rotation);
+    h = PBWorldHashFloat(h, b->velocity.x);
+    h = PBWorldHashFloat(h, b->velocity.y);
+    h = PBWorldHashFloat(h, b->angularVelocity);
+  }
+  
   for(int i = 0; i < world->arbiters->count; i++) {
-    PBArbiter* arbiter = (PBArbiter*)PBArrayGetItem(world->arbiters, i);
-    PBArbiterPreStep(arbiter, inv_dt);
+    PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+    for(int j = 0; j < arbiter->numContacts; j++) {
+      h = PBWorldHashFloat(h, arbiter->contacts[j].Pn);
+      h = PBWorldHashFloat(h, arbiter->contacts[j].Pt);
+    }
   }
+  
+  world->stateHash = h;
+}
 
-  for(int i = 0; i < world->joints->count; i++) {
-    PBJoint* joint = PBWorldGetJoint(world, i);
-    PBJointPreStep(joint, inv_dt);
+// Starts the hash over from a fixed seed. Machines that enable it on the
+// same step of the same simulation get the same hash after every step.
+void PBWorldSetStateHash(PBWorld* world, int enabled) {
+  world->stateHashEnabled = enabled;
+  world->stateHash = PB_STATE_HASH_SEED;
+}
+
+uint32_t PBWorldGetStateHash(PBWorld* world) {
+  return world->stateHash;
+}
+
+// STEPPING
+
+// Checked every PB_STEP_SLICE_SIZE work items while a budgeted step runs.
+static int PBWorldIsOutOfTime(PBWorld* world, int workDone) {
+  PBWorldStepState* state = &world->stepState;
+  if(!state->budgeted || workDone % PB_STEP_SLICE_SIZE != 0) {
+    return 0;
+  }
+  return (int)(pb_milliseconds() - state->startTime) >= state->budget;
+}
+
+static int PBWorldComparePairs(const void* a, const void* b) {
+  const PBBodyPair* p1 = (const PBBodyPair*)a;
+  const PBBodyPair* p2 = (const PBBodyPair*)b;
+  int a1 = p1->body1->solverIndex, a2 = p1->body2->solverIndex;
+  int b1 = p2->body1->solverIndex, b2 = p2->body2->solverIndex;
+  int aMin = a1 < a2 ? a1 : a2, aMax = a1 < a2 ? a2 : a1;
+  int bMin = b1 < b2 ? b1 : b2, bMax = b1 < b2 ? b2 : b1;
+  if(aMin != bMin) {
+    return aMin - bMin;
   }
+  return aMax - bMax;
+}
 
-  // Perform iterations
-  for(int i = 0; i < world->iterations; i++) {
-    for(int j = 0; j < world->arbiters->count; j++) {
-      PBArbiter* arbiter = (PBArbiter*)PBArrayGetItem(world->arbiters, j);
-      PBArbiterApplyImpulse(arbiter);
+// Work done once when a stage starts, before any of its items.
+static void PBWorldBeginStage(PBWorld* world, PBWorldStepStage stage) {
+  PBWorldStepState* state = &world->stepState;
+  float dt = state->dt;
+  state->stage = stage;
+  state->index = 0;
+  
+  switch(stage) {
+    case PBWorldStepStagePairs: {
+      // The tree is current: Integrate synchronized it at the end of the
+      // last step and PBWorldUpdateBody covers moves made since.
+      PBArraySetCount(world->pairs, 0);
+      
+      // Indices order the new pairs below.
+      for(int i = 0; i < world->bodies->count; i++) {
+        PBWorldGetBody(world, i)->solverIndex = i;
+      }
+      
+      if((world->reorderInterval > 0 || world->reorderThreshold > 0.0f) && PBWorldShouldReorder(world)) {
+        PBWorldSortSpatially(world);
+        world->stats.reordered = 1;
+      }
+      
+      if(world->lodEnabled) {
+        PBWorldUpdateLOD(world);
+      }
+      break;
     }
+    
+    case PBWorldStepStageNewPairs: {
+      // Tree traversal order depends on the tree's history. Sorting keeps
+      // arbiter order, and so the solution, the same after PBWorldRestore.
+      if(world->pairs->count > 1) {
+        qsort(world->pairs->first, world->pairs->count, sizeof(PBBodyPair), PBWorldComparePairs);
+      }
+      break;
+    }
+    
+    case PBWorldStepStagePreStep: {
+      // Integrate forces.
+      for(int i = 0; i < world->bodies->count; ++i) {
+        PBBody* b = PBWorldGetBody(world, i);
 
-    for(int j = 0; j < world->joints->count; j++) {
-      PBJoint* joint = PBWorldGetJoint(world, j);
-      PBJointApplyImpulse(joint);
+        if(b->invMass == 0.0f || b->lodSkipped) {
+          continue;
+        }
+
+        float bodyDt = dt + b->lodTime;
+        b->velocity = PBVec2Add(b->velocity, PBVec2MultF(PBVec2Add(world->gravity, PBVec2MultF(b->force, b->invMass)), bodyDt));
+        b->angularVelocity += bodyDt * b->invI * b->torque;
+      }
+
+      // Copy the state the iterations touch into the solver body array.
+      PBArraySetCount(world->solverBodies, world->bodies->count);
+      PBSolverBody* solverBodies = (PBSolverBody*)world->solverBodies->first;
+      for(int i = 0; i < world->bodies->count; i++) {
+        PBBody* b = PBWorldGetBody(world, i);
+        PBSolverBody* sb = solverBodies + i;
+        b->solverIndex = i;
+        sb->velocity = b->velocity;
+        sb->angularVelocity = b->angularVelocity;
+        sb->invMass = b->lodSkipped ? 0.0f : b->invMass;
+        sb->invI = b->lodSkipped ? 0.0f : b->invI;
+        sb->biasVelocity = PBVec2MakeEmpty();
+        sb->biasAngularVelocity = 0.0f;
+      }
+      
+      // Set here rather than in PBJointPreStep, which skipped joints don't
+      // reach but islands and the iterations still read them.
+      for(int i = 0; i < world->joints->count; i++) {
+        PBJoint* joint = PBWorldGetJoint(world, i);
+        joint->solverIndex1 = joint->body1->solverIndex;
+        joint->solverIndex2 = joint->body2->solverIndex;
+      }
+      
+      // Each arbiter emits its constraint at the same index.
+      PBArraySetCount(world->contactConstraints, world->arbiters->count);
+      break;
     }
+    
+    case PBWorldStepStageIterations: {
+      if(world->solverTolerance > 0.0f) {
+        PBContactConstraint* constraints = (PBContactConstraint*)world->contactConstraints->first;
+        PBSolverBody* solverBodies = (PBSolverBody*)world->solverBodies->first;
+        state->numSolving = PBWorldBuildIslands(world, constraints, world->contactConstraints->count, solverBodies);
+        world->stats.islands = state->numSolving;
+      }
+      else {
+        state->numSolving = 0;
+      }
+      break;
+    }
+    
+    default:
+      break;
   }
+}
 
-  // Integrate Velocities
+static void PBWorldIntegrate(PBWorld* world) {
+  float dt = world->stepState.dt;
+  PBSolverBody* solverBodies = (PBSolverBody*)world->solverBodies->first;
+  PBContactConstraint* constraints = (PBContactConstraint*)world->contactConstraints->first;
+  int numConstraints = world->contactConstraints->count;
+  
+  // Solve penetration separately so it doesn't feed back into velocity.
+  if(world->splitImpulse) {
+    for(int i = 0; i < world->iterations; i++) {
+      for(int j = 0; j < numConstraints; j++) {
+        PBContactConstraintApplyPositionImpulse(constraints + j, solverBodies);
+      }
+    }
+  }
+  
+  // Keep the impulses for warm starting.
+  for(int i = 0; i < numConstraints; i++) {
+    PBArbiterStoreImpulses(PBWorldGetArbiter(world, i), constraints + i);
+  }
+
+  // Write velocities back and integrate them.
+  int numBullets = 0;
   for(int i = 0; i < world->bodies->count; i++) {
     PBBody* b = PBWorldGetBody(world, i);
+    PBSolverBody* sb = solverBodies + i;
+    
+    // Skipped bodies keep their state and forces for the step that simulates them.
+    if(b->lodSkipped) {
+      continue;
+    }
+    
+    // Time skipped at a reduced level of detail is made up here.
+    float bodyDt = dt + b->lodTime;
+    
+    if(b->invMass != 0.0f || b->invI != 0.0f) {
+      b->velocity = sb->velocity;
+      b->angularVelocity = sb->angularVelocity;
+    }
+    
+    // Bias velocities move the body this step and are then discarded.
+    if(world->splitImpulse) {
+      b->position = PBVec2Add(b->position, PBVec2MultF(sb->biasVelocity, bodyDt));
+      b->rotation += bodyDt * sb->biasAngularVelocity;
+    }
+    
+    // Bullets move after everything else so they sweep against final positions.
+    if(b->bullet && b->invMass != 0.0f) {
+      numBullets++;
+    }
+    else {
+      b->position = PBVec2Add(b->position, PBVec2MultF(b->velocity, bodyDt));
+      b->lodTime = 0.0f;
+    }
     
-    b->position = PBVec2Add(b->position, PBVec2MultF(b->velocity, dt));
-    b->rotation += dt * b->angularVelocity;
+    if(b->fixedRotation) {
+      b->angularVelocity = 0.0f;
+    }
+    else {
+      b->rotation += bodyDt * b->angularVelocity;
+    }
 
     b->force.x = 0.0f;
     b->force.y = 0.0f;
     b->torque = 0.0f;
   }
+  
+  // Keep the tree current for queries made between steps.
+  PBWorldSynchronizeProxies(world);
+  
+  for(int i = 0; i < world->bodies->count && numBullets > 0; i++) {
+    PBBody* b = PBWorldGetBody(world, i);
+    if(b->bullet && b->invMass != 0.0f && !b->lodSkipped) {
+      PBWorldAdvanceBullet(world, b, dt + b->lodTime);
+      b->lodTime = 0.0f;
+      PBWorldUpdateBody(world, b);
+      numBullets--;
+    }
+  }
 }
 
-void PBWorldBroadphase(PBWorld* world) {
-  // O(n^2) broad-phase
-  for(int i = 0; i < world->bodies->count; i++) {
-    PBBody* bi = PBWorldGetBody(world, i);
-    
-    for(int j = i + 1; j < world->bodies->count; j++) {
-      PBBody* bj = PBWorldGetBody(world, j);
+typedef struct {
+  PBWorld* world;
+  PBBody* body;
+} PBWorldPairQuery;
+
+static int PBWorldPairQueryCallback(int proxyId, void* context) {
+  PBWorldPairQuery* query = (PBWorldPairQuery*)context;
+  PBBody* body = query->body;
+  PBBody* other = (PBBody*)PBDynamicTreeGetUserData(query->world->tree, proxyId);
   
-      if(bi->invMass == 0.0f && bj->invMass == 0.0f) {
-        continue;
-      }
+  // Dynamic pairs are reported once, by the body with the lower proxy id.
+  // Static and skipped bodies never query so their pairs come from the other side.
+  if(other == body || (other->invMass != 0.0f && !other->lodSkipped && other->proxyId < body->proxyId)) {
+    return 1;
+  }
+  
+  // Pairs that already have an arbiter are updated separately.
+  if(PBWorldFindArbiter(query->world, body, other) != NULL) {
+    return 1;
+  }
+  
+  // Order by index rather than address so the result doesn't depend on the allocator.
+  int first = body->solverIndex < other->solverIndex;
+  PBBodyPair pair = { .body1 = first ? body : other, .body2 = first ? other : body };
+  PBArrayAppendItem(query->world->pairs, &pair);
+  return 1;
+}
+
+// Run the narrowphase for a pair. Returns 0 and destroys the arbiter if the bodies no longer touch.
+static int PBWorldCollidePair(PBWorld* world, PBArbiter* arb, PBBody* b1, PBBody* b2, int reuseManifolds) {
+  int warmStarting = world->stepState.solverFlags & PBSolverWarmStarting;
+  
+  if(reuseManifolds && arb != NULL) {
+    if(PBArbiterReuseManifold(arb, world->manifoldReuseLinearTolerance, world->manifoldReuseAngularTolerance, warmStarting)) {
+      world->stats.narrowphaseSkipped++;
+      return 1;
+    }
+  }
+  
+  PBContact contacts[MAX_ARBITER_POINTS];
+  memset(contacts, 0, sizeof(contacts));
+  int numContacts = PBCollide(contacts, b1, b2);
+  world->stats.narrowphaseCalls++;
+  
+  if(numContacts > 0) {
+    if(arb == NULL) {
+      PBWorldAddArbiter(world, PBArbiterCreateWithContacts(b1, b2, contacts, numContacts));
+    }
+    else {
+      PBArbiterUpdate(arb, contacts, numContacts, warmStarting);
+    }
+    return 1;
+  }
+  
+  if(arb != NULL) {
+    PBWorldDestroyArbiter(world, arb);
+  }
+  return 0;
+}
 
-      PBArbiter* new_arbiter = PBArbiterCreate(bi, bj);
-      int existing_arbiter_i = PBWorldFindArbiter(world, bi, bj);
+// Advances the current stage from stepState.index. Returns 1 when the stage
+// is finished and 0 when the time budget ran out first.
+static int PBWorldRunStage(PBWorld* world) {
+  PBWorldStepState* state = &world->stepState;
+  int reuseManifolds = world->manifoldReuseLinearTolerance > 0.0f && world->manifoldReuseAngularTolerance > 0.0f;
+  int workDone = 0;
+  
+  switch(state->stage) {
+    case PBWorldStepStagePairs: {
+      // Find body pairs whose fat AABBs overlap and have no arbiter yet.
+      while(state->index < world->bodies->count) {
+        PBBody* body = PBWorldGetBody(world, state->index++);
+        if(body->invMass != 0.0f && !body->lodSkipped) {
+          PBWorldPairQuery query = { .world = world, .body = body };
+          PBDynamicTreeQuery(world->tree, PBDynamicTreeGetFatAABB(world->tree, body->proxyId), PBWorldPairQueryCallback, &query);
+        }
+        if(PBWorldIsOutOfTime(world, ++workDone)) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+    
+    case PBWorldStepStageNarrowphase: {
+      // Update existing arbiters. Destroying one swaps the last arbiter into its slot.
+      while(state->index < world->arbiters->count) {
+        PBArbiter* arb = PBWorldGetArbiter(world, state->index);
+        PBAABB fat1 = PBDynamicTreeGetFatAABB(world->tree, arb->body1->proxyId);
+        PBAABB fat2 = PBDynamicTreeGetFatAABB(world->tree, arb->body2->proxyId);
+        
+        if(PBWorldIsLODSkipped(arb->body1, arb->body2)) {
+          // Neither body moved, so the contacts still hold.
+          world->stats.narrowphaseSkipped++;
+          state->index++;
+        }
+        else if(!PBAABBOverlaps(fat1, fat2)) {
+          PBWorldDestroyArbiter(world, arb);
+        }
+        else if(PBWorldCollidePair(world, arb, arb->body1, arb->body2, reuseManifolds)) {
+          state->index++;
+        }
+        
+        if(PBWorldIsOutOfTime(world, ++workDone)) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+    
+    case PBWorldStepStageNewPairs: {
+      // Create arbiters for new pairs that touch.
+      while(state->index < world->pairs->count) {
+        PBBodyPair* pair = (PBBodyPair*)PBArrayGetItem(world->pairs, state->index++);
+        PBWorldCollidePair(world, NULL, pair->body1, pair->body2, reuseManifolds);
+        if(PBWorldIsOutOfTime(world, ++workDone)) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+    
+    case PBWorldStepStagePreStep: {
+      float inv_dt = state->dt > 0.0f ? 1.0f / state->dt : 0.0f;
+      PBSolverBody* solverBodies = (PBSolverBody*)world->solverBodies->first;
+      PBContactConstraint* constraints = (PBContactConstraint*)world->contactConstraints->first;
+      int numArbiters = world->contactConstraints->count;
       
-      if(new_arbiter->numContacts > 0) {
-        if(existing_arbiter_i == -1) {
-          PBArrayAppendItem(world->arbiters, new_arbiter);
+      while(state->index < numArbiters + world->joints->count) {
+        int i = state->index++;
+        if(i < numArbiters) {
+          PBArbiter* arbiter = PBWorldGetArbiter(world, i);
+          if(world->lodEnabled) {
+            PBWorldPreStepLODArbiter(world, arbiter, constraints + i, solverBodies);
+          }
+          else {
+            PBArbiterPreStep(arbiter, constraints + i, solverBodies, inv_dt, world->splitImpulse, state->solverFlags);
+          }
         }
         else {
-          PBArbiter* arb = (PBArbiter*)PBArrayGetItem(world->arbiters, existing_arbiter_i);
-          PBArbiterUpdate(arb, new_arbiter->contacts, new_arbiter->numContacts);
+          PBJoint* joint = PBWorldGetJoint(world, i - numArbiters);
+          if(!world->lodEnabled || !PBWorldIsLODSkipped(joint->body1, joint->body2)) {
+            PBJointPreStep(joint, solverBodies, inv_dt, state->solverFlags);
+          }
+        }
+        if(PBWorldIsOutOfTime(world, ++workDone)) {
+          return 0;
         }
       }
-      else {
-        if(existing_arbiter_i != -1) {
-          PBArrayRemoveItemAt(world->arbiters, existing_arbiter_i);
+      return 1;
+    }
+    
+    case PBWorldStepStageIterations: {
+      // Passes are the unit of work here, so check the clock after every one.
+      if(world->iterations <= 0 || (world->solverTolerance > 0.0f && state->numSolving == 0)) {
+        return 1;
+      }
+      while(PBWorldSolveVelocityPass(world, state->index++)) {
+        if(state->budgeted && (int)(pb_milliseconds() - state->startTime) >= state->budget) {
+          return 0;
         }
       }
-      
-      PBArbiterFree(new_arbiter);
+      return 1;
+    }
+    
+    case PBWorldStepStageIntegrate: {
+      PBWorldIntegrate(world);
+      if(world->stateHashEnabled) {
+        PBWorldUpdateStateHash(world);
+      }
+      return 1;
+    }
+    
+    default:
+      return 1;
+  }
+}
+
+static int PBWorldContinueStep(PBWorld* world) {
+  PBWorldStepState* state = &world->stepState;
+  
+  while(state->stage != PBWorldStepStageIdle) {
+    if(!PBWorldRunStage(world)) {
+      return 0;
     }
+    
+    PBWorldStepStage next = state->stage + 1;
+    PBWorldBeginStage(world, next < PBWorldStepStageCount ? next : PBWorldStepStageIdle);
+  }
+  
+  PBWorldApplyBodyEdits(world);
+  
+  return 1;
+}
+
+static void PBWorldBeginStep(PBWorld* world, float dt) {
+  memset(&world->stats, 0, sizeof(PBWorldStats));
+  
+  // Apply queued adds and removes in one pass. Later changes stay queued
+  // until the step finishes.
+  PBWorldFlushCommands(world);
+  
+  world->stepState.dt = dt;
+  world->stepState.solverFlags = world->solverFlags;
+  world->stepState.solve = PBContactConstraintGetSolveFunction(world->solverFlags, world->blockSolver);
+  PBWorldBeginStage(world, PBWorldStepStagePairs);
+}
+
+void PBWorldStep(PBWorld* world, float dt) {
+  // Finish a step left over from PBWorldStepWithBudget first.
+  world->stepState.budgeted = 0;
+  PBWorldContinueStep(world);
+  
+  PBWorldBeginStep(world, dt);
+  PBWorldContinueStep(world);
+}
+
+// Runs the current step, or starts a new one with dt, until it finishes or
+// about milliseconds have passed. Returns 1 if a step finished. While a step
+// is unfinished the bodies keep their previous poses, adds and removes are
+// queued as in deferred mode, and changes made with PBWorldSetBodyVelocity
+// and the like wait for the step to finish. dt is only read when a new step
+// starts.
+int PBWorldStepWithBudget(PBWorld* world, float dt, int milliseconds) {
+  PBWorldStepState* state = &world->stepState;
+  state->budgeted = 1;
+  state->budget = milliseconds;
+  state->startTime = pb_milliseconds();
+  
+  if(state->stage == PBWorldStepStageIdle) {
+    PBWorldBeginStep(world, dt);
+  }
+  
+  int finished = PBWorldContinueStep(world);
+  state->budgeted = 0;
+  return finished;
+}
+
+int PBWorldIsStepping(PBWorld* world) {
+  return world->stepState.stage != PBWorldStepStageIdle;
+}
+
+// Broadphase and narrowphase only, outside of a step.
+void PBWorldBroadphase(PBWorld* world) {
+  PBWorldStepState* state = &world->stepState;
+  if(state->stage != PBWorldStepStageIdle) {
+    return;
+  }
+  
+  state->budgeted = 0;
+  for(PBWorldStepStage stage = PBWorldStepStagePairs; stage <= PBWorldStepStageNewPairs; stage++) {
+    PBWorldBeginStage(world, stage);
+    PBWorldRunStage(world);
   }
+  state->stage = PBWorldStepStageIdle;
 }
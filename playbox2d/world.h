@@ -6,15 +6,172 @@
 #include "arbiter.h"
 #include "maths.h"
 #include "array.h"
+#include "broadphase.h"
+#include "solver.h"
+#include <stdint.h>
+
+#ifndef PB_MAX_BULLET_SUB_STEPS
+#define PB_MAX_BULLET_SUB_STEPS 4
+#endif
+
+// Distance bullets stop short of the surface they hit
+#ifndef PB_BULLET_SLOP
+#define PB_BULLET_SLOP 0.005f
+#endif
+
+// Work items between clock checks in PBWorldStepWithBudget
+#ifndef PB_STEP_SLICE_SIZE
+#define PB_STEP_SLICE_SIZE 16
+#endif
+
+struct PBScene;
+
+typedef struct {
+  PBBody* body1;
+  PBBody* body2;
+} PBBodyPair;
+
+typedef enum {
+  PBWorldStepStageIdle = 0,
+  PBWorldStepStagePairs,
+  PBWorldStepStageNarrowphase,
+  PBWorldStepStageNewPairs,
+  PBWorldStepStagePreStep,
+  PBWorldStepStageIterations,
+  PBWorldStepStageIntegrate,
+  PBWorldStepStageCount
+} PBWorldStepStage;
+
+// Progress of the current step, so a budgeted step can resume where it stopped.
+typedef struct {
+  PBWorldStepStage stage;
+  int index;  // next work item in the stage
+  float dt;
+  int numSolving;  // islands still iterating
+  int budgeted;
+  int budget;  // milliseconds
+  unsigned int startTime;
+  
+  // Solver configuration the step started with
+  int solverFlags;
+  PBContactSolveFunction solve;
+} PBWorldStepState;
+
+typedef struct {
+  int narrowphaseCalls;
+  int narrowphaseSkipped;  // existing manifolds reused instead of running PBCollide
+  int bulletSubSteps;  // bullet sweeps that hit something and resumed from the time of impact
+  int iterations;  // velocity passes actually run
+  int islands;  // islands with constraints, when solving to a tolerance
+  int lodSkipped;  // bodies not simulated because of their level of detail
+  int reordered;  // 1 if bodies, arbiters and joints were reordered before this step
+} PBWorldStats;
+
+typedef enum {
+  PBWorldCommandAddBody,
+  PBWorldCommandRemoveBody,
+  PBWorldCommandAddJoint,
+  PBWorldCommandRemoveJoint
+} PBWorldCommandType;
+
+typedef struct {
+  PBWorldCommandType type;
+  void* object;
+} PBWorldCommand;
+
+typedef enum {
+  PBWorldBodyEditSetVelocity,
+  PBWorldBodyEditSetAngularVelocity,
+  PBWorldBodyEditSetForce,
+  PBWorldBodyEditSetTorque,
+  PBWorldBodyEditAddForce
+} PBWorldBodyEditType;
+
+typedef struct {
+  PBWorldBodyEditType type;
+  PBBody* body;
+  PBVec2 v;
+  float f;
+} PBWorldBodyEdit;
 
 typedef struct {
   PBVec2 gravity;
   int iterations;
   float pixelScale;
   
+  // Manifold reuse, disabled while either tolerance is zero
+  float manifoldReuseLinearTolerance;
+  float manifoldReuseAngularTolerance;
+  
   PBArray* bodies;
   PBArray* joints;
   PBArray* arbiters;
+  
+  // Broadphase tree of body AABBs and the new pairs it found this step
+  PBDynamicTree* tree;
+  PBArray* pairs;
+  
+  // Dense body velocities and inverse masses for the constraint iterations
+  PBArray* solverBodies;
+  PBArray* contactConstraints;  // parallel to arbiters, rebuilt every step
+  PBArray* islandIds;  // root solver body of each body's island
+  PBArray* islands;  // PBSolverIsland per root
+  
+  // When deferred, adds and removes are queued and applied at the start of the next step
+  int deferred;
+  PBArray* commands;
+  
+  // Velocity and force changes made while a step is unfinished. The step
+  // overwrites both, so they are applied when it finishes.
+  PBArray* bodyEdits;
+  
+  // Islands stop iterating once no impulse changes by more than the
+  // tolerance in a pass. Disabled while the tolerance is zero.
+  float solverTolerance;
+  int minIterations;
+  
+  // Solve the normal impulses of two-point manifolds together
+  int blockSolver;
+  
+  // Resolve penetration with separate bias velocities instead of Baumgarte
+  int splitImpulse;
+  
+  // PBSolverFlags, PB_SOLVER_DEFAULT_FLAGS unless changed
+  int solverFlags;
+  
+  // Sweep bullets against dynamic bodies as well as static ones
+  int bulletsHitDynamic;
+  
+  // Level of detail. Once a focus is set, bodies further than
+  // lodReducedDistance from it are simulated every lodInterval steps and
+  // bodies further than lodFrozenDistance are not simulated at all.
+  int lodEnabled;
+  PBAABB lodFocus;
+  float lodReducedDistance;
+  float lodFrozenDistance;
+  int lodInterval;
+  int lodStep;
+  
+  // Spatial reordering, see PBWorldSetReorder
+  int reorderInterval;
+  float reorderThreshold;
+  int reorderStep;
+  
+  // Bumped whenever bodies or joints are added, removed or reordered, so
+  // snapshots can tell that their records no longer line up
+  uint32_t orderGeneration;
+  
+  PBWorldStepState stepState;
+  
+  // Rolling hash of the state after each step, see PBWorldSetStateHash
+  int stateHashEnabled;
+  uint32_t stateHash;
+  
+  // Bodies and joints loaded with PBSceneLoad, freed with the world
+  struct PBScene* scene;
+  
+  // Counters for the last step
+  PBWorldStats stats;
 } PBWorld;
 
 extern PBWorld* PBWorldCreate(PBVec2 gravity, int iterations);
@@ -24,9 +181,34 @@ extern void PBWorldAddBody(PBWorld* world, PBBody* body);
 extern void PBWorldRemoveBody(PBWorld* world, PBBody* body);
 extern void PBWorldAddJoint(PBWorld* world, PBJoint* joint);
 extern void PBWorldRemoveJoint(PBWorld* world, PBJoint* joint);
+extern void PBWorldUpdateBody(PBWorld* world, PBBody* body);
+extern void PBWorldSetBodyVelocity(PBWorld* world, PBBody* body, PBVec2 velocity);
+extern void PBWorldSetBodyAngularVelocity(PBWorld* world, PBBody* body, float angularVelocity);
+extern void PBWorldSetBodyForce(PBWorld* world, PBBody* body, PBVec2 force);
+extern void PBWorldSetBodyTorque(PBWorld* world, PBBody* body, float torque);
+extern void PBWorldAddBodyForce(PBWorld* world, PBBody* body, PBVec2 force);
 extern void PBWorldClear(PBWorld* world);
+extern void PBWorldSetDeferred(PBWorld* world, int deferred);
+extern void PBWorldFlushCommands(PBWorld* world);
+extern void PBWorldSetManifoldReuseTolerance(PBWorld* world, float linearTolerance, float angularTolerance);
+extern void PBWorldSetSolverTolerance(PBWorld* world, float tolerance, int minIterations);
+extern void PBWorldSetBlockSolver(PBWorld* world, int blockSolver);
+extern void PBWorldSetSplitImpulse(PBWorld* world, int splitImpulse);
+extern void PBWorldSetSolverFlags(PBWorld* world, int flags);
+extern void PBWorldSetBulletsHitDynamic(PBWorld* world, int hitDynamic);
+extern void PBWorldSetLODFocus(PBWorld* world, PBAABB focus);
+extern void PBWorldClearLODFocus(PBWorld* world);
+extern void PBWorldSetLODDistances(PBWorld* world, float reducedDistance, float frozenDistance, int interval);
+extern void PBWorldSetReorder(PBWorld* world, int interval, float threshold);
+extern void PBWorldReorder(PBWorld* world);
+extern void PBWorldSetStateHash(PBWorld* world, int enabled);
+extern uint32_t PBWorldGetStateHash(PBWorld* world);
 extern void PBWorldStep(PBWorld* world, float dt);
+extern int PBWorldStepWithBudget(PBWorld* world, float dt, int milliseconds);
+extern int PBWorldIsStepping(PBWorld* world);
 extern void PBWorldBroadphase(PBWorld* world);
+extern PBArbiter* PBWorldGetArbiter(PBWorld* world, int i);
 extern int PBWorldNumberOfContactsBetweenBodies(PBWorld* world, PBBody* body1, PBBody* body2);
+extern int PBWorldGetTouchingBodies(PBWorld* world, PBBody* body, PBBody** bodies, int maxBodies);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+// Smoke test for the threaded world in async.c.
+//
+//   asynccheck [steps]
+//
+// Steps the same pile of boxes twice, once with PBWorldStep and once on an
+// async world's worker thread, changing a body while each async step runs.
+// The change is applied to the plain world after its step, which is when
+// the async world applies it on join. Every front frame must match the
+// plain world bit for bit, and the contact events must add up to the pairs
+// touching at the end. Exits with status 1 on the first mismatch.
+//
+// Built with PB_THREADS and pthreads; the Playdate build has neither.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "playbox.h"
+#include "async.h"
+
+#define NUM_BOXES 60
+
+PBBody* PBWorldGetBody(PBWorld* world, int i);
+
+static unsigned int seed;
+
+static float randomFloat(float low, float high) {
+  seed = seed * 1664525u + 1013904223u;
+  return low + (high - low) * ((seed >> 8) * (1.0f / 16777216.0f));
+}
+
+static PBBody* addBox(PBWorld* world, float w, float h, float mass, float x, float y) {
+  PBBody* body = PBBodyCreate();
+  PBBodySet(body, PBVec2Make(w, h), mass);
+  body->position = PBVec2Make(x, y);
+  body->rotation = randomFloat(-0.2f, 0.2f);
+  PBWorldAddBody(world, body);
+  return body;
+}
+
+static PBWorld* createPile(void) {
+  PBWorld* world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), 10);
+  seed = 12345;
+  addBox(world, 40.0f, 1.0f, FLT_MAX, 0.0f, 10.0f);
+  for(int i = 0; i < NUM_BOXES; i++) {
+    addBox(world, randomFloat(0.5f, 1.0f), randomFloat(0.5f, 1.0f), 1.0f, (i % 10) - 4.5f, 8.0f - (i / 10) * 1.2f);
+  }
+  return world;
+}
+
+static void freePile(PBWorld* world) {
+  for(int i = world->bodies->count - 1; i >= 0; i--) {
+    PBBody* body = PBWorldGetBody(world, i);
+    PBWorldRemoveBody(world, body);
+    PBBodyFree(body);
+  }
+  PBWorldFree(world);
+}
+
+static int frameMatches(const PBWorldFrame* frame, PBWorld* world) {
+  if(frame->transforms->count != world->bodies->count) {
+    return 0;
+  }
+  const PBBodyTransform* transforms = frame->transforms->first;
+  for(int i = 0; i < world->bodies->count; i++) {
+    PBBody* body = PBWorldGetBody(world, i);
+    if(memcmp(&transforms[i].position, &body->position, sizeof(PBVec2)) != 0 ||
+       memcmp(&transforms[i].rotation, &body->rotation, sizeof(float)) != 0 ||
+       memcmp(&transforms[i].velocity, &body->velocity, sizeof(PBVec2)) != 0 ||
+       memcmp(&transforms[i].angularVelocity, &body->angularVelocity, sizeof(float)) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  int numSteps = argc > 1 ? atoi(argv[1]) : 300;
+  float dt = 1.0f / 30.0f;
+
+  PBWorld* world = createPile();
+  PBWorld* asyncWorld = createPile();
+  PBAsyncWorld* async = PBAsyncWorldCreate(asyncWorld);
+  if(async == NULL) {
+    fprintf(stderr, "asynccheck: couldn't start the worker thread\n");
+    return 2;
+  }
+
+  int touching = 0;
+  int numEvents = 0;
+  for(int step = 0; step < numSteps; step++) {
+    PBAsyncWorldBeginStep(async, dt);
+
+    // Kick a box every few steps while the worker is busy.
+    int kick = step % 7 == 0;
+    PBVec2 force = PBVec2Make(randomFloat(-200.0f, 200.0f), -300.0f);
+    int target = 1 + step % NUM_BOXES;
+    if(kick) {
+      PBAsyncWorldAddForce(async, PBWorldGetBody(asyncWorld, target), force);
+    }
+
+    PBWorldStep(world, dt);
+    PBAsyncWorldJoin(async);
+    if(kick) {
+      PBBodyAddForce(PBWorldGetBody(world, target), force);
+    }
+
+    const PBWorldFrame* frame = PBAsyncWorldGetFrame(async);
+    if(frame->step != step + 1 || !frameMatches(frame, world)) {
+      printf("asynccheck: frame %d differs from the synchronous step\n", step + 1);
+      return 1;
+    }
+    const PBContactEvent* events = frame->contactEvents->first;
+    for(int i = 0; i < frame->contactEvents->count; i++) {
+      touching += events[i].type == PBContactEventBegin ? 1 : -1;
+    }
+    numEvents += frame->contactEvents->count;
+  }
+
+  int expected = 0;
+  for(int i = 0; i < world->arbiters->count; i++) {
+    expected += PBWorldGetArbiter(world, i)->numContacts > 0;
+  }
+  if(touching != expected) {
+    printf("asynccheck: contact events leave %d pairs touching, the world has %d\n", touching, expected);
+    return 1;
+  }
+
+  printf("asynccheck: matched %d steps, %d contact events\n", numSteps, numEvents);
+
+  PBAsyncWorldFree(async);
+  freePile(asyncWorld);
+  freePile(world);
+  return 0;
+}
@@ -0,0 +1,169 @@
+// Times whole-world steps on the host.
+//
+//   bench [steps] [repeats]
+//
+// Every scene is built from a fixed seed, stepped through a warmup so the
+// piles settle, and then timed over the given number of steps (300 by
+// default). Bodies are added in shuffled order, as they would be after a
+// level has been played for a while, so the reorder variants show whether
+// spatial ordering helps the solver on this machine.
+//
+// Each scene is built and timed again for every repeat (5 by default),
+// going round the scenes in turn so a burst of load on the machine doesn't
+// land on one of them. The median is reported with the fastest and slowest
+// runs; differences inside that range are noise.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "playbox.h"
+
+#define WARMUP_STEPS 120
+#define MAX_REPEATS 32
+
+typedef struct {
+  const char* name;
+  int numBodies;
+  int reorderInterval;
+  float reorderThreshold;
+} BenchScene;
+
+static const BenchScene scenes[] = {
+  { "pile 250", 250, 0, 0.0f },
+  { "pile 250 reorder", 250, 60, 0.0f },
+  { "pile 1000", 1000, 0, 0.0f },
+  { "pile 1000 reorder", 1000, 60, 0.0f },
+  { "pile 1000 reorder 25%", 1000, 0, 0.25f },
+};
+
+static unsigned int seed;
+
+static float randomFloat(void) {
+  seed = seed * 1664525u + 1013904223u;
+  return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static double nowNanoseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static PBBody* addStatic(PBWorld* world, float x, float y, float w, float h) {
+  PBBody* body = PBBodyCreate();
+  PBBodySet(body, PBVec2Make(w, h), FLT_MAX);
+  body->position = PBVec2Make(x, y);
+  PBWorldAddBody(world, body);
+  return body;
+}
+
+// A bin as wide as the pile needs, filled from a grid of boxes and circles.
+static PBWorld* createPile(int numBodies, PBBody** bodies) {
+  PBWorld* world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), 10);
+  seed = 12345;
+
+  int columns = 25;
+  float width = columns * 0.6f;
+  bodies[numBodies] = addStatic(world, 0.0f, 1.0f, width + 2.0f, 1.0f);
+  bodies[numBodies + 1] = addStatic(world, -width * 0.5f - 0.5f, -20.0f, 1.0f, 42.0f);
+  bodies[numBodies + 2] = addStatic(world, width * 0.5f + 0.5f, -20.0f, 1.0f, 42.0f);
+
+  for(int i = 0; i < numBodies; i++) {
+    PBBody* body = PBBodyCreate();
+    float size = 0.3f + 0.2f * randomFloat();
+    if(i % 3 == 0) {
+      PBBodySetCircle(body, size * 0.5f, 1.0f);
+    }
+    else {
+      PBBodySet(body, PBVec2Make(size, size), 1.0f);
+    }
+    body->position = PBVec2Make((i % columns - columns * 0.5f + 0.5f) * 0.6f, -(i / columns) * 0.6f);
+    body->rotation = randomFloat();
+    body->friction = 0.5f;
+    bodies[i] = body;
+  }
+
+  // Shuffle so insertion order has nothing to do with position.
+  for(int i = numBodies - 1; i > 0; i--) {
+    int j = (int)(randomFloat() * (i + 1));
+    PBBody* t = bodies[i];
+    bodies[i] = bodies[j];
+    bodies[j] = t;
+  }
+  for(int i = 0; i < numBodies; i++) {
+    PBWorldAddBody(world, bodies[i]);
+  }
+
+  return world;
+}
+
+static void freeWorld(PBWorld* world, PBBody** bodies, int numBodies) {
+  PBWorldFree(world);
+  for(int i = 0; i < numBodies; i++) {
+    PBBodyFree(bodies[i]);
+  }
+}
+
+#define NUM_SCENES ((int)(sizeof(scenes) / sizeof(scenes[0])))
+
+typedef struct {
+  double times[MAX_REPEATS];  // ns per step
+  int contacts;
+  int reorders;
+} BenchResult;
+
+static void runScene(const BenchScene* scene, int steps, BenchResult* result, int repeat) {
+  const float dt = 1.0f / 30.0f;
+  PBBody** bodies = malloc((scene->numBodies + 3) * sizeof(PBBody*));
+  PBWorld* world = createPile(scene->numBodies, bodies);
+  PBWorldSetReorder(world, scene->reorderInterval, scene->reorderThreshold);
+
+  for(int i = 0; i < WARMUP_STEPS; i++) {
+    PBWorldStep(world, dt);
+  }
+
+  int reorders = 0;
+  double start = nowNanoseconds();
+  for(int i = 0; i < steps; i++) {
+    PBWorldStep(world, dt);
+    reorders += world->stats.reordered;
+  }
+  result->times[repeat] = (nowNanoseconds() - start) / steps;
+  result->contacts = world->arbiters->count;
+  result->reorders = reorders;
+
+  freeWorld(world, bodies, scene->numBodies + 3);
+  free(bodies);
+}
+
+static int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+  int steps = argc > 1 ? atoi(argv[1]) : 300;
+  int repeats = argc > 2 ? atoi(argv[2]) : 5;
+  if(steps <= 0 || repeats <= 0 || repeats > MAX_REPEATS) {
+    fprintf(stderr, "usage: bench [steps] [repeats up to %d]\n", MAX_REPEATS);
+    return 2;
+  }
+
+  static BenchResult results[NUM_SCENES];
+  for(int r = 0; r < repeats; r++) {
+    for(int s = 0; s < NUM_SCENES; s++) {
+      runScene(scenes + s, steps, results + s, r);
+    }
+  }
+
+  printf("%-24s %10s %10s %10s %10s %10s\n", "scene", "ns/step", "fastest", "slowest", "contacts", "reorders");
+  for(int s = 0; s < NUM_SCENES; s++) {
+    BenchResult* result = results + s;
+    qsort(result->times, repeats, sizeof(double), compareDoubles);
+    printf("%-24s %10.0f %10.0f %10.0f %10i %10i\n", scenes[s].name, result->times[repeats / 2], result->times[0], result->times[repeats - 1], result->contacts, result->reorders);
+  }
+
+  return 0;
+}
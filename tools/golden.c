@@ -0,0 +1,437 @@
+// Records and checks per-step body trajectories of reference scenes.
+//
+//   golden record dir [scene.pbscene ...]
+//   golden check dir [-tolerance position rotation velocity] [scene.pbscene ...]
+//
+// record steps every built-in scene, plus any scene files given, and writes
+// the position, rotation and velocities of every body after every step to
+// dir/<scene>.golden. check steps them again and compares against those
+// files. It reports the first step and body that differ by more than the
+// tolerances, and exits with status 1 if any scene diverged. The tolerances
+// are absolute and default to 0, which means bit-identical.
+//
+// Record with the build you trust, then check the build being optimized.
+// Golden files are specific to the compiler and CPU that recorded them,
+// unless both builds are made with DETERMINISTIC=1. Each scene also prints
+// its final state hash, to compare machines without copying files, and the
+// kinetic energy left in its dynamic bodies, which is zero once a stack has
+// come to rest.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "playbox.h"
+
+#define GOLDEN_MAGIC 0x444c4f47  // "GOLD"
+#define GOLDEN_VERSION 1
+#define MAX_BODIES 1024
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int32_t numSteps;
+  int32_t numBodies;
+  float dt;
+} GoldenHeader;
+
+typedef struct {
+  float positionX, positionY;
+  float rotation;
+  float velocityX, velocityY;
+  float angularVelocity;
+} GoldenBody;
+
+typedef struct {
+  PBWorld* world;
+  PBBody* bodies[MAX_BODIES];  // in creation order, which reordering can't change
+  int numBodies;
+  PBJoint* joints[MAX_BODIES];
+  int numJoints;
+  int ownsBodies;  // 0 for scenes loaded from files, whose bodies live in the scene block
+} GoldenScene;
+
+typedef struct {
+  const char* name;
+  void (*build)(GoldenScene* scene);
+  int numSteps;
+} GoldenSceneDef;
+
+static unsigned int seed;
+
+static float randomFloat(float low, float high) {
+  seed = seed * 1664525u + 1013904223u;
+  return low + (high - low) * ((seed >> 8) * (1.0f / 16777216.0f));
+}
+
+static PBBody* addBody(GoldenScene* scene, PBBody* body, float x, float y, float rotation) {
+  body->position = PBVec2Make(x, y);
+  body->rotation = rotation;
+  body->friction = 0.5f;
+  PBWorldAddBody(scene->world, body);
+  scene->bodies[scene->numBodies++] = body;
+  return body;
+}
+
+static PBBody* addBox(GoldenScene* scene, float w, float h, float mass, float x, float y, float rotation) {
+  PBBody* body = PBBodyCreate();
+  PBBodySet(body, PBVec2Make(w, h), mass);
+  return addBody(scene, body, x, y, rotation);
+}
+
+static void addJoint(GoldenScene* scene, PBBody* body1, PBBody* body2, PBVec2 anchor) {
+  PBJoint* joint = PBJointCreate(body1, body2, anchor);
+  PBWorldAddJoint(scene->world, joint);
+  scene->joints[scene->numJoints++] = joint;
+}
+
+// SCENES
+
+static void buildPyramid(GoldenScene* scene) {
+  scene->world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), 10);
+  addBox(scene, 40.0f, 1.0f, FLT_MAX, 0.0f, 10.0f, 0.0f);
+  for(int row = 0; row < 10; row++) {
+    for(int i = 0; i <= row; i++) {
+      addBox(scene, 1.0f, 1.0f, 1.0f, (i - row * 0.5f) * 1.05f, 9.0f - (9 - row) * 1.0f, 0.0f);
+    }
+  }
+}
+
+static void buildPyramidBlockSolver(GoldenScene* scene) {
+  buildPyramid(scene);
+  PBWorldSetBlockSolver(scene->world, 1);
+  PBWorldSetSplitImpulse(scene->world, 1);
+}
+
+// Ten boxes stacked on the ground with warm starting on, for comparing how
+// the solver modes settle at a given iteration count.
+static void buildStack(GoldenScene* scene, int iterations) {
+  scene->world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), iterations);
+  PBWorldSetSolverFlags(scene->world, PB_SOLVER_DEFAULT_FLAGS | PBSolverWarmStarting);
+  addBox(scene, 40.0f, 1.0f, FLT_MAX, 0.0f, 10.0f, 0.0f);
+  for(int i = 0; i < 10; i++) {
+    addBox(scene, 1.0f, 1.0f, 1.0f, 0.0f, 9.0f - i, 0.0f);
+  }
+}
+
+// With the pyramid's default solver settings, as a second check that a
+// solver refactor hasn't changed the output.
+static void buildStackDefault(GoldenScene* scene) {
+  buildStack(scene, 10);
+  PBWorldSetSolverFlags(scene->world, PB_SOLVER_DEFAULT_FLAGS);
+}
+
+static void buildStackSequential(GoldenScene* scene) {
+  buildStack(scene, 10);
+}
+
+static void buildStackBlockSolver(GoldenScene* scene) {
+  buildStack(scene, 6);
+  PBWorldSetBlockSolver(scene->world, 1);
+}
+
+// Split impulse against the sequential solver at the same low count.
+static void buildStackSequential4(GoldenScene* scene) {
+  buildStack(scene, 4);
+}
+
+static void buildStackSplitImpulse(GoldenScene* scene) {
+  buildStack(scene, 4);
+  PBWorldSetSplitImpulse(scene->world, 1);
+}
+
+static void buildStackSplitImpulseBlockSolver(GoldenScene* scene) {
+  buildStack(scene, 4);
+  PBWorldSetSplitImpulse(scene->world, 1);
+  PBWorldSetBlockSolver(scene->world, 1);
+}
+
+// Boxes, circles and triangles dropped into a bin.
+static void buildPile(GoldenScene* scene) {
+  scene->world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), 10);
+  addBox(scene, 12.0f, 1.0f, FLT_MAX, 0.0f, 10.0f, 0.0f);
+  addBox(scene, 1.0f, 20.0f, FLT_MAX, -6.5f, 0.0f, 0.0f);
+  addBox(scene, 1.0f, 20.0f, FLT_MAX, 6.5f, 0.0f, 0.1f);
+
+  seed = 12345;
+  for(int i = 0; i < 120; i++) {
+    float size = randomFloat(0.3f, 0.6f);
+    PBBody* body = PBBodyCreate();
+    if(i % 3 == 0) {
+      PBBodySetCircle(body, size * 0.5f, 1.0f);
+    }
+    else if(i % 3 == 1) {
+      PBBodySet(body, PBVec2Make(size, size), 1.0f);
+    }
+    else {
+      PBVec2 vertices[3] = { { -size * 0.5f, size * 0.4f }, { size * 0.5f, size * 0.4f }, { 0.0f, -size * 0.6f } };
+      PBBodySetPolygon(body, vertices, 3, 1.0f);
+    }
+    addBody(scene, body, (i % 10 - 4.5f) * 1.1f, 8.0f - (i / 10) * 1.1f, randomFloat(0.0f, 3.0f));
+  }
+}
+
+// A rope of boxes hanging from a static body, released from horizontal.
+static void buildChain(GoldenScene* scene) {
+  scene->world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), 10);
+  PBBody* previous = addBox(scene, 1.0f, 1.0f, FLT_MAX, 0.0f, 0.0f, 0.0f);
+  for(int i = 0; i < 15; i++) {
+    PBBody* link = addBox(scene, 0.75f, 0.25f, 1.0f, 0.5f + i, 0.0f, 0.0f);
+    addJoint(scene, previous, link, PBVec2Make((float)i, 0.0f));
+    previous = link;
+  }
+}
+
+// Fast bullets into thin walls.
+static void buildBullets(GoldenScene* scene) {
+  scene->world = PBWorldCreate(PBVec2Make(0.0f, 9.8f), 10);
+  addBox(scene, 40.0f, 1.0f, FLT_MAX, 0.0f, 10.0f, 0.0f);
+  addBox(scene, 0.1f, 10.0f, FLT_MAX, 10.0f, 5.0f, 0.0f);
+  addBox(scene, 0.5f, 4.0f, 2.0f, -10.0f, 7.5f, 0.0f);
+  for(int i = 0; i < 4; i++) {
+    PBBody* bullet = PBBodyCreate();
+    PBBodySetCircle(bullet, 0.1f, 0.2f);
+    bullet->bullet = 1;
+    bullet->velocity = PBVec2Make(i % 2 == 0 ? 300.0f : -300.0f, -2.0f * i);
+    addBody(scene, bullet, 0.0f, 2.0f + i * 1.5f, 0.0f);
+  }
+}
+
+static const GoldenSceneDef sceneDefs[] = {
+  { "pyramid", buildPyramid, 300 },
+  { "pyramid-block", buildPyramidBlockSolver, 300 },
+  { "stack", buildStackDefault, 300 },
+  { "stack-sequential", buildStackSequential, 300 },
+  { "stack-block", buildStackBlockSolver, 300 },
+  { "stack-sequential-4", buildStackSequential4, 300 },
+  { "stack-split", buildStackSplitImpulse, 300 },
+  { "stack-split-block", buildStackSplitImpulseBlockSolver, 300 },
+  { "pile", buildPile, 300 },
+  { "chain", buildChain, 300 },
+  { "bullets", buildBullets, 120 },
+};
+
+#define NUM_SCENES ((int)(sizeof(sceneDefs) / sizeof(sceneDefs[0])))
+
+static void* readFile(const char* path, int* size) {
+  FILE* file = fopen(path, "rb");
+  if(file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  *size = (int)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  void* data = malloc(*size);
+  if(fread(data, 1, *size, file) != (size_t)*size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+static int loadScene(GoldenScene* scene, const char* path) {
+  int size;
+  void* data = readFile(path, &size);
+  if(data == NULL) {
+    fprintf(stderr, "golden: can't read %s\n", path);
+    return 0;
+  }
+
+  scene->world = PBSceneLoad(data, size);
+  free(data);
+  if(scene->world == NULL) {
+    return 0;
+  }
+
+  PBScene* loaded = PBWorldGetScene(scene->world);
+  if(loaded->bodyCount > MAX_BODIES) {
+    fprintf(stderr, "golden: %s has more than %i bodies\n", path, MAX_BODIES);
+    PBWorldFree(scene->world);
+    return 0;
+  }
+  for(int i = 0; i < loaded->bodyCount; i++) {
+    scene->bodies[scene->numBodies++] = PBSceneGetBody(loaded, i);
+  }
+  return 1;
+}
+
+static void freeScene(GoldenScene* scene) {
+  PBWorldFree(scene->world);
+  if(scene->ownsBodies) {
+    for(int i = 0; i < scene->numJoints; i++) {
+      PBJointFree(scene->joints[i]);
+    }
+    for(int i = 0; i < scene->numBodies; i++) {
+      PBBodyFree(scene->bodies[i]);
+    }
+  }
+}
+
+// RECORDING AND CHECKING
+
+typedef struct {
+  float position, rotation, velocity;
+} GoldenTolerance;
+
+static GoldenBody captureBody(const PBBody* body) {
+  return (GoldenBody){
+    .positionX = body->position.x, .positionY = body->position.y,
+    .rotation = body->rotation,
+    .velocityX = body->velocity.x, .velocityY = body->velocity.y,
+    .angularVelocity = body->angularVelocity
+  };
+}
+
+static float difference(float a, float b) {
+  float d = a - b;
+  return d < 0.0f ? -d : d;
+}
+
+// Also fails on NaN, which compares false against any tolerance.
+static int withinTolerance(const GoldenBody* a, const GoldenBody* b, const GoldenTolerance* tolerance) {
+  return difference(a->positionX, b->positionX) <= tolerance->position &&
+    difference(a->positionY, b->positionY) <= tolerance->position &&
+    difference(a->rotation, b->rotation) <= tolerance->rotation &&
+    difference(a->velocityX, b->velocityX) <= tolerance->velocity &&
+    difference(a->velocityY, b->velocityY) <= tolerance->velocity &&
+    difference(a->angularVelocity, b->angularVelocity) <= tolerance->velocity;
+}
+
+static float getKineticEnergy(const GoldenScene* scene) {
+  float energy = 0.0f;
+  for(int i = 0; i < scene->numBodies; i++) {
+    const PBBody* body = scene->bodies[i];
+    if(body->invMass != 0.0f) {
+      energy += 0.5f * body->mass * PBVec2Dot(body->velocity, body->velocity);
+    }
+    if(body->invI != 0.0f) {
+      energy += 0.5f * body->I * body->angularVelocity * body->angularVelocity;
+    }
+  }
+  return energy;
+}
+
+static void printBody(const char* label, const GoldenBody* b) {
+  printf("  %-7s position %.9g, %.9g  rotation %.9g  velocity %.9g, %.9g  angular %.9g\n",
+    label, b->positionX, b->positionY, b->rotation, b->velocityX, b->velocityY, b->angularVelocity);
+}
+
+// Records when tolerance is NULL, checks otherwise. Returns 1 on success.
+static int runScene(GoldenScene* scene, const char* name, int numSteps, const char* path, const GoldenTolerance* tolerance) {
+  const float dt = 1.0f / 60.0f;
+  GoldenHeader header = { GOLDEN_MAGIC, GOLDEN_VERSION, numSteps, scene->numBodies, dt };
+  FILE* file = fopen(path, tolerance == NULL ? "wb" : "rb");
+  if(file == NULL) {
+    fprintf(stderr, "golden: can't open %s\n", path);
+    return 0;
+  }
+
+  if(tolerance == NULL) {
+    fwrite(&header, sizeof(header), 1, file);
+  }
+  else {
+    GoldenHeader recorded;
+    if(fread(&recorded, sizeof(recorded), 1, file) != 1 || recorded.magic != GOLDEN_MAGIC || recorded.version != GOLDEN_VERSION) {
+      fprintf(stderr, "golden: %s isn't a golden file\n", path);
+      fclose(file);
+      return 0;
+    }
+    if(recorded.numSteps != numSteps || recorded.numBodies != scene->numBodies || recorded.dt != dt) {
+      printf("%s: scene changed, recorded %i steps of %i bodies, now %i of %i\n", name, recorded.numSteps, recorded.numBodies, numSteps, scene->numBodies);
+      fclose(file);
+      return 0;
+    }
+  }
+
+  GoldenBody states[MAX_BODIES];
+  GoldenBody recordedStates[MAX_BODIES];
+  PBWorldSetStateHash(scene->world, 1);
+  for(int step = 0; step < numSteps; step++) {
+    PBWorldStep(scene->world, dt);
+    for(int i = 0; i < scene->numBodies; i++) {
+      states[i] = captureBody(scene->bodies[i]);
+    }
+
+    if(tolerance == NULL) {
+      fwrite(states, sizeof(GoldenBody), scene->numBodies, file);
+      continue;
+    }
+
+    if(fread(recordedStates, sizeof(GoldenBody), scene->numBodies, file) != (size_t)scene->numBodies) {
+      fprintf(stderr, "golden: %s is truncated\n", path);
+      fclose(file);
+      return 0;
+    }
+    for(int i = 0; i < scene->numBodies; i++) {
+      if(!withinTolerance(states + i, recordedStates + i, tolerance)) {
+        printf("%s: diverged at step %i, body %i\n", name, step + 1, i);
+        printBody("golden", recordedStates + i);
+        printBody("now", states + i);
+        fclose(file);
+        return 0;
+      }
+    }
+  }
+
+  fclose(file);
+  printf("%s: %s %i steps of %i bodies, hash %08x, energy %.3g\n", name, tolerance == NULL ? "recorded" : "matched", numSteps, scene->numBodies, PBWorldGetStateHash(scene->world), getKineticEnergy(scene));
+  return 1;
+}
+
+// The file name without directories or extension.
+static void getSceneName(const char* path, char* name, int size) {
+  const char* base = strrchr(path, '/');
+  base = base != NULL ? base + 1 : path;
+  snprintf(name, size, "%s", base);
+  char* dot = strrchr(name, '.');
+  if(dot != NULL && dot != name) {
+    *dot = '\0';
+  }
+}
+
+int main(int argc, char** argv) {
+  if(argc < 3 || (strcmp(argv[1], "record") != 0 && strcmp(argv[1], "check") != 0)) {
+    fprintf(stderr, "usage: golden record dir [scene.pbscene ...]\n");
+    fprintf(stderr, "       golden check dir [-tolerance position rotation velocity] [scene.pbscene ...]\n");
+    return 2;
+  }
+
+  int checking = strcmp(argv[1], "check") == 0;
+  const char* dir = argv[2];
+  GoldenTolerance tolerance = { 0.0f, 0.0f, 0.0f };
+  int firstFile = 3;
+  if(checking && argc >= 7 && strcmp(argv[3], "-tolerance") == 0) {
+    tolerance.position = atof(argv[4]);
+    tolerance.rotation = atof(argv[5]);
+    tolerance.velocity = atof(argv[6]);
+    firstFile = 7;
+  }
+
+  int numFailed = 0;
+  char path[1024];
+  char name[256];
+
+  for(int s = 0; s < NUM_SCENES; s++) {
+    GoldenScene scene = { .ownsBodies = 1 };
+    sceneDefs[s].build(&scene);
+    snprintf(path, sizeof(path), "%s/%s.golden", dir, sceneDefs[s].name);
+    numFailed += !runScene(&scene, sceneDefs[s].name, sceneDefs[s].numSteps, path, checking ? &tolerance : NULL);
+    freeScene(&scene);
+  }
+
+  for(int i = firstFile; i < argc; i++) {
+    GoldenScene scene = { .ownsBodies = 0 };
+    getSceneName(argv[i], name, sizeof(name));
+    if(!loadScene(&scene, argv[i])) {
+      numFailed++;
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s.golden", dir, name);
+    numFailed += !runScene(&scene, name, 300, path, checking ? &tolerance : NULL);
+    freeScene(&scene);
+  }
+
+  return numFailed > 0;
+}
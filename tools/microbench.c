@@ -0,0 +1,534 @@
+// Times the primitives the step is built from, in nanoseconds per call.
+//
+//   microbench [-n iterations] [-save file] [-check file] [-threshold percent]
+//
+// Inputs come from a fixed seed. Each benchmark is warmed up while doubling
+// the number of calls per run (at least 100000) until a run takes 20 ms,
+// then timed over 15 runs, taken in turn with the other benchmarks, and
+// reported as the median. The spread column is the interquartile range of
+// those runs as a percentage of the median.
+//
+// -save writes the results as a baseline file of "name ns" medians. -check
+// reads one and exits with status 1 if any benchmark got slower than the
+// baseline by more than the threshold (25% by default). The lower quartile
+// of the runs has to be over it as well, so a noisy run doesn't read as a
+// regression. Shared or frequency-scaled machines can drift further than
+// that between invocations; check a fresh baseline a few times to see how
+// much, and raise the threshold to match.
+//
+// Build with PB_SIMD or PB_FAST_TRIG to compare the maths modes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "playbox.h"
+
+// The clipping helper is private to the narrowphase, so this file compiles
+// collide.c itself and the Makefile leaves it out of the library sources.
+#include "collide.c"
+
+#define NUM_INPUTS 1024
+#define NUM_RUNS 15
+#define MIN_RUN_NANOSECONDS 20e6
+#define MAX_BENCHES 64
+
+typedef struct {
+  const char* name;
+  void (*setup)(void);
+  float (*run)(int iterations);
+} Microbench;
+
+static unsigned int seed;
+
+static float randomFloat(float low, float high) {
+  seed = seed * 1664525u + 1013904223u;
+  return low + (high - low) * ((seed >> 8) * (1.0f / 16777216.0f));
+}
+
+static PBVec2 randomVec2(float range) {
+  return PBVec2Make(randomFloat(-range, range), randomFloat(-range, range));
+}
+
+static double nowNanoseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// MATHS
+
+typedef struct {
+  PBVec2 v1, v2, r1, r2, n;
+  float w1, w2;
+} ContactInput;
+
+static ContactInput contactInputs[NUM_INPUTS];
+static float angles[NUM_INPUTS];
+
+static void setupMaths(void) {
+  for(int i = 0; i < NUM_INPUTS; i++) {
+    ContactInput* c = contactInputs + i;
+    c->v1 = randomVec2(5.0f);
+    c->v2 = randomVec2(5.0f);
+    c->r1 = randomVec2(1.0f);
+    c->r2 = randomVec2(1.0f);
+    c->n = randomVec2(1.0f);
+    c->w1 = randomFloat(-3.0f, 3.0f);
+    c->w2 = randomFloat(-3.0f, 3.0f);
+    angles[i] = randomFloat(-10.0f, 10.0f);
+  }
+}
+
+// The relative normal velocity at a contact, as the solver computes it.
+static float contactVelocity(int iterations) {
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    const ContactInput* c = contactInputs + (i & (NUM_INPUTS - 1));
+    PBVec2 dv = PBVec2Sub(PBVec2Add(c->v2, PBVec2FCross(c->w2, c->r2)), PBVec2Add(c->v1, PBVec2FCross(c->w1, c->r1)));
+    sum += PBVec2Dot(dv, c->n);
+  }
+  return sum;
+}
+
+// The same with every vector op forced out of line, which is what maths.c
+// used to compile to without link-time optimization.
+__attribute__((noinline)) static PBVec2 callAdd(PBVec2 a, PBVec2 b) { return PBVec2Add(a, b); }
+__attribute__((noinline)) static PBVec2 callSub(PBVec2 a, PBVec2 b) { return PBVec2Sub(a, b); }
+__attribute__((noinline)) static PBVec2 callFCross(float s, PBVec2 v) { return PBVec2FCross(s, v); }
+__attribute__((noinline)) static float callDot(PBVec2 a, PBVec2 b) { return PBVec2Dot(a, b); }
+
+static float contactVelocityCalls(int iterations) {
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    const ContactInput* c = contactInputs + (i & (NUM_INPUTS - 1));
+    PBVec2 dv = callSub(callAdd(c->v2, callFCross(c->w2, c->r2)), callAdd(c->v1, callFCross(c->w1, c->r1)));
+    sum += callDot(dv, c->n);
+  }
+  return sum;
+}
+
+static float rotate(int iterations) {
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    int j = i & (NUM_INPUTS - 1);
+    PBMat22 R = PBMat22MakeWithAngle(angles[j]);
+    sum += PBMat22MultVec(R, contactInputs[j].r1).x;
+  }
+  return sum;
+}
+
+// NARROWPHASE
+
+static PBBody collideA, collideB;
+
+static void setBox(PBBody* body, float w, float h, float x, float y, float rotation) {
+  PBBodyInit(body);
+  PBBodySet(body, PBVec2Make(w, h), 1.0f);
+  body->position = PBVec2Make(x, y);
+  body->rotation = rotation;
+}
+
+// Checks that a case takes the path it is named for: the contact normal
+// must lie along the expected box's axis, or there must be no contact.
+static void expectNormal(const char* name, const PBBody* box, int axis) {
+  PBContact contacts[MAX_ARBITER_POINTS];
+  int numContacts = PBCollide(contacts, &collideA, &collideB);
+  if(box == NULL) {
+    if(numContacts != 0) {
+      fprintf(stderr, "microbench: %s: expected no contact\n", name);
+      exit(2);
+    }
+    return;
+  }
+
+  PBMat22 R = PBMat22MakeWithAngle(box->rotation);
+  PBVec2 expected = axis == 0 ? R.col1 : R.col2;
+  if(numContacts == 0 || PBAbs(PBVec2Dot(contacts[0].normal, expected)) < 0.9999f) {
+    fprintf(stderr, "microbench: %s: contact normal isn't along the expected face\n", name);
+    exit(2);
+  }
+}
+
+// A is a long bar, B a small box resting on its top face.
+static void setupFaceAY(void) {
+  setBox(&collideA, 4.0f, 1.0f, 0.0f, 0.0f, 0.01f);
+  setBox(&collideB, 1.0f, 1.0f, 0.0f, -0.95f, 0.02f);
+  expectNormal("face a y", &collideA, 1);
+}
+
+// B against the end of A.
+static void setupFaceAX(void) {
+  setBox(&collideA, 4.0f, 1.0f, 0.0f, 0.0f, 0.01f);
+  setBox(&collideB, 1.0f, 1.0f, 2.45f, 0.0f, 0.02f);
+  expectNormal("face a x", &collideA, 0);
+}
+
+// A is a box balanced on its corner on B, so B's face separates least.
+static void setupFaceBY(void) {
+  setBox(&collideA, 1.0f, 1.0f, 0.0f, 0.0f, 0.7854f);
+  setBox(&collideB, 4.0f, 1.0f, 0.0f, 1.157f, 0.01f);
+  expectNormal("face b y", &collideB, 1);
+}
+
+static void setupFaceBX(void) {
+  setBox(&collideA, 1.0f, 1.0f, 0.0f, 0.0f, 0.7854f);
+  setBox(&collideB, 1.0f, 4.0f, 1.157f, 0.0f, 0.01f);
+  expectNormal("face b x", &collideB, 0);
+}
+
+// Both unrotated, which takes the axis-aligned shortcut.
+static void setupAligned(void) {
+  setBox(&collideA, 4.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+  setBox(&collideB, 1.0f, 1.0f, 0.3f, -0.95f, 0.0f);
+  expectNormal("aligned", &collideA, 1);
+}
+
+// Rejected by the bounding circle test in PBCollide.
+static void setupFar(void) {
+  setBox(&collideA, 1.0f, 1.0f, 0.0f, 0.0f, 0.1f);
+  setBox(&collideB, 1.0f, 1.0f, 5.0f, 0.0f, 0.2f);
+  expectNormal("far", NULL, 0);
+}
+
+// Close enough to pass the bounding circle, separated along A's faces.
+static void setupSeparatedA(void) {
+  setBox(&collideA, 4.0f, 1.0f, 0.0f, 0.0f, 0.01f);
+  setBox(&collideB, 1.0f, 1.0f, 0.0f, -1.2f, 0.02f);
+  expectNormal("separated a", NULL, 0);
+}
+
+// Overlapping along A's faces, separated along B's.
+static void setupSeparatedB(void) {
+  setBox(&collideA, 1.0f, 1.0f, 0.0f, 0.0f, 0.7854f);
+  setBox(&collideB, 4.0f, 1.0f, 0.0f, 1.3f, 0.01f);
+  expectNormal("separated b", NULL, 0);
+}
+
+static float collide(int iterations) {
+  PBContact contacts[MAX_ARBITER_POINTS];
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    sum += PBCollide(contacts, &collideA, &collideB);
+  }
+  return sum;
+}
+
+static PBClipVertex clipInputs[NUM_INPUTS][2];
+
+static void setupClip(void) {
+  for(int i = 0; i < NUM_INPUTS; i++) {
+    clipInputs[i][0].v = randomVec2(1.0f);
+    clipInputs[i][1].v = randomVec2(1.0f);
+    clipInputs[i][0].fp.value = 0;
+    clipInputs[i][1].fp.value = 0;
+  }
+}
+
+// Half the segments cross the line, so both clipping branches run.
+static float clipSegment(int iterations) {
+  PBClipVertex out[2];
+  PBVec2 normal = PBVec2Make(0.0f, 1.0f);
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    sum += PBClipSegmentToLine(out, clipInputs[i & (NUM_INPUTS - 1)], normal, 0.0f, EDGE1);
+  }
+  return sum;
+}
+
+// SOLVER
+
+static PBArbiter* arbiter;
+static PBContactConstraint constraint;
+static PBJoint joint;
+static PBSolverBody solverBodies[2];
+
+static void resetSolverBodies(void) {
+  for(int i = 0; i < 2; i++) {
+    PBBody* body = i == 0 ? &collideA : &collideB;
+    body->solverIndex = i;
+    memset(solverBodies + i, 0, sizeof(PBSolverBody));
+    solverBodies[i].velocity = body->velocity;
+    solverBodies[i].invMass = body->invMass;
+    solverBodies[i].invI = body->invI;
+  }
+}
+
+// A box resting on a bar with two contact points.
+static void setupArbiter(void) {
+  setBox(&collideA, 4.0f, 1.0f, 0.0f, 0.0f, 0.01f);
+  setBox(&collideB, 1.0f, 1.0f, 0.0f, -0.95f, 0.02f);
+  collideB.velocity = PBVec2Make(0.1f, 0.5f);
+  collideB.friction = collideA.friction = 0.5f;
+
+  PBContact contacts[MAX_ARBITER_POINTS];
+  int numContacts = PBCollide(contacts, &collideA, &collideB);
+  if(arbiter != NULL) {
+    PBArbiterFree(arbiter);
+  }
+  arbiter = PBArbiterCreateWithContacts(&collideA, &collideB, contacts, numContacts);
+  resetSolverBodies();
+  PBArbiterPreStep(arbiter, &constraint, solverBodies, 60.0f, 0, PB_SOLVER_DEFAULT_FLAGS);
+}
+
+static float arbiterPreStep(int iterations) {
+  for(int i = 0; i < iterations; i++) {
+    PBArbiterPreStep(arbiter, &constraint, solverBodies, 60.0f, 0, PB_SOLVER_DEFAULT_FLAGS);
+  }
+  return constraint.points[0].massNormal;
+}
+
+static float arbiterApplyImpulse(int iterations) {
+  PBContactSolveFunction solve = PBContactConstraintGetSolveFunction(PB_SOLVER_DEFAULT_FLAGS, 0);
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    sum += solve(&constraint, solverBodies);
+  }
+  return sum;
+}
+
+// A pendulum hanging from a heavy body.
+static void setupJoint(void) {
+  setBox(&collideA, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+  setBox(&collideB, 0.2f, 2.0f, 0.0f, 1.0f, 0.3f);
+  collideB.velocity = PBVec2Make(1.0f, 0.0f);
+  PBJointInit(&joint, &collideA, &collideB, PBVec2Make(0.0f, 0.0f));
+  resetSolverBodies();
+  PBJointPreStep(&joint, solverBodies, 60.0f, PB_SOLVER_DEFAULT_FLAGS);
+}
+
+static float jointPreStep(int iterations) {
+  for(int i = 0; i < iterations; i++) {
+    PBJointPreStep(&joint, solverBodies, 60.0f, PB_SOLVER_DEFAULT_FLAGS);
+  }
+  return joint.M.col1.x;
+}
+
+static float jointApplyImpulse(int iterations) {
+  float sum = 0.0f;
+  for(int i = 0; i < iterations; i++) {
+    sum += PBJointApplyImpulse(&joint, solverBodies);
+  }
+  return sum;
+}
+
+// ARRAYS
+
+static PBArray* array;
+static int arraySize;
+
+static void setupArray(int size) {
+  if(array != NULL) {
+    PBArrayFree(array);
+  }
+  array = PBArrayCreate(sizeof(size_t));
+  arraySize = size;
+  for(size_t i = 1; i <= (size_t)size; i++) {
+    PBArrayAppendItem(array, &i);
+  }
+}
+
+static void setupArray16(void) { setupArray(16); }
+static void setupArray256(void) { setupArray(256); }
+static void setupArray4096(void) { setupArray(4096); }
+
+// Fills to the size and empties again, keeping the allocation, so growth
+// is only paid on the first pass.
+static float arrayAppend(int iterations) {
+  size_t item = 1;
+  for(int i = 0; i < iterations; i++) {
+    if(array->count == arraySize) {
+      array->count = 0;
+    }
+    PBArrayAppendItem(array, &item);
+  }
+  return array->count;
+}
+
+// Removes from the middle and appends to stay at the same size.
+static float arrayRemoveAt(int iterations) {
+  size_t item = 1;
+  for(int i = 0; i < iterations; i++) {
+    PBArrayRemoveItemAt(array, array->count / 2);
+    PBArrayAppendItem(array, &item);
+  }
+  return array->count;
+}
+
+static const Microbench benches[] = {
+  { "maths/contact-velocity", setupMaths, contactVelocity },
+  { "maths/contact-velocity-calls", setupMaths, contactVelocityCalls },
+  { "maths/rotate", setupMaths, rotate },
+  { "collide/far", setupFar, collide },
+  { "collide/separated-a", setupSeparatedA, collide },
+  { "collide/separated-b", setupSeparatedB, collide },
+  { "collide/aligned", setupAligned, collide },
+  { "collide/face-a-x", setupFaceAX, collide },
+  { "collide/face-a-y", setupFaceAY, collide },
+  { "collide/face-b-x", setupFaceBX, collide },
+  { "collide/face-b-y", setupFaceBY, collide },
+  { "collide/clip-segment", setupClip, clipSegment },
+  { "solver/arbiter-prestep", setupArbiter, arbiterPreStep },
+  { "solver/arbiter-apply-impulse", setupArbiter, arbiterApplyImpulse },
+  { "solver/joint-prestep", setupJoint, jointPreStep },
+  { "solver/joint-apply-impulse", setupJoint, jointApplyImpulse },
+  { "array/append-16", setupArray16, arrayAppend },
+  { "array/append-4096", setupArray4096, arrayAppend },
+  { "array/remove-at-16", setupArray16, arrayRemoveAt },
+  { "array/remove-at-256", setupArray256, arrayRemoveAt },
+  { "array/remove-at-4096", setupArray4096, arrayRemoveAt },
+};
+
+#define NUM_BENCHES ((int)(sizeof(benches) / sizeof(benches[0])))
+
+// Results are summed into a volatile float so the work can't be optimized away.
+static volatile float sink;
+
+typedef struct {
+  double median;
+  double lowerQuartile;
+  double spread;  // interquartile range, percent of the median
+} MicrobenchResult;
+
+static int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Grows the number of calls until a run is long enough to time reliably.
+static int calibrateBench(const Microbench* bench, int iterations) {
+  seed = 12345;
+  bench->setup();
+  for(;;) {
+    double start = nowNanoseconds();
+    sink += bench->run(iterations);
+    if(nowNanoseconds() - start >= MIN_RUN_NANOSECONDS || iterations > (1 << 29)) {
+      return iterations;
+    }
+    iterations *= 2;
+  }
+}
+
+static double timeBench(const Microbench* bench, int iterations) {
+  seed = 12345;
+  bench->setup();
+  sink += bench->run(iterations / 8 + 1);
+  
+  double start = nowNanoseconds();
+  sink += bench->run(iterations);
+  return (nowNanoseconds() - start) / iterations;
+}
+
+// Runs go round the benchmarks rather than repeating one, so a burst of
+// load on the machine spreads over all of them instead of one median.
+static void runBenches(MicrobenchResult* results, int minIterations) {
+  int iterations[NUM_BENCHES];
+  for(int b = 0; b < NUM_BENCHES; b++) {
+    iterations[b] = calibrateBench(benches + b, minIterations);
+  }
+  
+  static double times[NUM_BENCHES][NUM_RUNS];
+  for(int r = 0; r < NUM_RUNS; r++) {
+    for(int b = 0; b < NUM_BENCHES; b++) {
+      times[b][r] = timeBench(benches + b, iterations[b]);
+    }
+  }
+  
+  for(int b = 0; b < NUM_BENCHES; b++) {
+    qsort(times[b], NUM_RUNS, sizeof(double), compareDoubles);
+    results[b].median = times[b][NUM_RUNS / 2];
+    results[b].lowerQuartile = times[b][NUM_RUNS / 4];
+    results[b].spread = (times[b][NUM_RUNS * 3 / 4] - times[b][NUM_RUNS / 4]) / results[b].median * 100.0;
+  }
+}
+
+// Returns the number of benchmarks over the threshold.
+static int checkBaseline(const char* path, const MicrobenchResult* results, float threshold) {
+  FILE* file = fopen(path, "r");
+  if(file == NULL) {
+    fprintf(stderr, "microbench: can't read %s\n", path);
+    exit(2);
+  }
+
+  int numSlower = 0;
+  char name[128];
+  double baseline;
+  while(fscanf(file, "%127s %lf", name, &baseline) == 2) {
+    for(int b = 0; b < NUM_BENCHES; b++) {
+      if(strcmp(benches[b].name, name) != 0) {
+        continue;
+      }
+      // Load on the machine only ever adds time, so a real regression also
+      // moves the fastest quarter of the runs.
+      double change = (results[b].median - baseline) / baseline * 100.0;
+      double lowerChange = (results[b].lowerQuartile - baseline) / baseline * 100.0;
+      if(change > threshold && lowerChange > threshold) {
+        printf("SLOWER %-32s %10.2f -> %.2f ns (%+.1f%%)\n", name, baseline, results[b].median, change);
+        numSlower++;
+      }
+    }
+  }
+
+  fclose(file);
+  return numSlower;
+}
+
+int main(int argc, char** argv) {
+  int iterations = 100000;
+  const char* savePath = NULL;
+  const char* checkPath = NULL;
+  float threshold = 25.0f;
+
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "-save") == 0 && i + 1 < argc) {
+      savePath = argv[++i];
+    }
+    else if(strcmp(argv[i], "-check") == 0 && i + 1 < argc) {
+      checkPath = argv[++i];
+    }
+    else if(strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    }
+    else {
+      fprintf(stderr, "usage: microbench [-n iterations] [-save file] [-check file] [-threshold percent]\n");
+      return 2;
+    }
+  }
+
+#ifdef PB_SIMD
+  printf("PB_SIMD\n");
+#endif
+#ifdef PB_FAST_TRIG
+  printf("PB_FAST_TRIG\n");
+#endif
+  printf("%-32s %10s %8s\n", "benchmark", "ns/call", "spread");
+
+  MicrobenchResult results[NUM_BENCHES];
+  runBenches(results, iterations);
+  for(int b = 0; b < NUM_BENCHES; b++) {
+    printf("%-32s %10.2f %7.1f%%\n", benches[b].name, results[b].median, results[b].spread);
+  }
+
+  if(savePath != NULL) {
+    FILE* file = fopen(savePath, "w");
+    if(file == NULL) {
+      fprintf(stderr, "microbench: can't write %s\n", savePath);
+      return 2;
+    }
+    for(int b = 0; b < NUM_BENCHES; b++) {
+      fprintf(file, "%s %.3f\n", benches[b].name, results[b].median);
+    }
+    fclose(file);
+  }
+
+  if(checkPath != NULL && checkBaseline(checkPath, results, threshold) > 0) {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,289 @@
+// Converts a text scene description into the binary format read by
+// PBSceneLoad and playbox.world.loadScene.
+//
+//   scenec level.txt level.pbscene
+//
+// Each line is a kind followed by key=value pairs. Vectors are "x,y" and
+// polygon vertices are "x,y;x,y;...". Bodies are numbered from 0 in the
+// order they appear, which is how joints refer to them.
+//
+//   world gravity=0,9.8 iterations=10 pixelScale=32 blockSolver=1
+//   box size=10,1 position=0,8
+//   box size=1,1 mass=1 position=0,2 friction=0.5 tag=7
+//   circle radius=0.5 mass=1 position=2,0 bullet=1
+//   polygon vertices=0,0;1,0;0,1 mass=1 position=-2,0
+//   joint bodies=1,2 anchor=1,2 softness=0.01
+//
+// Bodies without a mass are static. Lines starting with # are comments.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene.h"
+
+static PBSceneHeader header;
+static PBSceneBody* bodies;
+static int bodyCapacity;
+static PBSceneJoint* joints;
+static int jointCapacity;
+
+static int lineNumber;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "scenec: line %i: %s%s%s\n", lineNumber, message, detail ? ": " : "", detail ? detail : "");
+  exit(1);
+}
+
+static PBVec2 parseVec2(const char* value) {
+  PBVec2 v;
+  if(sscanf(value, "%f,%f", &v.x, &v.y) != 2) {
+    fail("expected x,y", value);
+  }
+  return v;
+}
+
+static int parseVertices(const char* value, PBVec2* vertices) {
+  int count = 0;
+  const char* p = value;
+  while(*p != '\0') {
+    if(count == PB_SCENE_MAX_VERTICES) {
+      fail("too many vertices", value);
+    }
+    vertices[count++] = parseVec2(p);
+    p = strchr(p, ';');
+    if(p == NULL) {
+      break;
+    }
+    p++;
+  }
+  return count;
+}
+
+static void parseWorldKey(const char* key, const char* value) {
+  if(strcmp(key, "gravity") == 0) {
+    header.gravity = parseVec2(value);
+  }
+  else if(strcmp(key, "iterations") == 0) {
+    header.iterations = atoi(value);
+  }
+  else if(strcmp(key, "pixelScale") == 0) {
+    header.pixelScale = strtof(value, NULL);
+  }
+  else if(strcmp(key, "solverTolerance") == 0) {
+    header.solverTolerance = strtof(value, NULL);
+  }
+  else if(strcmp(key, "minIterations") == 0) {
+    header.minIterations = atoi(value);
+  }
+  else if(strcmp(key, "manifoldReuse") == 0) {
+    PBVec2 tolerances = parseVec2(value);
+    header.manifoldReuseLinearTolerance = tolerances.x;
+    header.manifoldReuseAngularTolerance = tolerances.y;
+  }
+  else if(strcmp(key, "blockSolver") == 0) {
+    header.flags |= atoi(value) ? PBSceneWorldBlockSolver : 0;
+  }
+  else if(strcmp(key, "splitImpulse") == 0) {
+    header.flags |= atoi(value) ? PBSceneWorldSplitImpulse : 0;
+  }
+  else if(strcmp(key, "bulletsHitDynamic") == 0) {
+    header.flags |= atoi(value) ? PBSceneWorldBulletsHitDynamic : 0;
+  }
+  else {
+    fail("unknown world key", key);
+  }
+}
+
+static void parseBodyKey(PBSceneBody* body, const char* key, const char* value) {
+  if(strcmp(key, "size") == 0) {
+    body->size = parseVec2(value);
+  }
+  else if(strcmp(key, "radius") == 0) {
+    body->radius = strtof(value, NULL);
+  }
+  else if(strcmp(key, "vertices") == 0) {
+    body->vertexCount = parseVertices(value, body->vertices);
+  }
+  else if(strcmp(key, "mass") == 0) {
+    body->mass = strtof(value, NULL);
+  }
+  else if(strcmp(key, "friction") == 0) {
+    body->friction = strtof(value, NULL);
+  }
+  else if(strcmp(key, "position") == 0) {
+    body->position = parseVec2(value);
+  }
+  else if(strcmp(key, "rotation") == 0) {
+    body->rotation = strtof(value, NULL);
+  }
+  else if(strcmp(key, "velocity") == 0) {
+    body->velocity = parseVec2(value);
+  }
+  else if(strcmp(key, "angularVelocity") == 0) {
+    body->angularVelocity = strtof(value, NULL);
+  }
+  else if(strcmp(key, "fixedRotation") == 0) {
+    body->flags |= atoi(value) ? PBSceneBodyFixedRotation : 0;
+  }
+  else if(strcmp(key, "bullet") == 0) {
+    body->flags |= atoi(value) ? PBSceneBodyBullet : 0;
+  }
+  else if(strcmp(key, "tag") == 0) {
+    body->tag = atoi(value);
+  }
+  else {
+    fail("unknown body key", key);
+  }
+}
+
+static void parseJointKey(PBSceneJoint* joint, const char* key, const char* value) {
+  if(strcmp(key, "bodies") == 0) {
+    if(sscanf(value, "%d,%d", &joint->body1, &joint->body2) != 2) {
+      fail("expected two body indices", value);
+    }
+  }
+  else if(strcmp(key, "anchor") == 0) {
+    joint->anchor = parseVec2(value);
+  }
+  else if(strcmp(key, "softness") == 0) {
+    joint->softness = strtof(value, NULL);
+  }
+  else if(strcmp(key, "biasFactor") == 0) {
+    joint->biasFactor = strtof(value, NULL);
+  }
+  else {
+    fail("unknown joint key", key);
+  }
+}
+
+static PBSceneBody* addBody(int shapeType) {
+  if(header.bodyCount == bodyCapacity) {
+    bodyCapacity = bodyCapacity ? bodyCapacity * 2 : 64;
+    bodies = realloc(bodies, bodyCapacity * sizeof(PBSceneBody));
+  }
+  PBSceneBody* body = bodies + header.bodyCount++;
+  memset(body, 0, sizeof(PBSceneBody));
+  body->shapeType = shapeType;
+  body->size = (PBVec2){ 1.0f, 1.0f };
+  body->friction = 0.2f;
+  return body;
+}
+
+static PBSceneJoint* addJoint(void) {
+  if(header.jointCount == jointCapacity) {
+    jointCapacity = jointCapacity ? jointCapacity * 2 : 16;
+    joints = realloc(joints, jointCapacity * sizeof(PBSceneJoint));
+  }
+  PBSceneJoint* joint = joints + header.jointCount++;
+  memset(joint, 0, sizeof(PBSceneJoint));
+  joint->body1 = -1;
+  joint->body2 = -1;
+  joint->biasFactor = 0.2f;
+  return joint;
+}
+
+static void parseLine(char* line) {
+  char* kind = strtok(line, " \t\r\n");
+  if(kind == NULL || kind[0] == '#') {
+    return;
+  }
+  
+  PBSceneBody* body = NULL;
+  PBSceneJoint* joint = NULL;
+  int isWorld = 0;
+  if(strcmp(kind, "world") == 0) {
+    isWorld = 1;
+  }
+  else if(strcmp(kind, "box") == 0) {
+    body = addBody(PBShapeTypeBox);
+  }
+  else if(strcmp(kind, "circle") == 0) {
+    body = addBody(PBShapeTypeCircle);
+  }
+  else if(strcmp(kind, "polygon") == 0) {
+    body = addBody(PBShapeTypePolygon);
+  }
+  else if(strcmp(kind, "joint") == 0) {
+    joint = addJoint();
+  }
+  else {
+    fail("unknown kind", kind);
+  }
+  
+  for(char* token = strtok(NULL, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+    char* value = strchr(token, '=');
+    if(value == NULL) {
+      fail("expected key=value", token);
+    }
+    *value++ = '\0';
+    
+    if(isWorld) {
+      parseWorldKey(token, value);
+    }
+    else if(body != NULL) {
+      parseBodyKey(body, token, value);
+    }
+    else {
+      parseJointKey(joint, token, value);
+    }
+  }
+  
+  if(body != NULL && body->shapeType == PBShapeTypePolygon && body->vertexCount < 3) {
+    fail("polygon needs at least 3 vertices", NULL);
+  }
+  if(body != NULL && body->shapeType == PBShapeTypeCircle && body->radius <= 0.0f) {
+    fail("circle needs a radius", NULL);
+  }
+  if(joint != NULL && (joint->body1 < 0 || joint->body1 >= header.bodyCount || joint->body2 < 0 || joint->body2 >= header.bodyCount)) {
+    fail("joint bodies must be defined before the joint", NULL);
+  }
+}
+
+int main(int argc, char** argv) {
+  if(argc != 3) {
+    fprintf(stderr, "usage: scenec input.txt output.pbscene\n");
+    return 1;
+  }
+  
+  const uint16_t endian = 1;
+  if(*(const uint8_t*)&endian != 1) {
+    fprintf(stderr, "scenec: scenes are little-endian and this host is not\n");
+    return 1;
+  }
+  
+  FILE* input = fopen(argv[1], "r");
+  if(input == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  
+  header.magic = PB_SCENE_MAGIC;
+  header.version = PB_SCENE_VERSION;
+  header.gravity = (PBVec2){ 0.0f, 9.8f };
+  header.iterations = 10;
+  header.pixelScale = 1.0f;
+  header.minIterations = 1;
+  
+  char line[4096];
+  while(fgets(line, sizeof(line), input) != NULL) {
+    lineNumber++;
+    parseLine(line);
+  }
+  fclose(input);
+  
+  header.size = sizeof(PBSceneHeader) + header.bodyCount * sizeof(PBSceneBody) + header.jointCount * sizeof(PBSceneJoint);
+  
+  FILE* output = fopen(argv[2], "wb");
+  if(output == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+  fwrite(&header, sizeof(header), 1, output);
+  fwrite(bodies, sizeof(PBSceneBody), header.bodyCount, output);
+  fwrite(joints, sizeof(PBSceneJoint), header.jointCount, output);
+  fclose(output);
+  
+  printf("%s: %i bodies, %i joints, %u bytes\n", argv[2], (int)header.bodyCount, (int)header.jointCount, (unsigned)header.size);
+  return 0;
+}